@@ -0,0 +1,36 @@
+#include "benchmark.hpp"
+
+#include <simulator/particle_grid.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <vector>
+#include <cstdio>
+#include <memory>
+
+using namespace unibox;
+
+void bench::batching() {
+    const uint batches[] = { 1, 10, 100 };
+    const uint count = 100000;
+    const uint worldSize = 1024;
+    const uint ticks = 300;
+
+    const std::vector<Voxel> voxels = createScene("sand", count, worldSize);
+    for(uint batch : batches) {
+        auto grid = std::make_unique<ParticleGrid>(worldSize, worldSize, 1);
+        if(!grid->addVoxels(0, 0, 0, voxels)) continue;
+
+        // Warm up, the first tick includes the driver's own setup work.
+        grid->simulate(1);
+        grid->finish();
+
+        // Each call is the same round trip as a frame of the app, the particles come back to the host once per batch.
+        double time = measure([&]() {
+            for(uint done = 0; done < ticks; done += batch) grid->simulate(batch);
+            grid->finish();
+        });
+        report("batching", std::to_string(batch) + " ticks per call, " + std::to_string(count) + " sand", ticks, time);
+        printf("%-16s %.1f ticks per second\n", "", ticks/time);
+    }
+}
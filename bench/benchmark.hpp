@@ -0,0 +1,41 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <simulator/voxel.hpp>
+#include <compute/grid_pipeline.hpp>
+
+#include <nlohmann/json.hpp>
+
+namespace unibox::bench {
+    template<typename F> double measure(F func) {
+        auto start = std::chrono::high_resolution_clock::now();
+        func();
+        auto end = std::chrono::high_resolution_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count()/1000000000.0;
+    }
+
+    // Prints a result and keeps it for the JSON output, the parameters are stored next to it for later filtering.
+    void report(const std::string& suite, const std::string& name, size_t operations, double seconds, const nlohmann::json& parameters = nlohmann::json::object());
+
+    // Whether either the OpenCL or the native backend is running.
+    bool hasBackend();
+
+    // Particle mixes from the unibox pack: "sand" falls, "circuit" is copper wiring carrying sparks,
+    // "mixed" scatters sand, copper, silicon, fiber and photons. Cells are unique and random.
+    std::vector<Voxel> createScene(const std::string& mix, uint count, uint worldSize);
+    extern const char* const mixes[3];
+    // Pipeline of a worldSize^2 grid holding the given voxels with every brick reserved, the particles are
+    // released already. 0 if the storage can't be allocated.
+    GridPipeline* createPipeline(Simulator& simulator, MeshGenPipeline& meshGenerator, const std::vector<Voxel>& voxels, uint worldSize);
+
+    // Suites
+    void occupancyIndex();
+    void simulation();
+    void sorting();
+    void batching();
+    void particleGrid();
+    void pipeline();
+}
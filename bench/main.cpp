@@ -0,0 +1,158 @@
+#include "benchmark.hpp"
+
+#include <cl-engine/engine.hpp>
+#include <native-engine/engine.hpp>
+#include <simulator/particle.hpp>
+#include <simulator/particle_grid.hpp>
+#include <util/finalizer.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <random>
+#include <algorithm>
+
+using namespace unibox;
+
+static nlohmann::json results = nlohmann::json::array();
+
+void bench::report(const std::string& suite, const std::string& name, size_t operations, double seconds, const nlohmann::json& parameters) {
+    printf("%-16s %-32s %10zu ops %12.3f ms %10.2f ns/op\n", suite.c_str(), name.c_str(), operations, seconds*1000.0, seconds*1000000000.0/operations);
+    nlohmann::json result = {
+        { "suite", suite },
+        { "name", name },
+        { "operations", operations },
+        { "seconds", seconds },
+        { "nsPerOp", seconds*1000000000.0/operations }
+    };
+    if(!parameters.empty()) result["parameters"] = parameters;
+    results.push_back(result);
+}
+
+bool bench::hasBackend() {
+    return ClEngine::getInstance() != 0 || NativeEngine::getInstance() != 0;
+}
+
+const char* const bench::mixes[3] = { "sand", "circuit", "mixed" };
+
+std::vector<Voxel> bench::createScene(const std::string& mix, uint count, uint worldSize) {
+    std::vector<uint> cells(worldSize*worldSize);
+    for(uint i = 0; i < cells.size(); i++) cells[i] = i;
+    std::shuffle(cells.begin(), cells.end(), std::mt19937(count ^ worldSize));
+    count = std::min<uint>(count, cells.size());
+
+    const ushort sand = Particle::getParticleId("unibox:sand");
+    const ushort copper = Particle::getParticleId("unibox:copper");
+    const ushort spark = Particle::getParticleId("unibox:spark");
+    const ushort mixed[] = {
+        sand, copper,
+        Particle::getParticleId("unibox:psilicon"),
+        Particle::getParticleId("unibox:nsilicon"),
+        Particle::getParticleId("unibox:optical_fiber"),
+        Particle::getParticleId("unibox:photon")
+    };
+
+    std::vector<Voxel> voxels(count);
+    for(uint i = 0; i < count; i++) {
+        Voxel& voxel = voxels[i];
+        voxel = {};
+        voxel.position[0] = cells[i]%worldSize;
+        voxel.position[1] = cells[i]/worldSize;
+        if(mix == "sand") {
+            voxel.type = sand;
+            voxel.velocity[1] = -1;
+        } else if(mix == "circuit") {
+            // One live spark for every 64 conductors.
+            voxel.type = i%64 == 0 ? spark : copper;
+            voxel.stype = i%64 == 0 ? copper : 0;
+            voxel.data[0] = i%64 == 0 ? 2 : 0;
+        } else {
+            voxel.type = mixed[i%6];
+            if(voxel.type == sand) voxel.velocity[1] = -1;
+            else if(voxel.type == mixed[5]) voxel.velocity[0] = 1;
+        }
+    }
+    return voxels;
+}
+
+GridPipeline* bench::createPipeline(Simulator& simulator, MeshGenPipeline& meshGenerator, const std::vector<Voxel>& voxels, uint worldSize) {
+    const GridInfo info = GridInfo::create(worldSize, worldSize, 1);
+    GridPipeline* pipeline = GridPipeline::create(simulator, meshGenerator, info);
+    if(!pipeline->resize(voxels.size(), 0)) {
+        delete pipeline;
+        return 0;
+    }
+    for(size_t i = 0; i < voxels.size(); i++) packVoxel(voxels[i], pipeline->getParticles()[i], pipeline->getParticleData()[i]);
+    pipeline->setEmitBase(voxels.size());
+    // Shuffled cells touch every brick of the world.
+    pipeline->reserveBricks(info.getBrickCount());
+    pipeline->releaseParticles();
+    return pipeline;
+}
+
+// unibox-bench [--json <file>] [--backend native] [suite...]
+int main(int argc, char** argv) {
+    std::string jsonPath;
+    std::set<std::string> suites;
+    // Like unibox, the native backend is also used when there is no OpenCL device.
+    bool nativeBackend = false;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--json") == 0 && i+1 < argc) jsonPath = argv[++i];
+        else if(strcmp(argv[i], "--backend") == 0 && i+1 < argc) nativeBackend = strcmp(argv[++i], "native") == 0;
+        else suites.insert(argv[i]);
+    }
+    auto enabled = [&suites](const char* suite) { return suites.empty() || suites.count(suite) > 0; };
+
+    if(enabled("occupancy")) bench::occupancyIndex();
+
+    // The remaining suites need a simulation backend and the particle packs, run from the same directory as unibox.
+    std::string device = "none";
+    Finalizer* finalizer = new Finalizer();
+    {
+        ClEngine* clEngine = 0;
+        NativeEngine* nativeEngine = 0;
+        if(!nativeBackend) {
+            clEngine = new ClEngine();
+            if(ClEngine::getInstance() != 0) device = clEngine->getDevice().getInfo<CL_DEVICE_NAME>();
+            else spdlog::warn("Falling back to the native simulation backend.");
+        }
+        if(ClEngine::getInstance() == 0) {
+            nativeEngine = new NativeEngine();
+            device = "native, " + std::to_string(nativeEngine->getThreadPool().getThreadCount()) + " threads";
+        }
+        Particle::loadParticles();
+
+        if(enabled("simulation")) bench::simulation();
+        if(enabled("sorting")) bench::sorting();
+        // These go through ParticleGrid, which shares its compute setup between every grid.
+        const bool gridsReady = (enabled("batching") || enabled("grid")) && bench::hasBackend();
+        if(gridsReady) {
+            ParticleGrid::initCompute();
+            ParticleGrid::waitInitComplete();
+        } else if(enabled("batching") || enabled("grid")) spdlog::error("Skipping the batching and grid benchmarks, no simulation backend.");
+        if(enabled("batching") && gridsReady) bench::batching();
+        if(enabled("grid") && gridsReady) bench::particleGrid();
+        if(enabled("pipeline")) bench::pipeline();
+
+        if(nativeEngine != 0) delete nativeEngine;
+        if(clEngine != 0) delete clEngine;
+    }
+    delete finalizer;
+
+    if(!jsonPath.empty()) {
+        nlohmann::json output = {
+            { "device", device },
+            { "results", results }
+        };
+        std::ofstream stream(jsonPath);
+        if(!stream.is_open()) {
+            spdlog::error("Could not open '" + jsonPath + "' for the results.");
+            return -1;
+        }
+        stream << output.dump(4) << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+#include "benchmark.hpp"
+
+#include <simulator/occupancy_index.hpp>
+
+#include <vector>
+#include <random>
+#include <algorithm>
+
+using namespace unibox;
+
+void bench::occupancyIndex() {
+    const uint sizes[] = { 10000, 100000, 1000000 };
+    const uint worldSize = 2048;
+
+    for(uint count : sizes) {
+        // Unique random cells, the same way a loaded save scatters particles around the world.
+        std::vector<uint> cells(worldSize*worldSize);
+        for(uint i = 0; i < cells.size(); i++) cells[i] = i;
+        std::shuffle(cells.begin(), cells.end(), std::mt19937(count));
+        cells.resize(count);
+
+        OccupancyIndex index(worldSize, worldSize, 1);
+        const std::string name = std::to_string(count) + " particles";
+
+        double time = measure([&]() {
+            for(uint i = 0; i < count; i++) {
+                const uint x = cells[i]%worldSize;
+                const uint y = cells[i]/worldSize;
+                if(!index.get(x, y, 0).has_value()) index.set(x, y, 0, i);
+            }
+        });
+        report("occupancy", "insert, " + name, count, time);
+
+        volatile uint found = 0;
+        time = measure([&]() {
+            for(uint i = 0; i < count; i++) {
+                if(index.get(cells[i]%worldSize, cells[i]/worldSize, 0).has_value()) found++;
+            }
+        });
+        report("occupancy", "lookup, " + name, count, time);
+
+        time = measure([&]() {
+            index.clear();
+            for(uint i = 0; i < count; i++) index.set(cells[i]%worldSize, cells[i]/worldSize, 0, i);
+        });
+        report("occupancy", "rebuild, " + name, count, time);
+
+        time = measure([&]() {
+            for(uint i = 0; i < count; i++) index.erase(cells[i]%worldSize, cells[i]/worldSize, 0);
+        });
+        report("occupancy", "erase, " + name, count, time);
+    }
+}
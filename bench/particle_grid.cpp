@@ -0,0 +1,53 @@
+#include "benchmark.hpp"
+
+#include <simulator/particle_grid.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <memory>
+
+using namespace unibox;
+
+void bench::particleGrid() {
+    // The slot pool grows by 256 particles at a time and every growth copies the whole pool,
+    // counts past a few hundred thousand are dominated by that and take far too long.
+    const uint counts[] = { 1000, 16000, 64000, 256000 };
+    const uint worldSizes[] = { 256, 1024, 2048 };
+
+    for(uint worldSize : worldSizes) {
+        for(uint count : counts) {
+            // Leave room for the particles to move.
+            if(count > worldSize*worldSize/2) continue;
+            for(const char* mix : mixes) {
+                std::vector<Voxel> voxels = createScene(mix, count, worldSize);
+                const std::string scene = std::to_string(count) + " " + mix + ", " + std::to_string(worldSize) + "^2";
+                const nlohmann::json parameters = {
+                    { "particles", count },
+                    { "worldSize", worldSize },
+                    { "mix", mix }
+                };
+
+                // Starts out with 256 slots like every other grid, so this includes every growth of the pool.
+                auto grid = std::make_unique<ParticleGrid>(worldSize, worldSize, 1);
+                double time = measure([&]() {
+                    for(auto& voxel : voxels) grid->addVoxel(voxel);
+                });
+                report("grid", "addVoxel, " + scene, count, time, parameters);
+
+                // Erased slots are reused before the pool grows, so the second fill is the cost without growth.
+                for(auto& voxel : voxels) grid->eraseVoxel(static_cast<uint>(voxel.position[0]), static_cast<uint>(voxel.position[1]), 0);
+                time = measure([&]() {
+                    for(auto& voxel : voxels) grid->addVoxel(voxel);
+                });
+                report("grid", "addVoxel reused, " + scene, count, time, parameters);
+                grid.reset();
+
+                grid = std::make_unique<ParticleGrid>(worldSize, worldSize, 1);
+                time = measure([&]() {
+                    grid->addVoxels(0, 0, 0, voxels);
+                });
+                report("grid", "addVoxels, " + scene, count, time, parameters);
+            }
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#include "benchmark.hpp"
+
+#include <compute/grid_pipeline.hpp>
+#include <simulator/particle.hpp>
+#include <simulator/voxel.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <vector>
+
+using namespace unibox;
+
+void bench::pipeline() {
+    if(!hasBackend()) {
+        spdlog::error("Skipping the pipeline benchmark, no simulation backend.");
+        return;
+    }
+
+    Simulator simulator = Simulator();
+    if(!simulator.createSimulationShader()) return;
+    simulator.createSimulationInformation();
+    MeshGenPipeline meshGenerator = MeshGenPipeline();
+    meshGenerator.createMeshGenerationShader();
+    meshGenerator.createMeshGenerationInformation();
+
+    const uint counts[] = { 1000, 16000, 256000, 1000000, 4000000 };
+    const uint worldSizes[] = { 256, 1024, 4096 };
+    const uint ticks = 20;
+
+    for(uint worldSize : worldSizes) {
+        for(uint count : counts) {
+            if(count > worldSize*worldSize/2) continue;
+            for(const char* mix : mixes) {
+                std::vector<Voxel> voxels = createScene(mix, count, worldSize);
+                GridPipeline* pipeline = createPipeline(simulator, meshGenerator, voxels, worldSize);
+                if(pipeline == 0) {
+                    spdlog::error("Skipping " + std::to_string(count) + " particles, the buffers could not be allocated.");
+                    continue;
+                }
+
+                pipeline->simulate(count);
+                pipeline->generateMesh(count, 0);
+                pipeline->finish();
+
+                const std::string scene = std::to_string(count) + " " + mix + ", " + std::to_string(worldSize) + "^2";
+                const nlohmann::json parameters = {
+                    { "particles", count },
+                    { "worldSize", worldSize },
+                    { "mix", mix }
+                };
+
+                double time = measure([&]() {
+                    for(uint i = 0; i < ticks; i++) pipeline->simulate(count);
+                    pipeline->finish();
+                });
+                report("pipeline", "simulate, " + scene, ticks, time, parameters);
+
+                time = measure([&]() {
+                    for(uint i = 0; i < ticks; i++) pipeline->generateMesh(count, 0);
+                    pipeline->finish();
+                });
+                report("pipeline", "meshgen, " + scene, ticks, time, parameters);
+                delete pipeline;
+            }
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#include "benchmark.hpp"
+
+#include <compute/grid_pipeline.hpp>
+#include <simulator/particle.hpp>
+#include <simulator/voxel.hpp>
+#include <util/finalizer.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <vector>
+#include <cstdio>
+
+using namespace unibox;
+
+void bench::simulation() {
+    if(!hasBackend()) {
+        spdlog::error("Skipping the simulation benchmark, no simulation backend.");
+        return;
+    }
+
+    Simulator simulator = Simulator();
+    if(!simulator.createSimulationShader()) return;
+    simulator.createSimulationInformation();
+    MeshGenPipeline meshGenerator = MeshGenPipeline();
+    meshGenerator.createMeshGenerationShader();
+    meshGenerator.createMeshGenerationInformation();
+
+    const uint sizes[] = { 10000, 100000, 1000000 };
+    const uint worldSize = 1024;
+    const uint ticks = 100;
+
+    for(uint count : sizes) {
+        // A pile of sand falling onto the bottom of the world, the densest case for the move resolution.
+        const std::vector<Voxel> voxels = createScene("sand", count, worldSize);
+        const MoveResolution modes[] = { SINGLE_PASS, TWO_PHASE };
+        for(MoveResolution mode : modes) {
+            GridPipeline* pipeline = createPipeline(simulator, meshGenerator, voxels, worldSize);
+            if(pipeline == 0) continue;
+            pipeline->setMoveResolution(mode);
+
+            // Warm up, the first launch includes the driver's own setup work.
+            pipeline->simulate(count);
+            pipeline->finish();
+
+            double time = measure([&]() {
+                for(uint i = 0; i < ticks; i++) pipeline->simulate(count);
+                pipeline->finish();
+            });
+            report("simulation", std::string(mode == SINGLE_PASS ? "single pass, " : "two phase, ") + std::to_string(count) + " sand", ticks, time);
+            printf("%-16s %u awake chunks, %u asleep chunks\n", "", pipeline->getAwakeChunks(), pipeline->getAsleepChunks());
+            delete pipeline;
+        }
+    }
+}
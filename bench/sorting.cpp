@@ -0,0 +1,61 @@
+#include "benchmark.hpp"
+
+#include <compute/grid_pipeline.hpp>
+#include <simulator/particle.hpp>
+#include <simulator/voxel.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <vector>
+
+using namespace unibox;
+
+void bench::sorting() {
+    if(!hasBackend()) {
+        spdlog::error("Skipping the sorting benchmark, no simulation backend.");
+        return;
+    }
+
+    Simulator simulator = Simulator();
+    if(!simulator.createSimulationShader()) return;
+    simulator.createSimulationInformation();
+    MeshGenPipeline meshGenerator = MeshGenPipeline();
+    meshGenerator.createMeshGenerationShader();
+    meshGenerator.createMeshGenerationInformation();
+
+    const uint worldSizes[] = { 256, 512, 1024 };
+    const uint ticks = 100;
+
+    for(uint worldSize : worldSizes) {
+        // Copper wiring over half of the world with a live spark in every 64 conductors. The particles are
+        // inserted in random order, like a circuit which has been edited for a while.
+        const std::vector<Voxel> voxels = createScene("circuit", worldSize*worldSize/2, worldSize);
+        const uint count = voxels.size();
+
+        GridPipeline* pipeline = createPipeline(simulator, meshGenerator, voxels, worldSize);
+        if(pipeline == 0) continue;
+
+        pipeline->simulate(count);
+        pipeline->finish();
+
+        const std::string scene = std::to_string(count) + " conductors";
+        double time = measure([&]() {
+            for(uint i = 0; i < ticks; i++) pipeline->simulate(count);
+            pipeline->finish();
+        });
+        report("sorting", "unsorted, " + scene, ticks, time);
+
+        time = measure([&]() {
+            pipeline->sort(count);
+            pipeline->finish();
+        });
+        report("sorting", "sort, " + scene, 1, time);
+
+        time = measure([&]() {
+            for(uint i = 0; i < ticks; i++) pipeline->simulate(count);
+            pipeline->finish();
+        });
+        report("sorting", "sorted, " + scene, ticks, time);
+        delete pipeline;
+    }
+}
@@ -3,6 +3,7 @@
 #include <CL/cl.hpp>
 
 #include <vector>
+#include <cstdint>
 
 namespace unibox {
     class ClEngine {
@@ -11,14 +12,44 @@ namespace unibox {
         cl::Device device;
         cl::Context context;
 
+        // Long lived in-order queues, kernels go through the compute queue
+        // while host <-> device copies of results go through the transfer queue.
+        cl::CommandQueue computeQueue;
+        cl::CommandQueue transferQueue;
+
         bool valid;
+
+        // cl_khr_external_memory_opaque_fd entry points, all set or all 0. The headers might predate
+        // OpenCL 3.0, so they are looked up at runtime with their own declarations.
+        typedef cl_mem (*CreateBufferWithPropertiesFn)(cl_context, const cl_ulong*, cl_mem_flags, size_t, void*, cl_int*);
+        typedef cl_int (*ExternalMemObjectsFn)(cl_command_queue, cl_uint, const cl_mem*, cl_uint, const cl_event*, cl_event*);
+        CreateBufferWithPropertiesFn createBufferWithProperties;
+        ExternalMemObjectsFn acquireExternalMemObjects;
+        ExternalMemObjectsFn releaseExternalMemObjects;
+        bool hasDeviceUUID;
+        uint8_t deviceUUID[16];
+
+        void initExternalMemory();
+        cl_int enqueueExternal(ExternalMemObjectsFn function, cl::Buffer& buffer, const std::vector<cl::Event>& wait, cl::Event& event);
     public:
-        ClEngine();
+        // Picks the first device of the given type, the queue properties apply to both queues.
+        ClEngine(cl_device_type deviceType = CL_DEVICE_TYPE_GPU, cl_command_queue_properties queueProperties = 0);
         ~ClEngine();
 
         cl::Context& getContext();
         cl::Device& getDevice();
 
+        cl::CommandQueue& getComputeQueue();
+        cl::CommandQueue& getTransferQueue();
+
+        // True if memory exported by the given device can be imported, the UUIDs have to match.
+        bool supportsExternalMemory(const uint8_t* deviceUUID);
+        // Imports exported memory as a buffer, the file descriptor stays owned by the caller. 0 on failure.
+        cl::Buffer* importBuffer(int fd, size_t size);
+        // Imported buffers have to be acquired on the compute queue before kernels use them and released afterwards.
+        cl_int acquireExternal(cl::Buffer& buffer, const std::vector<cl::Event>& wait, cl::Event& event);
+        cl_int releaseExternal(cl::Buffer& buffer, const std::vector<cl::Event>& wait, cl::Event& event);
+
         static ClEngine* getInstance();
     };
 }
\ No newline at end of file
@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cl-engine/engine.hpp>
+#include <compute/grid_pipeline.hpp>
+#include <compute/simulator.hpp>
+#include <compute/meshgen.hpp>
+#include <simulator/voxel.hpp>
+
+#include <vector>
+#include <map>
+#include <string>
+
+namespace unibox {
+    // GridPipeline of the OpenCL backend. Kernel arguments are bound once and only the particle count is updated
+    // between ticks, every stage waits on the event of the previous one so the host never has to synchronize in between.
+    class ClGridPipeline : public GridPipeline {
+        cl::Kernel resetKernel;
+        cl::Kernel markKernel;
+        cl::Kernel allocateKernel;
+        cl::Kernel buildKernel;
+        // Simulate kernels of every type with an update function, in the same order as types.
+        std::vector<ushort> types;
+        std::vector<cl::Kernel> simKernels;
+        std::vector<cl::Kernel> intentKernels;
+        cl::Kernel claimKernel;
+        cl::Kernel resolveKernel;
+        cl::Kernel wakeKernel;
+        cl::Kernel typeCountKernel;
+        cl::Kernel bucketKernel;
+        cl::Kernel countKernel;
+        cl::Kernel liveKernel;
+        cl::Kernel scanKernel;
+        cl::Kernel addKernel;
+        cl::Kernel scatterKernel;
+        cl::Kernel finishKernel;
+        cl::Kernel mortonKernel;
+        cl::Kernel radixCountKernel;
+        cl::Kernel radixScatterKernel;
+        cl::Kernel gatherKernel;
+        cl::Kernel emitCountKernel;
+        cl::Kernel emitCommitKernel;
+        cl::Kernel meshKernel;
+        cl::Kernel mergedKernel;
+        cl::Kernel clearImageKernel;
+        cl::Kernel imageKernel;
+        cl::Kernel reduceKernel;
+        cl::Kernel cullKernel;
+
+        GridInfo info;
+
+        // Sparse grid storage, see GridInfo in simulator.cl.
+        cl::Buffer brickTable;
+        cl::Buffer brickPool;
+        cl::Buffer brickCounters;
+        uint brickCapacity;
+
+        // Counters of the last finished tick, read back without blocking.
+        uint counters[10];
+        cl::Event counterEvent;
+
+        // Bricks are also the simulation chunks, every chunk holds the last tick something
+        // changed in or next to it. Only particles in awake chunks end up in the work list.
+        cl::Buffer activityBuffer;
+        cl::Buffer workList;
+
+        // First work list entry of every type, only read back to size the launches.
+        uint typeCount;
+        cl::Buffer typeOffsets;
+        cl::Buffer typeCursors;
+        std::vector<uint> typeOffsetsHost;
+        bool typeOffsetsValid;
+        uint tick;
+        std::vector<uint> wokenCells;
+
+        cl::Buffer intentBuffer;
+        MoveResolution moveResolution;
+
+        // Hot and cold halves of the particles, see VoxelHot and VoxelCold. They are mapped while on the host.
+        cl::Buffer particleBuffer;
+        cl::Buffer particleDataBuffer;
+        uint particleCapacity;
+        VoxelHot* particles;
+        VoxelCold* particleData;
+        cl::Event mapEvent;
+        bool mapPending;
+
+        cl::Buffer meshBuffer;
+        // Draw command and records of the mesh within the cull area, grown to the slots of the cull.
+        cl::Buffer visibleBuffer;
+        size_t visibleSlots;
+        // Allocated by the first image generation.
+        cl::Buffer imageBuffer;
+        // Imported snapshots, see importSnapshot.
+        cl::Buffer* sharedBuffers[2];
+        // Last copy out of the visible or the image buffer, or release of a shared snapshot.
+        cl::Event readEvent;
+
+        // Dead slots are compacted once they make up a quarter of the dispatched slots
+        // or every compactionInterval ticks if it is set.
+        cl::Buffer liveCount;
+        uint compactedCount;
+        uint compactionInterval;
+        uint ticksSinceCompaction;
+
+        // Particles are sorted by the Z-order key of their cell every sortInterval ticks, 0 disables it.
+        uint sortInterval;
+        uint ticksSinceSort;
+        uint keyBits;
+        uint keyShift;
+
+        // Particles emitted on the device go into the slots starting at the emission base, the host
+        // moves the base whenever it allocates past it and learns about the used slots from emitTop and emitPlaced.
+        bool emitters;
+        cl::Buffer emitOffsets;
+        uint emitBase;
+        bool emitBaseDirty;
+        uint emitTop;
+        uint emitPlaced;
+
+        cl::Event lastEvent;
+        cl::Event meshEvent;
+
+        // Levels of the image pyramid built after every image generation.
+        std::vector<ImageLevel> imageLevels;
+
+        // Blocks of the mesh or image changed by the last generation, read back and cleared after every one.
+        cl::Buffer dirtyBuffer;
+        std::vector<uint> dirtyBlocks;
+        cl::Event dirtyEvent;
+
+        // Instances counted by the last cull, read back without blocking when asked for.
+        uint visibleCount;
+        cl::Event visibleEvent;
+
+        // Every enqueued kernel with the name of its phase, only kept while profiling.
+        bool profiling;
+        std::vector<std::pair<const char*, cl::Event>> profiledEvents;
+
+        std::vector<cl::Event> waitList(const cl::Event& event);
+        // Generations and culls wait for the copies out of the buffers they write.
+        std::vector<cl::Event> meshWaitList();
+        bool enqueue(cl::Kernel& kernel, uint size, const cl::Event& waitEvent, cl::Event& event, const char* name);
+        bool enqueue(cl::Kernel& kernel, uint size, const std::vector<cl::Event>& wait, cl::Event& event, const char* name, uint localSize = 0);
+        bool scan(cl::Buffer& values, uint count, cl::Event& event);
+        bool finishCompaction(cl::Buffer& compacted, cl::Buffer& compactedData, const cl::Event& waitEvent);
+        void checkCounters();
+        void bindBuffers();
+        bool enqueueWakes(cl::Event& event);
+        bool enqueueImageGeneration(cl::Buffer& image, uint particleCount, const std::vector<cl::Event>& wait, uint sinceTick);
+        bool enqueueImage(cl::Buffer& image, uint particleCount, const std::vector<cl::Event>& wait, uint sinceTick);
+        bool enqueueCull(cl::Buffer& visible, uint particleCount, const uint area[4], const std::vector<cl::Event>& wait);
+        bool readDirtyBlocks();
+        bool readVisibleCount();
+        bool allocateImage();
+        uint getDispatchSize(ushort type, uint particleCount);
+
+        // Sets an argument of every simulate kernel, indices are the ones of simulate_<type>.
+        template<typename T> void setUpdateArg(uint index, const T& value) {
+            for(auto& kernel : simKernels) kernel.setArg(index, value);
+            for(auto& kernel : intentKernels) kernel.setArg(index < 5 ? index : index+1, value);
+        }
+    public:
+        ClGridPipeline(Simulator& simulator, MeshGenPipeline& meshGenerator, const GridInfo& info);
+        ~ClGridPipeline();
+
+        virtual bool resize(uint capacity, uint keptSlots);
+        virtual uint getCapacity();
+        virtual VoxelHot* getParticles();
+        virtual VoxelCold* getParticleData();
+        virtual bool releaseParticles();
+        virtual bool acquireParticles();
+        virtual void waitParticles();
+        virtual void finish();
+
+        virtual void setMoveResolution(MoveResolution resolution);
+
+        virtual void reserveBricks(size_t bricks);
+        virtual uint getBrickCapacity();
+
+        virtual void wake(uint x, uint y, uint z);
+        virtual uint getAwakeChunks();
+        virtual uint getAsleepChunks();
+
+        virtual bool needsCompaction(uint slotCount, uint hostHoles);
+        virtual void setCompactionInterval(uint ticks);
+        virtual bool compact(uint slotCount);
+        virtual uint getCompactedCount();
+
+        virtual bool needsSort();
+        virtual void setSortInterval(uint ticks);
+        virtual bool sort(uint slotCount);
+
+        virtual void setEmitBase(uint slot);
+        virtual uint getEmitTop();
+        virtual uint getEmitPlaced();
+        virtual uint getRequiredSpace(uint particleCapacity, uint ticks);
+
+        virtual bool simulate(uint particleCount);
+        virtual uint getTick();
+
+        virtual bool generateMesh(uint particleCount, uint sinceTick);
+        virtual bool generateImage(uint particleCount, uint sinceTick);
+        virtual bool generateMergedMesh(uint particleCount, uint sinceTick);
+        virtual bool areDirtyBlocksReady(bool wait);
+        virtual const std::vector<uint>& getDirtyBlocks();
+
+        virtual bool cullMesh(uint particleCount, const uint area[4]);
+        virtual bool isVisibleCountReady();
+        virtual uint getVisibleCount();
+
+        virtual bool readMesh(void* target, bool image, size_t source, const std::vector<std::pair<size_t, size_t>>& ranges);
+        virtual bool isReadComplete();
+        virtual void waitRead();
+
+        virtual bool supportsSharedSnapshots(const uint8_t* deviceUUID);
+        virtual bool importSnapshot(uint snapshot, int fd, size_t size);
+        virtual void releaseSnapshots();
+        virtual bool generateSharedImage(uint snapshot, uint particleCount, uint sinceTick);
+        virtual bool cullSharedMesh(uint snapshot, uint particleCount, const uint area[4]);
+
+        virtual void setProfiling(bool enable);
+        virtual void collectProfile(std::map<std::string, double>& phases);
+    };
+}
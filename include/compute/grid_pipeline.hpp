@@ -0,0 +1,128 @@
+#pragma once
+
+#include <compute/simulator.hpp>
+#include <compute/meshgen.hpp>
+#include <simulator/voxel.hpp>
+
+#include <vector>
+#include <map>
+#include <string>
+#include <utility>
+#include <cstdint>
+
+namespace unibox {
+    enum MoveResolution {
+        // Particles write their new position straight into the particle buffer while others are still reading the grid.
+        SINGLE_PASS,
+        // Particles claim their target cell and only the winners move in a separate resolve pass.
+        TWO_PHASE
+    };
+
+    // Per grid chain of the reset -> build -> simulate -> meshgen kernels over the particles, the mesh and the image
+    // of a grid, which the pipeline owns. ClGridPipeline runs it on an OpenCL device and NativeGridPipeline on the
+    // native engine, the host only ever sees the particles between acquireParticles and releaseParticles.
+    // Calls enqueue their stages behind every earlier one and may return before they are done.
+    class GridPipeline {
+    public:
+        virtual ~GridPipeline() {}
+
+        // Native pipeline if the native engine is running, OpenCL otherwise.
+        static GridPipeline* create(Simulator& simulator, MeshGenPipeline& meshGenerator, const GridInfo& info);
+        // Draw command of a cull followed by the records of the given amount of slots.
+        static size_t getVisibleSize(size_t slots);
+
+        // Grows the storage to the given amount of slots, the first keptSlots are kept and the rest are zeroed.
+        // The particles have to be on the host, the mesh has to be generated whole afterwards.
+        virtual bool resize(uint capacity, uint keptSlots) = 0;
+        virtual uint getCapacity() = 0;
+        // Only valid while the particles are on the host.
+        virtual VoxelHot* getParticles() = 0;
+        virtual VoxelCold* getParticleData() = 0;
+        // Hands the particles to the following stages.
+        virtual bool releaseParticles() = 0;
+        // Gives the particles back to the host once every stage is done, waitParticles blocks until then.
+        virtual bool acquireParticles() = 0;
+        virtual void waitParticles() = 0;
+        // Blocks until every stage is done.
+        virtual void finish() = 0;
+
+        virtual void setMoveResolution(MoveResolution resolution) = 0;
+
+        // Makes sure the brick pool can hold at least the given amount of bricks. A tick whose particles need
+        // more bricks than the pool holds is skipped and the pool grown after it, reserving ahead avoids that.
+        virtual void reserveBricks(size_t bricks) = 0;
+        virtual uint getBrickCapacity() = 0;
+
+        // Wakes the chunk of an edited cell and its neighbours before the next tick.
+        virtual void wake(uint x, uint y, uint z) = 0;
+        virtual uint getAwakeChunks() = 0;
+        virtual uint getAsleepChunks() = 0;
+
+        // Host freed slots within slotCount have to be passed in, the device only knows about its own deaths.
+        virtual bool needsCompaction(uint slotCount, uint hostHoles) = 0;
+        virtual void setCompactionInterval(uint ticks) = 0;
+        // Packs live particles to the front and zeroes the rest, the new particle count is
+        // available through getCompactedCount once the particles are back on the host.
+        virtual bool compact(uint slotCount) = 0;
+        virtual uint getCompactedCount() = 0;
+
+        virtual bool needsSort() = 0;
+        virtual void setSortInterval(uint ticks) = 0;
+        // Sorts the particles by cell, dead slots are compacted along the way
+        // so the result is picked up through getCompactedCount as well.
+        virtual bool sort(uint slotCount) = 0;
+
+        // Every slot from the given one up is free on the host.
+        virtual void setEmitBase(uint slot) = 0;
+        // First slot not used by emitted particles as of the last tick on the host.
+        virtual uint getEmitTop() = 0;
+        // Emitted particles which got a cell since the pipeline was created, as of the last tick on the host.
+        // Emissions which lost their cell leave an empty slot below the top. The sum wraps, only differences count.
+        virtual uint getEmitPlaced() = 0;
+        // Slots the storage should grow by to keep up with the emission for the given amount of ticks.
+        virtual uint getRequiredSpace(uint particleCapacity, uint ticks) = 0;
+
+        virtual bool simulate(uint particleCount) = 0;
+        // The tick the next simulation runs, generations stamped with it only miss the changes made after them.
+        virtual uint getTick() = 0;
+
+        // Only chunks changed since the given tick are revisited, the mesh has to hold the one generated back then.
+        // 0 regenerates everything. Blocks which changed are in getDirtyBlocks once areDirtyBlocksReady.
+        virtual bool generateMesh(uint particleCount, uint sinceTick) = 0;
+        // Writes the color of every cell into the image pyramid, see MeshGenPipeline::getImageLevels.
+        virtual bool generateImage(uint particleCount, uint sinceTick) = 0;
+        // Mesh of a flat grid with runs of equal cells merged into rectangles, see generateMerged in meshGenerator.cl.
+        // Generates the image first, the dirty blocks cover both.
+        virtual bool generateMergedMesh(uint particleCount, uint sinceTick) = 0;
+        virtual bool areDirtyBlocksReady(bool wait) = 0;
+        virtual const std::vector<uint>& getDirtyBlocks() = 0;
+
+        // Packs the records of the mesh within the given cell area (min x, min y, max x, max y, inclusive)
+        // behind a MeshDrawCommand counting them, the count is in getVisibleCount once isVisibleCountReady.
+        virtual bool cullMesh(uint particleCount, const uint area[4]) = 0;
+        virtual bool isVisibleCountReady() = 0;
+        virtual uint getVisibleCount() = 0;
+
+        // Copies the given offset and size ranges of the culled mesh or of the image, starting at the source
+        // offset, into the same ranges of the target. It's complete once isReadComplete.
+        virtual bool readMesh(void* target, bool image, size_t source, const std::vector<std::pair<size_t, size_t>>& ranges) = 0;
+        virtual bool isReadComplete() = 0;
+        virtual void waitRead() = 0;
+
+        // Zero-copy snapshots, exported Vulkan memory of the device with the given UUID is imported and the image
+        // is generated or the mesh culled straight into it. Only the OpenCL pipeline supports them.
+        virtual bool supportsSharedSnapshots(const uint8_t* deviceUUID) = 0;
+        // Takes a file descriptor of the exported memory, the caller closes it.
+        virtual bool importSnapshot(uint snapshot, int fd, size_t size) = 0;
+        // Drops every imported snapshot, has to be called before their memory is freed.
+        virtual void releaseSnapshots() = 0;
+        // The snapshot is complete once isReadComplete.
+        virtual bool generateSharedImage(uint snapshot, uint particleCount, uint sinceTick) = 0;
+        virtual bool cullSharedMesh(uint snapshot, uint particleCount, const uint area[4]) = 0;
+
+        // Needs a compute queue created with CL_QUEUE_PROFILING_ENABLE on OpenCL.
+        virtual void setProfiling(bool enable) = 0;
+        // Adds the time of every stage finished since the last call to its phase, in seconds.
+        virtual void collectProfile(std::map<std::string, double>& phases) = 0;
+    };
+}
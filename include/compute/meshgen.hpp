@@ -1,20 +1,66 @@
 #pragma once
 
 #include <cl-engine/engine.hpp>
+#include <native-engine/program.hpp>
+#include <simulator/particle.hpp>
+
+#include <vector>
+#include <cstdint>
 
 namespace unibox {
+    // One quad of the particle mesh, same layout as Instance in meshGenerator.cl. The vertex shader
+    // expands it, empty slots have an x of EMPTY.
+    struct MeshInstance {
+        static constexpr uint16_t EMPTY = 0xFFFF;
+
+        uint16_t position[2];
+        // Cells covered from the position on, merged meshes cover more than one.
+        uint16_t size[2];
+        // RGBA8, red in the lowest byte.
+        uint32_t color;
+    };
+
+    // Draw command in front of the culled mesh, same layout as VkDrawIndirectCommand and DrawCommand in
+    // meshGenerator.cl. Culling counts the instances into it so the mesh is drawn without the host knowing how many.
+    struct MeshDrawCommand {
+        uint32_t vertexCount;
+        uint32_t instanceCount;
+        uint32_t firstVertex;
+        uint32_t firstInstance;
+    };
+
+    // Level of the image pyramid, offset and size in cells.
+    struct ImageLevel {
+        uint32_t offset;
+        uint32_t width;
+        uint32_t height;
+    };
+
     class MeshGenPipeline {
         static cl::Buffer* pib; // Particle Info Buffer
         static cl::Program* program;
+        // Used instead of the OpenCL program and buffer when the native engine is running.
+        static NativeProgram* nativeProgram;
+        static std::vector<ParticleInfoPacket> particleInfo;
 
-        cl::Kernel kernel;
     public:
+        // Mesh records or image cells per bit of the dirty block mask, see MESH_BLOCK_SHIFT in meshGenerator.cl.
+        static constexpr uint32_t DIRTY_BLOCK_SIZE = 1024;
+
+        // Level 0 is the image of the grid, every following one halves the previous one down to a single cell.
+        // Levels start on a dirty block so uploading one never touches another.
+        static std::vector<ImageLevel> getImageLevels(uint32_t sizeX, uint32_t sizeY);
+
         MeshGenPipeline();
         ~MeshGenPipeline();
 
-        void generate(uint32_t particleCount, cl::Buffer& particleBuffer, cl::Buffer& meshBuffer);
-
         void createMeshGenerationInformation();
         void createMeshGenerationShader();
+
+        cl::Program& getProgram();
+        cl::Buffer& getParticleInfo();
+
+        NativeProgram& getNativeProgram();
+        const ParticleInfoPacket* getParticleInfoData();
     };
-}
\ No newline at end of file
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <compute/simulator.hpp>
+#include <compute/meshgen.hpp>
+#include <compute/grid_pipeline.hpp>
+#include <native-engine/program.hpp>
+#include <simulator/voxel.hpp>
+#include <simulator/particle.hpp>
+
+#include <vector>
+#include <map>
+#include <string>
+#include <chrono>
+
+namespace unibox {
+    // GridPipeline of the native backend. Runs the same kernels over host memory, every call
+    // returns once its stages are done. Work group kernels (scans and the radix sort) are
+    // replaced by their host equivalents since native work groups are a single work item.
+    class NativeGridPipeline : public GridPipeline {
+        // Same layout as float4 of the kernels.
+        struct alignas(16) Intent {
+            float value[4];
+        };
+
+        typedef void (*ResetKernel)(uint*, uint*, uint*, uint*, GridInfo);
+        typedef void (*MarkKernel)(VoxelHot*, uint*, GridInfo, uint);
+        typedef void (*AllocateKernel)(uint*, GridPoint*, uint*, GridInfo, uint);
+        typedef void (*BuildKernel)(VoxelHot*, uint*, GridPoint*, GridInfo, uint);
+        typedef void (*SimulateKernel)(VoxelHot*, VoxelCold*, uint*, GridPoint*, const SimulationParticleInfoPacket*, uint*, uint*, uint*, uint*, uint*, GridInfo, uint, uint, uint, uint);
+        typedef void (*IntentKernel)(VoxelHot*, VoxelCold*, uint*, GridPoint*, const SimulationParticleInfoPacket*, Intent*, uint*, uint*, uint*, uint*, uint*, GridInfo, uint, uint, uint, uint);
+        typedef void (*ClaimKernel)(uint*, GridPoint*, Intent*, uint*, uint*, GridInfo, uint);
+        typedef void (*ResolveKernel)(VoxelHot*, VoxelCold*, uint*, GridPoint*, Intent*, uint*, uint*, uint*, GridInfo, uint, uint);
+        typedef void (*WakeKernel)(uint*, const uint*, GridInfo, uint, uint);
+        typedef void (*TypeCountKernel)(VoxelHot*, uint*, uint*, uint*, GridInfo, uint, uint);
+        typedef void (*BucketKernel)(VoxelHot*, uint*, uint*, uint*, uint*, GridInfo, uint, uint);
+        typedef void (*CountKernel)(uint*, uint*, uint*, GridInfo, uint);
+        typedef void (*LiveKernel)(VoxelHot*, uint*, uint);
+        typedef void (*ScatterKernel)(VoxelHot*, VoxelCold*, VoxelHot*, VoxelCold*, uint*, uint*, uint);
+        typedef void (*FinishKernel)(VoxelHot*, VoxelCold*, VoxelHot*, VoxelCold*, uint*, uint*, uint);
+        typedef void (*MortonKernel)(VoxelHot*, uint*, uint*, GridInfo, uint, uint, uint);
+        typedef void (*GatherKernel)(VoxelHot*, VoxelCold*, VoxelHot*, VoxelCold*, uint*, uint*, uint*, uint, uint);
+        typedef void (*EmitCountKernel)(VoxelHot*, VoxelCold*, uint*, GridPoint*, const SimulationParticleInfoPacket*, uint*, uint*, uint*, GridInfo, uint, uint);
+        typedef void (*EmitCommitKernel)(uint*, uint*, uint);
+        typedef void (*MeshKernel)(VoxelHot*, VoxelCold*, MeshInstance*, const ParticleInfoPacket*, uint*, uint*, GridInfo, uint, uint);
+        typedef void (*MergedKernel)(VoxelHot*, MeshInstance*, uint*, uint*, uint*, GridInfo, uint, uint);
+        typedef void (*ClearImageKernel)(uint*, uint*, uint*, GridInfo, uint);
+        typedef void (*ImageKernel)(VoxelHot*, VoxelCold*, uint*, const ParticleInfoPacket*, uint*, GridInfo, uint, uint);
+        typedef void (*ReduceKernel)(uint*, uint*, uint*, GridInfo, uint, uint, uint, uint, uint, uint, uint, uint);
+        typedef void (*CullKernel)(MeshInstance*, MeshDrawCommand*, uint, uint, uint, uint, uint);
+
+        NativeProgram& program;
+        NativeProgram& meshProgram;
+        const SimulationParticleInfoPacket* simulationInfo;
+        const ParticleInfoPacket* meshInfo;
+
+        ResetKernel resetKernel;
+        MarkKernel markKernel;
+        AllocateKernel allocateKernel;
+        BuildKernel buildKernel;
+        std::vector<ushort> types;
+        std::vector<SimulateKernel> simKernels;
+        std::vector<IntentKernel> intentKernels;
+        ClaimKernel claimKernel;
+        ResolveKernel resolveKernel;
+        WakeKernel wakeKernel;
+        TypeCountKernel typeCountKernel;
+        BucketKernel bucketKernel;
+        CountKernel countKernel;
+        LiveKernel liveKernel;
+        ScatterKernel scatterKernel;
+        FinishKernel finishKernel;
+        MortonKernel mortonKernel;
+        GatherKernel gatherKernel;
+        EmitCountKernel emitCountKernel;
+        EmitCommitKernel emitCommitKernel;
+        MeshKernel meshKernel;
+        MergedKernel mergedKernel;
+        ClearImageKernel clearImageKernel;
+        ImageKernel imageKernel;
+        ReduceKernel reduceKernel;
+        CullKernel cullKernel;
+
+        GridInfo info;
+
+        std::vector<uint> brickTable;
+        std::vector<GridPoint> brickPool;
+        uint brickCapacity;
+        uint counters[10];
+
+        std::vector<uint> activity;
+        std::vector<uint> workList;
+        uint typeCount;
+        std::vector<uint> typeOffsets;
+        std::vector<uint> typeCursors;
+        uint tick;
+        std::vector<uint> wokenCells;
+        std::vector<uint> dirtyBlocks;
+        std::vector<ImageLevel> imageLevels;
+
+        std::vector<Intent> intents;
+        MoveResolution moveResolution;
+
+        // The particles never leave the host.
+        std::vector<VoxelHot> particles;
+        std::vector<VoxelCold> particleData;
+        std::vector<MeshInstance> mesh;
+        uint particleCapacity;
+        // Command of the last cull followed by the visible records, see getVisibleSize.
+        std::vector<uint> visible;
+        uint visibleCount;
+        std::vector<uint> image;
+
+        uint liveCount;
+        uint compactionInterval;
+        uint ticksSinceCompaction;
+
+        uint sortInterval;
+        uint ticksSinceSort;
+        uint keyBits;
+        uint keyShift;
+
+        bool emitters;
+        std::vector<uint> emitOffsets;
+        uint emitBase;
+        bool emitBaseDirty;
+
+        // Host time of every phase since the last collectProfile, only kept while profiling.
+        bool profiling;
+        std::map<std::string, double> profiledPhases;
+
+        // Kernels have to be launched through the program they come from, the global id lives in the module.
+        template<typename... Params, typename... Args> void run(NativeProgram& module, const char* name, void (*kernel)(Params...), uint size, Args... args) {
+            const auto start = std::chrono::steady_clock::now();
+            module.launch(kernel, size, 256, args...);
+            if(profiling) profiledPhases[name] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        // Exclusive scan, returns the total.
+        uint scan(uint* values, uint count);
+        void applyWakes();
+        void runImage(uint particleCount, uint sinceTick);
+        void finishCompaction(std::vector<VoxelHot>& compacted, std::vector<VoxelCold>& compactedData);
+    public:
+        NativeGridPipeline(Simulator& simulator, MeshGenPipeline& meshGenerator, const GridInfo& info);
+        ~NativeGridPipeline();
+
+        virtual bool resize(uint capacity, uint keptSlots);
+        virtual uint getCapacity();
+        virtual VoxelHot* getParticles();
+        virtual VoxelCold* getParticleData();
+        // The particles are always on the host, only finish waits for anything.
+        virtual bool releaseParticles();
+        virtual bool acquireParticles();
+        virtual void waitParticles();
+        virtual void finish();
+
+        virtual void setMoveResolution(MoveResolution resolution);
+
+        virtual void reserveBricks(size_t bricks);
+        virtual uint getBrickCapacity();
+
+        virtual void wake(uint x, uint y, uint z);
+        virtual uint getAwakeChunks();
+        virtual uint getAsleepChunks();
+
+        virtual bool needsCompaction(uint slotCount, uint hostHoles);
+        virtual void setCompactionInterval(uint ticks);
+        virtual bool compact(uint slotCount);
+        virtual uint getCompactedCount();
+
+        virtual bool needsSort();
+        virtual void setSortInterval(uint ticks);
+        virtual bool sort(uint slotCount);
+
+        virtual void setEmitBase(uint slot);
+        virtual uint getEmitTop();
+        virtual uint getEmitPlaced();
+        virtual uint getRequiredSpace(uint particleCapacity, uint ticks);
+
+        virtual bool simulate(uint particleCount);
+        virtual uint getTick();
+
+        virtual bool generateMesh(uint particleCount, uint sinceTick);
+        virtual bool generateImage(uint particleCount, uint sinceTick);
+        virtual bool generateMergedMesh(uint particleCount, uint sinceTick);
+        // Ready as soon as the generation returns.
+        virtual bool areDirtyBlocksReady(bool wait);
+        virtual const std::vector<uint>& getDirtyBlocks();
+
+        virtual bool cullMesh(uint particleCount, const uint area[4]);
+        virtual bool isVisibleCountReady();
+        virtual uint getVisibleCount();
+
+        // Copied before it returns.
+        virtual bool readMesh(void* target, bool image, size_t source, const std::vector<std::pair<size_t, size_t>>& ranges);
+        virtual bool isReadComplete();
+        virtual void waitRead();
+
+        // Host memory can't be shared with Vulkan, the snapshots are always copied.
+        virtual bool supportsSharedSnapshots(const uint8_t* deviceUUID);
+        virtual bool importSnapshot(uint snapshot, int fd, size_t size);
+        virtual void releaseSnapshots();
+        virtual bool generateSharedImage(uint snapshot, uint particleCount, uint sinceTick);
+        virtual bool cullSharedMesh(uint snapshot, uint particleCount, const uint area[4]);
+
+        // Host time instead of device time, otherwise the same as in ClGridPipeline.
+        virtual void setProfiling(bool enable);
+        virtual void collectProfile(std::map<std::string, double>& phases);
+    };
+}
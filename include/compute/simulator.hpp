@@ -1,23 +1,38 @@
 #pragma once
 
 #include <cl-engine/engine.hpp>
+#include <native-engine/program.hpp>
+#include <simulator/particle.hpp>
+
+#include <vector>
 
 namespace unibox {
     class Simulator {
         cl::Buffer pib;
 
         cl::Program* program;
-        cl::Kernel simKernel;
-        cl::Kernel resetKernel;
-        cl::Kernel buildKernel;
-
+        // Used instead of the OpenCL program and buffer when the native engine is running.
+        NativeProgram* nativeProgram;
+        std::vector<SimulationParticleInfoPacket> particleInfo;
+        // True if any loaded particle can emit new particles.
+        bool emitters;
+        // Types with an update function, each of them has its own simulate kernels.
+        std::vector<ushort> updatedTypes;
+        uint typeCount;
     public:
         Simulator();
         ~Simulator();
 
-        void simulate(uint32_t sizeX, uint32_t sizeY, uint32_t sizeZ, uint32_t particleCount, cl::Buffer gridBuffer, cl::Buffer particleBuffer);
-
         void createSimulationInformation();
         bool createSimulationShader();
+
+        cl::Program& getProgram();
+        bool hasEmitters();
+        const std::vector<ushort>& getUpdatedTypes();
+        uint getTypeCount();
+        cl::Buffer& getParticleInfo();
+
+        NativeProgram& getNativeProgram();
+        const SimulationParticleInfoPacket* getParticleInfoData();
     };
 }
@@ -74,6 +74,9 @@ namespace unibox::gui {
         uint width, height;
 
         glm::mat4 projection;
+
+        // Items were added or removed since the last takeChanges.
+        bool changed;
     public:
         GuiEngine(const RenderEngine& renderEngine);
         ~GuiEngine();
@@ -88,6 +91,8 @@ namespace unibox::gui {
         void removeItem(gui_handle handle);
 
         void render(double frameTime, double x, double y);
+        // Whether the GUI has to be drawn again, changes caused by input aren't tracked here.
+        bool takeChanges();
 
         void onMouseDown(double x, double y, int button);
         void onMouseUp(double x, double y, int button);
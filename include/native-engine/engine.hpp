@@ -0,0 +1,33 @@
+#pragma once
+
+#include <native-engine/thread_pool.hpp>
+
+#include <string>
+#include <vector>
+
+namespace unibox {
+    class NativeProgram;
+
+    // CPU backend for machines without a usable OpenCL device. The assembled kernel sources are
+    // compiled as C++ by the system compiler and loaded as a shared library, kernels run on the thread pool.
+    class NativeEngine {
+        static NativeEngine* instance;
+
+        ThreadPool pool;
+        std::string compiler;
+        std::string cacheDirectory;
+
+        // Runs the compiler without a shell, its errors go to the log file.
+        static bool runCompiler(const std::vector<std::string>& arguments, const std::string& logPath);
+    public:
+        // 0 threads uses every hardware thread. The compiler can be overridden with the CXX environment variable.
+        NativeEngine(uint32_t threads = 0);
+        ~NativeEngine();
+
+        ThreadPool& getThreadPool();
+        // Compiles OpenCL C source against shaders/native/opencl.hpp, returns 0 on failure.
+        NativeProgram* compile(const std::string& source, const std::string& name);
+
+        static NativeEngine* getInstance();
+    };
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <native-engine/engine.hpp>
+
+#include <string>
+#include <cstddef>
+
+namespace unibox {
+    // Loaded native kernel module. Kernels are plain functions which read their global id
+    // from the module, launch sets it before every call.
+    class NativeProgram {
+        void* handle;
+        void (*setWorkItem)(size_t, size_t);
+    public:
+        NativeProgram(void* handle);
+        ~NativeProgram();
+
+        NativeProgram(const NativeProgram&) = delete;
+        NativeProgram& operator=(const NativeProgram&) = delete;
+
+        void* getSymbol(const std::string& name);
+        // The parameter types have to match the kernel's declaration in the source, nothing checks them.
+        template<typename... Params> void (*getKernel(const std::string& name))(Params...) {
+            return reinterpret_cast<void (*)(Params...)>(getSymbol(name));
+        }
+
+        // Runs the kernel for every global id below size, like an NDRange without a local size.
+        template<typename... Params, typename... Args> void launch(void (*kernel)(Params...), uint32_t size, uint32_t grain, Args... args) {
+            if(kernel == 0) return;
+            auto workItem = setWorkItem;
+            NativeEngine::getInstance()->getThreadPool().parallelFor(size, grain, [&](uint32_t begin, uint32_t end) {
+                for(uint32_t i = begin; i < end; i++) {
+                    workItem(i, size);
+                    kernel(args...);
+                }
+            });
+        }
+    };
+}
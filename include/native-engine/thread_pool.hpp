@@ -0,0 +1,43 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <functional>
+
+namespace unibox {
+    // Work stealing pool, every worker takes tasks from the front of its own queue and steals
+    // from the back of the others once it runs dry. The thread calling parallelFor helps out as well.
+    class ThreadPool {
+        struct Worker {
+            std::deque<std::function<void()>> tasks;
+            std::mutex lock;
+        };
+
+        std::vector<std::thread> threads;
+        // One queue per thread, the last one belongs to whoever calls parallelFor.
+        std::vector<Worker*> workers;
+
+        std::mutex sleepLock;
+        std::condition_variable wakeup;
+        std::atomic<uint32_t> queued;
+        bool running;
+
+        bool runTask(uint32_t worker);
+        void run(uint32_t worker);
+    public:
+        // 0 uses every hardware thread.
+        ThreadPool(uint32_t threadCount = 0);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        uint32_t getThreadCount();
+        // Runs body over [0, count) split into ranges of at least grain items and returns once all of them are done.
+        void parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)>& body);
+    };
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
 
 #include <vk-engine/buffer.hpp>
@@ -30,6 +31,9 @@ namespace unibox {
 
         void getViewMatrix(glm::mat4* dst);
         glm::mat4 getProjectionMatrix();
+        // Bounds of the part of the plane at the given z which is on screen, as min x, min y, max x, max y.
+        // Infinite if the plane isn't in front of the camera everywhere.
+        glm::vec4 getVisibleArea(float z);
 
         void updateBuffer();
         Buffer& getBuffer();
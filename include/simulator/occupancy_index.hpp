@@ -0,0 +1,38 @@
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <sys/types.h>
+
+#include <simulator/voxel.hpp>
+
+namespace unibox {
+    // Host side map of grid cells to particle slots. The grid is split into the same bricks
+    // as the device side brick map, they are only allocated once a particle is stored inside of them.
+    class OccupancyIndex {
+        GridInfo info;
+
+        // Every brick cell holds slot+1 of the particle occupying it, 0 means empty.
+        std::vector<uint*> bricks;
+        size_t allocatedBricks;
+
+        uint* getBrick(uint x, uint y, uint z, bool allocate);
+        uint getBrickOffset(uint x, uint y, uint z);
+    public:
+        OccupancyIndex(uint sizeX, uint sizeY, uint sizeZ);
+        ~OccupancyIndex();
+
+        OccupancyIndex(const OccupancyIndex&) = delete;
+        OccupancyIndex& operator=(const OccupancyIndex&) = delete;
+
+        bool inBounds(uint x, uint y, uint z);
+
+        std::optional<uint> get(uint x, uint y, uint z);
+        void set(uint x, uint y, uint z, uint slot);
+        void erase(uint x, uint y, uint z);
+
+        void clear();
+
+        size_t getAllocatedBricks();
+    };
+}
@@ -48,6 +48,8 @@ namespace unibox {
         glm::vec4 color;
         std::vector<ParticlePhaseChangeProperty> phases;
         float density;
+        // The update script can call emitParticle.
+        bool emits;
     };
 
     struct ParticleInfoPacket {
@@ -104,6 +106,7 @@ namespace unibox {
 
         static Particle& getParticle(const std::string& name);
         static uint getParticleId(const std::string& name);
+        static std::string getParticleName(uint id);
         static void loadParticle(const std::string& name, const std::string& particleDir);
 
         static void loadParticles();
@@ -111,7 +114,10 @@ namespace unibox {
 
         static std::vector<Particle*>& getParticleArray() { return particlesIdArray; }
 
-        static std::string constructSwitchCode();
+        static std::string constructUpdateKernels();
+        static std::string constructUpdatedTypes();
+        static std::vector<ushort> getUpdatedTypes();
+        static std::string constructEmitSwitchCode();
         static std::string constructFunctions();
         static std::string& getIncludeCode();
 
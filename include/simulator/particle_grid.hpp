@@ -5,11 +5,18 @@
 #include <optional>
 #include <mutex>
 #include <list>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
 
 #include <simulator/voxel.hpp>
+#include <simulator/occupancy_index.hpp>
 #include <compute/simulator.hpp>
 #include <compute/meshgen.hpp>
+#include <compute/grid_pipeline.hpp>
 #include <vk-engine/buffer.hpp>
+#include <vk-engine/external_buffer.hpp>
 #include <vk-engine/gfxpipeline.hpp>
 #include <renderer/camera.hpp>
 
@@ -21,11 +28,50 @@ namespace unibox {
         static MeshGenPipeline* meshGenerator;
 
         static GraphicsPipeline* pipeline;
+        static GraphicsPipeline* imagePipeline;
+
+        // Copied snapshots of every grid are parts of one buffer, so the meshes of all grids are drawn by a single
+        // indirect call. Parts start on a multiple of SNAPSHOT_ALIGNMENT, it is a whole amount of mesh records and
+        // satisfies the largest storage buffer offset alignment Vulkan allows.
+        static constexpr size_t SNAPSHOT_ALIGNMENT = 256*sizeof(MeshInstance);
+        static Buffer* snapshotPool;
+        static size_t snapshotPoolSize;
+        static size_t snapshotPoolUsed;
+        // Draw command of every mesh drawn from the pool, gathered every frame.
+        static Buffer* drawCommands;
+        static size_t drawCommandCount;
+
+        // Fill ratios at which a 2D grid switches to and back from the image render mode. Past half full an
+        // RGBA8 image of the whole grid is smaller than a mesh record per particle, they are apart so a grid
+        // around the boundary doesn't switch every tick.
+        static constexpr float IMAGE_ENTER_FILL = 0.5f;
+        static constexpr float IMAGE_LEAVE_FILL = 0.375f;
+        // Cell sizes in pixels at which a 2D grid switches to and back from the image render mode regardless of
+        // the fill ratio. Smaller cells are drawn from the coarser levels of the image pyramid.
+        static constexpr float IMAGE_ENTER_PIXELS = 1.0f;
+        static constexpr float IMAGE_LEAVE_PIXELS = 2.0f;
+        // Fill ratios at which the mesh of a 2D grid switches to and back from merging equal cells into rectangles.
+        // The rectangles are merged from an image of the grid, below an eighth full it costs more than it saves.
+        static constexpr float MERGE_ENTER_FILL = 0.125f;
+        static constexpr float MERGE_LEAVE_FILL = 0.0625f;
+
+        // Meshes are culled to the view widened by this fraction of its size on every side, so small camera moves
+        // don't need another cull. Culled areas over CULL_SHRINK times the widened view are culled again.
+        static constexpr float CULL_MARGIN = 0.25f;
+        static constexpr float CULL_SHRINK = 4.0f;
+        // Cells on screen as of the last frame, see Camera::getVisibleArea.
+        static glm::vec4 viewArea;
+        // Pixels covered by the side of a cell as of the last frame, infinite while unknown.
+        static float getCellPixels();
 
         static std::mutex simLock;
         static std::mutex meshGenLock;
 
-        Voxel* particles;
+        // Set whenever a grid has something new to show, the callback wakes up whoever draws the frames.
+        static std::atomic<bool> frameRequested;
+        static std::function<void()> frameCallback;
+        static void requestFrame();
+
         std::list<uint> freeIndices;
 
         uint sizeX;
@@ -33,32 +79,150 @@ namespace unibox {
         uint sizeZ;
 
         uint particleCount;
-
-        cl::Buffer gridBuffer;
-        cl::Buffer* particleBuffer;
-        cl::Buffer* meshBuffer;
-
-        Buffer* meshBufferV;
+        // Every particle known to the host is below this slot, everything past it is free.
+        uint slotCount;
+        // Sum of the placed emissions as of the last applyEmission, see GridPipeline::getEmitPlaced.
+        uint emitPlaced;
+
+        OccupancyIndex occupancy;
+
+        // Owns the particles, the mesh and the image of the grid on whichever backend is running.
+        GridPipeline* gridPipeline;
+
+        // The renderer draws the front snapshot while the mesh of the latest tick is read into the back one,
+        // they are swapped once the read completes so neither the renderer nor the simulation waits on the other.
+        // A snapshot holds either the visible part of the mesh or an image of the grid. Copied snapshots are
+        // parts of the pool, shared ones are buffers of their own.
+        size_t snapshotOffset[2];
+        size_t snapshotSize[2];
+        // Slots covered by the mesh the snapshot was read from, nothing is drawn from it while 0. A mesh snapshot
+        // starts with the draw command of its cull, the amount of instances is only known to the device.
+        uint snapshotSlots[2];
+        bool snapshotImage[2];
+        // Cull area the snapshot was read with and whether it has to be read whole.
+        uint snapshotArea[2][4];
+        bool snapshotStale[2];
+        // Level of the image pyramid an image snapshot holds, shared snapshots hold all of them.
+        uint snapshotLevel[2];
+        uint frontSnapshot;
+        bool meshReadPending;
+        // Slots covered by the last generated mesh and whether it was generated as an image.
+        uint meshSlots;
+        bool meshImage;
+        // Cells the mesh is culled to, min x, min y, max x, max y, inclusive.
+        uint cullArea[4];
+        // Render mode of the following generations, picked from the fill ratio and the size of the cells on screen.
+        bool imageMode;
+        // Whether the following mesh generations merge equal cells and whether the mesh buffer holds merged records.
+        bool mergeMode;
+        bool meshMerged;
+        // Levels of the image pyramid and the one drawn, picked every frame.
+        std::vector<ImageLevel> imageLevels;
+        uint imageLevel;
+        // Storage buffer sets of the image pipeline, rebound when their snapshot is reallocated.
+        VkDescriptorSet imageSets[2];
+        bool imageSetsStale[2];
+        // Zero-copy mode, the snapshots are exported Vulkan buffers imported into the pipeline and the mesh is
+        // generated straight into the back one.
+        bool sharedMesh;
+        ExternalBuffer* sharedSnapshots[2];
+        // Tick every shared snapshot was last generated into as an image at.
+        uint sharedTicks[2];
+
+        // Tick of the last generation into the mesh and the image buffer, the next one only revisits the chunks
+        // changed since. 0 regenerates everything.
+        uint meshBufferTick;
+        uint imageBufferTick;
+        // Blocks changed since every snapshot was last read into, see MeshGenPipeline::DIRTY_BLOCK_SIZE.
+        std::vector<uint> snapshotDirty[2];
+        // Set until the dirty blocks of the last generation are read back from the device.
+        bool dirtyBlocksPending;
 
         bool dirty;
-
-        uint allocateParticleIndex();
+        bool meshDirty;
+        bool occupancyStale;
+        bool compactionPending;
+
+        // False if the particle buffer couldn't grow, index is left untouched then.
+        bool allocateParticleIndex(uint& index);
+        void rebuildOccupancy();
+        void storeVoxel(uint index, const Voxel& voxel);
+        void syncParticles();
+        void applyDeviceChanges();
+        void applyCompaction();
+        void applyEmission();
+        bool growParticles(uint count);
+        void wake(uint x, uint y, uint z);
+        void updateRenderMode();
+        void updateImageLevel();
+        void updateBufferTicks(uint tick);
+        bool collectDirtyBlocks(bool wait);
+        void foldDirtyBlocks(const std::vector<uint>& blocks);
+        bool isSnapshotCurrent(uint snapshot);
+        bool isMeshReadComplete();
+        bool updateCullArea();
+        bool cullMesh();
+        bool cullSharedMesh();
+        size_t getImageSize();
+        size_t getMeshSize();
+        bool generateMesh(uint capacity);
+        bool generateSharedMesh(uint capacity);
+        bool prepareSharedSnapshot(uint snapshot, size_t size);
+        // False if other grids are still reading into the pool, it can only grow once they are done.
+        bool growSnapshot(uint snapshot, size_t size);
+        void disableSharedMesh();
+        void startMeshRead();
+        void updateSnapshots();
+        VkBuffer getFrontSnapshot();
+        void renderMesh(VkCommandBuffer cmd);
+        void renderImage(VkCommandBuffer cmd);
     public:
         ParticleGrid(uint width, uint height, uint length);
         ~ParticleGrid();
 
-        void addVoxel(const Voxel& voxel);
-        void addVoxels(int x, int y, int z, const std::vector<Voxel>& voxels);
+        // False if the particle buffer ran out of space, voxels added before that stay in the grid.
+        bool addVoxel(const Voxel& voxel);
+        bool addVoxels(int x, int y, int z, const std::vector<Voxel>& voxels);
         void eraseVoxel(uint x, uint y, uint z);
-        std::optional<Voxel*> getVoxel(uint x, uint y, uint z);
+        std::optional<Voxel> getVoxel(uint x, uint y, uint z);
         bool isEmpty(uint x, uint y, uint z);
+        // Every live particle, as of the last tick.
+        std::vector<Voxel> getVoxels();
+        uint getParticleCount();
 
-        void render(VkCommandBuffer cmd);
-        void simulate();
+        // Sorts the particles by cell every given amount of ticks, 0 disables the sorting.
+        void setSortInterval(uint ticks);
+        void setMoveResolution(MoveResolution resolution);
+
+        // Chunk statistics of the last tick read back from the device.
+        uint getAwakeChunks();
+        uint getAsleepChunks();
+
+        // Runs the given amount of ticks back to back, the particles are only mapped again after the last one.
+        void simulate(uint steps = 1);
+        // Regenerates the mesh after host edits, simulate does this on its own.
+        void updateMesh();
+        // Blocks until every queued tick and mesh generation is done.
+        void finish();
+
+        // Per stage times of the grid's pipeline, see GridPipeline::collectProfile.
+        void setProfiling(bool enable);
+        void collectProfile(std::map<std::string, double>& phases);
 
         static void init(Camera& camera);
-        static void waitInitComplete();
+        // Only sets up the compute side, grids created after it can be simulated but not rendered.
+        static void initCompute();
+        // False if the simulation shader could not be built, grids can't be created then.
+        static bool waitInitComplete();
+
+        // The callback is called from the thread requesting the frame, it has to be set before any grid is simulated.
+        static void setFrameCallback(const std::function<void()>& callback);
+        // Whether the grids changed since the last call. Ticks without awake chunks don't request a frame,
+        // mesh reads still in flight keep requesting them until the new mesh is shown.
+        static bool takeFrameRequest();
 
         static void renderAll(VkCommandBuffer cmd);
+        static void simulateAll(uint steps = 1);
+        static void updateMeshAll();
     };
 }
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+namespace unibox {
+    // Runs ParticleGrid::simulateAll on its own thread at a fixed tick rate. Renderers pick up
+    // finished ticks from the mesh snapshots of the grids, so the frame rate and the tick rate are independent.
+    class SimulationThread {
+        std::thread thread;
+        std::mutex lock;
+        std::condition_variable wakeup;
+
+        bool running;
+        bool paused;
+        uint32_t pendingSteps;
+
+        double tickRate;
+        double speed;
+        // Ticks which may be run back to back to catch up, anything over it is dropped.
+        uint32_t maxCatchUp;
+
+        uint64_t tickCount;
+
+        void run();
+    public:
+        SimulationThread(double tickRate = 60.0);
+        ~SimulationThread();
+
+        SimulationThread(const SimulationThread&) = delete;
+        SimulationThread& operator=(const SimulationThread&) = delete;
+
+        void start();
+        void stop();
+
+        void setTickRate(double ticksPerSecond);
+        double getTickRate();
+        // Multiplier of the tick rate, values above 1 fast forward.
+        void setSpeed(double multiplier);
+        double getSpeed();
+        void setMaxCatchUp(uint32_t ticks);
+
+        void pause();
+        void resume();
+        bool isPaused();
+        // Runs the given amount of ticks while paused.
+        void step(uint32_t ticks = 1);
+
+        uint64_t getTickCount();
+    };
+}
@@ -12,7 +12,60 @@ namespace unibox {
         unsigned int state;
     };
 
+    // Device storage of a Voxel, must match ParticleHot and ParticleCold in simulator.cl. The hot part is all
+    // the grid passes need, the cold part is only touched by the update functions and the mesh generation.
+    struct VoxelHot {
+        unsigned short type;
+        unsigned short stype;
+        unsigned short position[3];
+        unsigned short padding;
+        unsigned int state;
+    };
+
+    struct VoxelCold {
+        unsigned char paintColor[4];
+        unsigned int data[4];
+        float velocity[3];
+        unsigned short subPosition[3];
+        unsigned short temperature;
+    };
+
+    void packVoxel(const Voxel& voxel, VoxelHot& hot, VoxelCold& cold);
+    Voxel unpackVoxel(const VoxelHot& hot, const VoxelCold& cold);
+
     struct GridPoint {
         uint particleOffset;
+        uint claim;
+    };
+
+    // Geometry of the two level brick map, must match GridInfo in simulator.cl.
+    // Flat worlds use 32x32 bricks, 3D worlds use 16x16x16 bricks.
+    struct GridInfo {
+        uint sizeX;
+        uint sizeY;
+        uint sizeZ;
+
+        uint brickShift;
+        uint brickShiftZ;
+
+        uint bricksX;
+        uint bricksY;
+        uint bricksZ;
+
+        uint getCellsPerBrick() const { return 1 << (brickShift*2+brickShiftZ); }
+        uint getBrickCount() const { return bricksX*bricksY*bricksZ; }
+
+        static GridInfo create(uint sizeX, uint sizeY, uint sizeZ) {
+            GridInfo info;
+            info.sizeX = sizeX;
+            info.sizeY = sizeY;
+            info.sizeZ = sizeZ;
+            info.brickShift = sizeZ > 1 ? 4 : 5;
+            info.brickShiftZ = sizeZ > 1 ? 4 : 0;
+            info.bricksX = (sizeX+(1 << info.brickShift)-1) >> info.brickShift;
+            info.bricksY = (sizeY+(1 << info.brickShift)-1) >> info.brickShift;
+            info.bricksZ = (sizeZ+(1 << info.brickShiftZ)-1) >> info.brickShiftZ;
+            return info;
+        }
     };
-}
\ No newline at end of file
+}
@@ -23,16 +23,23 @@ namespace unibox {
     
         std::ifstream fileStream;
 
-        void particleReadVersion1();
+        bool particleReadVersion1();
     public:
         SaveFile(const std::string& file);
         ~SaveFile();
 
-        void readParticles();
+        // False if the file is missing, not a save or cut short.
+        bool readParticles();
         std::vector<Voxel>& getParticles() { return particles; }
 
         uint32_t getSizeX();
         uint32_t getSizeY();
         uint32_t getSizeZ();
+
+        const std::string& getName() { return name; }
+        const std::string& getDescription() { return description; }
+
+        // Writes the particles in the newest format, particle types are stored by name.
+        static bool write(const std::string& file, const std::string& name, const std::string& description, uint32_t sizeX, uint32_t sizeY, uint32_t sizeZ, const std::vector<Voxel>& particles);
     };
 }
\ No newline at end of file
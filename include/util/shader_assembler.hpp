@@ -8,12 +8,21 @@
 
 #include <CL/cl.hpp>
 
+#include <native-engine/engine.hpp>
+#include <native-engine/program.hpp>
+
 namespace unibox {
     class ShaderAssembler {
         std::string code;
         std::vector<uint32_t> bytecode;
 
         static TBuiltInResource getResources();
+
+        // Built OpenCL programs are kept here, keyed by a hash of the source, the device and the driver.
+        static std::string programCacheDirectory;
+        std::string getProgramCacheKey(const cl::Device& device);
+        cl::Program* loadCachedProgram(const cl::Context& context, const cl::Device& device, const std::string& path);
+        void storeCachedProgram(cl::Program& program, const std::string& path);
     public:
         ShaderAssembler(const std::string& baseFile);
         ~ShaderAssembler();
@@ -23,8 +32,13 @@ namespace unibox {
         bool hasPragma(const std::string& pragmaName);
 
         std::vector<uint32_t>& compile(EShLanguage language);
+        // Loads the program from the binary cache if it was built before, builds and stores it otherwise.
         cl::Program* compile(const cl::Context& context, const cl::Device& device);
+        NativeProgram* compile(NativeEngine& engine, const std::string& name);
 
         void dump(std::ostream& stream);
+
+        // An empty directory disables the program binary cache.
+        static void setProgramCacheDirectory(const std::string& directory);
     };
 }
\ No newline at end of file
@@ -83,6 +83,16 @@ namespace unibox {
 
         std::recursive_mutex descriptorAllocatorLock;
 
+        // Set if buffer memory can be exported as an opaque file descriptor, see ExternalBuffer.
+        bool externalMemory;
+        uint8_t deviceUUID[VK_UUID_SIZE];
+        PFN_vkGetMemoryFdKHR getMemoryFd;
+
+        void init_external_memory();
+
+        // Set if one indirect call can draw several commands, each with its own first instance.
+        bool multiDraw;
+
     public:
         Engine();
         ~Engine();
@@ -97,6 +107,9 @@ namespace unibox {
 
         VkDevice getDevice() { return device; }
         VkRenderPass getRenderPass() { return renderpass; }
+        // Size of the swapchain images in pixels.
+        uint32_t getWidth() { return width; }
+        uint32_t getHeight() { return height; }
 
         void addRenderFunction(std::function<void(VkCommandBuffer)> renderFunc);
 
@@ -113,6 +126,14 @@ namespace unibox {
         uint32_t getQueueIndex(QueueType type);
 
         const VkPhysicalDeviceProperties& getProperties();
+        VkPhysicalDevice getPhysicalDevice() { return vkb_physDevice.physical_device; }
+
+        bool supportsExternalMemory() { return externalMemory; }
+        bool supportsMultiDraw() { return multiDraw; }
+        // Identifies the device across APIs, only valid if external memory is supported.
+        const uint8_t* getDeviceUUID() { return deviceUUID; }
+        // Returns a new file descriptor of the memory, the caller owns it. -1 on failure.
+        int exportMemory(VkDeviceMemory memory);
 
         static Engine* getInstance() { return instance; }
 
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+
+namespace unibox {
+    // Device local buffer with exportable memory, lets OpenCL write straight into it. VMA can't
+    // export its allocations, so the buffer has its own dedicated allocation.
+    class ExternalBuffer {
+        VkBuffer handle;
+        VkDeviceMemory memory;
+
+        size_t size;
+        bool valid;
+    public:
+        ExternalBuffer(size_t size, VkBufferUsageFlags usage);
+        ~ExternalBuffer();
+
+        ExternalBuffer(const ExternalBuffer&) = delete;
+        ExternalBuffer& operator=(const ExternalBuffer&) = delete;
+
+        bool isValid();
+        size_t getSize();
+        // New file descriptor of the memory, the caller owns it. -1 on failure.
+        int exportMemory();
+
+        VkBuffer& getHandle();
+    };
+}
@@ -7,6 +7,7 @@
 
 #include <algorithm>
 #include <list>
+#include <atomic>
 
 namespace unibox {
     class Window {
@@ -17,8 +18,14 @@ namespace unibox {
     
         std::list<std::function<void(double, double, int)>> mouseDownCallbacks;
         std::list<std::function<void(double, double, int)>> mouseUpCallbacks;
+        std::list<std::function<void(int, int)>> keyDownCallbacks;
+        // Set by every input event and whenever the window contents have to be redrawn, cleared by takeInput.
+        std::atomic<bool> inputReceived;
 
         static void mouseButtonCallback(GLFWwindow* window, int, int, int);
+        static void keyCallback(GLFWwindow* window, int, int, int, int);
+        static void cursorCallback(GLFWwindow* window, double, double);
+        static void refreshCallback(GLFWwindow* window);
     public:
         Window();
         ~Window();
@@ -27,6 +34,12 @@ namespace unibox {
 
         bool shouldClose();
         void frameStart();
+        // Sleeps until an event arrives, wakeUp is called or the timeout in seconds passes, then handles the events.
+        void waitEvents(double timeout);
+        // Makes waitEvents return, can be called from any thread.
+        void wakeUp();
+        // Whether there was any input since the last call.
+        bool takeInput();
         void render();
 
         void waitIdle();
@@ -38,5 +51,7 @@ namespace unibox {
 
         void addMouseDownCallback(std::function<void(double, double, int)> callback);
         void addMouseUpCallback(std::function<void(double, double, int)> callback);
+        // Called with the GLFW key and modifiers whenever a key is pressed.
+        void addKeyDownCallback(std::function<void(int, int)> callback);
     };
 }
\ No newline at end of file
@@ -0,0 +1,100 @@
+#pragma COMPILATION_REMOVE
+// This is here to stop the plugin from screaming that Particle is not a type.
+typedef struct {
+    ushort type;
+    ushort stype;
+    float paintColor[4];
+    int data[4];
+    float temperature;
+    float velocity[3];
+    float position[3];
+    uint state;
+} Particle;
+
+typedef struct {
+    ushort type;
+    ushort stype;
+    ushort position[3];
+    ushort padding;
+    uint state;
+} ParticleHot;
+
+typedef struct {
+    uchar paintColor[4];
+    int data[4];
+    float velocity[3];
+    ushort subPosition[3];
+    ushort temperature;
+} ParticleCold;
+
+typedef struct {
+    uint particleOffset;
+    uint claim;
+} GridPoint;
+
+typedef struct {
+    uint sizeX;
+    uint sizeY;
+    uint sizeZ;
+    uint brickShift;
+    uint brickShiftZ;
+    uint bricksX;
+    uint bricksY;
+    uint bricksZ;
+} GridInfo;
+
+typedef struct {
+    float density;
+    uint state;
+} ParticleInfo;
+
+typedef struct {
+    global ParticleHot* particles;
+    global ParticleCold* particleData;
+    global uint* brickTable;
+    global GridPoint* bricks;
+    global ParticleInfo* particleInfo;
+
+    GridInfo info;
+
+    uint sizeX;
+    uint sizeY;
+    uint sizeZ;
+    uint particleCount;
+
+    global uint* activity;
+    global uint* emitOffsets;
+    uint* emitted;
+    uint emitMode;
+    uint emitBase;
+    uint work;
+    uint tick;
+} SimulationStructures;
+#pragma END_COMPILATION_REMOVE
+
+// Shines upwards, a new photon leaves every time the cell above is free.
+void unibox_lamp_update(const SimulationStructures structs, Particle* vertex) {
+    const int x = (int)vertex->position[0];
+    const int y = (int)vertex->position[1]+1;
+    const int z = (int)vertex->position[2];
+    if(!checkBounds(structs, x, y, z) || !isEmpty(structs, (uint)x, (uint)y, (uint)z)) return;
+
+    Particle photon;
+    photon.type = UNIBOX_PHOTON;
+    photon.stype = 0;
+    photon.state = 0;
+    photon.temperature = vertex->temperature;
+    for(int i = 0; i < 4; i++) {
+        photon.paintColor[i] = 0;
+        photon.data[i] = 0;
+    }
+    // The light color uses the same bits as the photons, white unless the lamp says otherwise.
+    photon.data[0] = vertex->data[0] != 0 ? vertex->data[0] : (int)0xFF0FF0FF;
+    photon.position[0] = x+0.5f;
+    photon.position[1] = y+0.5f;
+    photon.position[2] = vertex->position[2];
+    photon.velocity[0] = 0;
+    photon.velocity[1] = 1;
+    photon.velocity[2] = 0;
+    emitParticle(structs, photon);
+}
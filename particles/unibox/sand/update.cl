@@ -11,24 +11,64 @@ typedef struct {
     uint state;
 } Particle;
 
+typedef struct {
+    ushort type;
+    ushort stype;
+    ushort position[3];
+    ushort padding;
+    uint state;
+} ParticleHot;
+
+typedef struct {
+    uchar paintColor[4];
+    int data[4];
+    float velocity[3];
+    ushort subPosition[3];
+    ushort temperature;
+} ParticleCold;
+
 typedef struct {
     uint particleOffset;
+    uint claim;
 } GridPoint;
 
+typedef struct {
+    uint sizeX;
+    uint sizeY;
+    uint sizeZ;
+    uint brickShift;
+    uint brickShiftZ;
+    uint bricksX;
+    uint bricksY;
+    uint bricksZ;
+} GridInfo;
+
 typedef struct {
     float density;
     uint state;
 } ParticleInfo;
 
 typedef struct {
-    global Particle* particles;
-    global GridPoint* grid;
+    global ParticleHot* particles;
+    global ParticleCold* particleData;
+    global uint* brickTable;
+    global GridPoint* bricks;
     global ParticleInfo* particleInfo;
 
+    GridInfo info;
+
     uint sizeX;
     uint sizeY;
     uint sizeZ;
     uint particleCount;
+
+    global uint* activity;
+    global uint* emitOffsets;
+    uint* emitted;
+    uint emitMode;
+    uint emitBase;
+    uint work;
+    uint tick;
 } SimulationStructures;
 #pragma END_COMPILATION_REMOVE
 
@@ -93,8 +133,8 @@ void unibox_sand_update(const SimulationStructures structs, Particle* vertex) {
         vertex->state |= 0x01;
     else vertex->state &= 0xFFFFFFFE;
 
+    // The stuck bit stays set for as long as the particle can't move, only the velocity decays.
     if((vertex->state & 0x01) != 0) {
-        vertex->state &= 0xFFFFFFFE;
         vertex->velocity[0] *= 0.9;
         vertex->velocity[1] *= 0.9;
         vertex->velocity[2] *= 0.9;
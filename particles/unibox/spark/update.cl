@@ -11,24 +11,64 @@ typedef struct {
     uint state;
 } Particle;
 
+typedef struct {
+    ushort type;
+    ushort stype;
+    ushort position[3];
+    ushort padding;
+    uint state;
+} ParticleHot;
+
+typedef struct {
+    uchar paintColor[4];
+    int data[4];
+    float velocity[3];
+    ushort subPosition[3];
+    ushort temperature;
+} ParticleCold;
+
 typedef struct {
     uint particleOffset;
+    uint claim;
 } GridPoint;
 
+typedef struct {
+    uint sizeX;
+    uint sizeY;
+    uint sizeZ;
+    uint brickShift;
+    uint brickShiftZ;
+    uint bricksX;
+    uint bricksY;
+    uint bricksZ;
+} GridInfo;
+
 typedef struct {
     float density;
     uint state;
 } ParticleInfo;
 
 typedef struct {
-    global Particle* particles;
-    global GridPoint* grid;
+    global ParticleHot* particles;
+    global ParticleCold* particleData;
+    global uint* brickTable;
+    global GridPoint* bricks;
     global ParticleInfo* particleInfo;
 
+    GridInfo info;
+
     uint sizeX;
     uint sizeY;
     uint sizeZ;
     uint particleCount;
+
+    global uint* activity;
+    global uint* emitOffsets;
+    uint* emitted;
+    uint emitMode;
+    uint emitBase;
+    uint work;
+    uint tick;
 } SimulationStructures;
 
 #pragma END_COMPILATION_REMOVE
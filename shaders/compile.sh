@@ -10,8 +10,13 @@ mkdir -p $OUTPUT/shaders/default
 mkdir -p $OUTPUT/shaders/compute
 glslc default/default.vert -o $OUTPUT/shaders/default/vertex.spv
 glslc default/default.frag -o $OUTPUT/shaders/default/fragment.spv
+mkdir -p $OUTPUT/shaders/grid
+glslc grid/grid.vert -o $OUTPUT/shaders/grid/vertex.spv
+glslc grid/grid.frag -o $OUTPUT/shaders/grid/fragment.spv
 cp compute/meshGenerator.cl $OUTPUT/shaders/compute/meshGenerator.cl
 cp compute/simulator.cl $OUTPUT/shaders/compute/simulator.cl
+mkdir -p $OUTPUT/shaders/native
+cp native/opencl.hpp $OUTPUT/shaders/native/opencl.hpp
 
 mkdir -p $OUTPUT/shaders/gui/texture
 mkdir -p $OUTPUT/shaders/gui/color
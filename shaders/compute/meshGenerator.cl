@@ -10,10 +10,58 @@ typedef struct {
     uint state;
 } Particle;
 
+// Storage layout of the particles, see simulator.cl.
 typedef struct {
-    float4 vertex;
-    float4 color;
-} Vertex;
+    ushort type;
+    ushort stype;
+    ushort position[3];
+    ushort padding;
+    uint state;
+} ParticleHot;
+
+typedef struct {
+    uchar paintColor[4];
+    int data[4];
+    float velocity[3];
+    ushort subPosition[3];
+    ushort temperature;
+} ParticleCold;
+
+// Expanded into a quad by the vertex shader, see MeshInstance.
+typedef struct {
+    ushort position[2];
+    // Cells covered from the position on, merged meshes cover more than one.
+    ushort size[2];
+    // RGBA8, red in the lowest byte.
+    uint color;
+} Instance;
+
+#define EMPTY_INSTANCE 0xFFFF
+
+// Draw command in front of the culled records, same layout as VkDrawIndirectCommand, see MeshDrawCommand.
+typedef struct {
+    uint vertexCount;
+    uint instanceCount;
+    uint firstVertex;
+    uint firstInstance;
+} DrawCommand;
+
+// Same as in simulator.cl, the chunk activity is used to skip everything which didn't change.
+typedef struct {
+    uint sizeX;
+    uint sizeY;
+    uint sizeZ;
+
+    uint brickShift;
+    uint brickShiftZ;
+
+    uint bricksX;
+    uint bricksY;
+    uint bricksZ;
+} GridInfo;
+
+// Mesh records or image cells per bit of the dirty block mask, the host only uploads marked blocks.
+#define MESH_BLOCK_SHIFT 10
 
 typedef struct {
     float4 materialColor;
@@ -25,38 +73,218 @@ typedef struct {
 
 #pragma PARTICLE_CODE
 
-__kernel void generate(global Particle* particles, global Vertex* output, constant ParticleInfo* particleInfo, uint particleCount) {
+// Only the draw functions need the whole particle, empty slots never read the cold array.
+Particle loadParticle(const ParticleHot hot, global ParticleCold* particleData, uint index) {
+    const ParticleCold cold = particleData[index];
+
+    Particle particle;
+    particle.type = hot.type;
+    particle.stype = hot.stype;
+    particle.state = hot.state;
+    for(int i = 0; i < 3; i++) {
+        particle.position[i] = hot.position[i] + cold.subPosition[i]/65536.0f;
+        particle.velocity[i] = cold.velocity[i];
+    }
+    for(int i = 0; i < 4; i++) {
+        particle.paintColor[i] = cold.paintColor[i]/255.0f;
+        particle.data[i] = cold.data[i];
+    }
+    particle.temperature = vload_half(0, (const half*)&cold.temperature);
+    return particle;
+}
+
+uint getBrickIndex(const GridInfo info, uint x, uint y, uint z) {
+    return (x >> info.brickShift) + (y >> info.brickShift)*info.bricksX + (z >> info.brickShiftZ)*info.bricksX*info.bricksY;
+}
+
+// Every change to a particle stamps its chunk with the current tick, see wakeCell in simulator.cl.
+bool chunkChanged(global uint* activity, uint brick, uint sinceTick) {
+    return (int)(activity[brick] - sinceTick) >= 0;
+}
+
+void markDirty(global uint* dirtyBlocks, uint index) {
+    const uint block = index >> MESH_BLOCK_SHIFT;
+    atomic_or(&dirtyBlocks[block >> 5], 1u << (block & 31));
+}
+
+// Final color of a live particle packed as RGBA8, both render modes draw the same colors.
+uint particleColor(const ParticleHot hot, global ParticleCold* particleData, constant ParticleInfo* particleInfo, uint index) {
+    Particle particle = loadParticle(hot, particleData, index);
+    float4 baseColor = particleInfo[particle.type-1].materialColor;
+    switch(particle.type) {
+        #pragma PARTICLE_SWITCH
+        default: break;
+    }
+    const float3 color = mix(
+        baseColor.xyz,
+        (float3)(particle.paintColor[0], particle.paintColor[1], particle.paintColor[2]),
+        particle.paintColor[3]);
+    const uint r = (uint)(clamp(color.x, 0.0f, 1.0f)*255.0f + 0.5f);
+    const uint g = (uint)(clamp(color.y, 0.0f, 1.0f)*255.0f + 0.5f);
+    const uint b = (uint)(clamp(color.z, 0.0f, 1.0f)*255.0f + 0.5f);
+    const uint a = (uint)(clamp(baseColor.w, 0.0f, 1.0f)*255.0f + 0.5f);
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+Instance emptyInstance() {
+    Instance instance;
+    instance.position[0] = EMPTY_INSTANCE;
+    instance.position[1] = 0;
+    instance.size[0] = 0;
+    instance.size[1] = 0;
+    instance.color = 0;
+    return instance;
+}
+
+// Records are compared with the previous ones so the host only uploads what actually changed.
+void storeInstance(global Instance* output, global uint* dirtyBlocks, uint index, const Instance instance) {
+    const Instance previous = output[index];
+    if(previous.position[0] == instance.position[0] && previous.position[1] == instance.position[1]
+        && previous.size[0] == instance.size[0] && previous.size[1] == instance.size[1] && previous.color == instance.color) return;
+    output[index] = instance;
+    markDirty(dirtyBlocks, index);
+}
+
+// Only particles in chunks changed since sinceTick are revisited, the rest of the output is still current.
+__kernel void generate(global ParticleHot* particles, global ParticleCold* particleData, global Instance* output, constant ParticleInfo* particleInfo, global uint* activity, global uint* dirtyBlocks, const GridInfo info, uint particleCount, uint sinceTick) {
     uint index = get_global_id(0);
     if(index >= particleCount) return;
 
-    float w = -1.0;
-    Particle particle = particles[index];
+    const ParticleHot hot = particles[index];
+    if(hot.type > 0 && !chunkChanged(activity, getBrickIndex(info, hot.position[0], hot.position[1], hot.position[2]), sinceTick)) return;
+
+    Instance instance = emptyInstance();
+    if(hot.type > 0) {
+        instance.position[0] = hot.position[0];
+        instance.position[1] = hot.position[1];
+        instance.size[0] = 1;
+        instance.size[1] = 1;
+        instance.color = particleColor(hot, particleData, particleInfo, index);
+    }
+    storeInstance(output, dirtyBlocks, index, instance);
+}
 
-    if(particle.type > 0) {
-        float4 baseColor = particleInfo[particle.type-1].materialColor;
-        switch(particle.type) {
-            #pragma PARTICLE_SWITCH
-            default: break;
+// Whether row y of the image holds exactly the run of color from startX to endX, bounded by other colors or by the
+// chunk on both sides.
+bool isRun(global uint* image, const GridInfo info, uint startX, uint endX, uint y, uint chunkStartX, uint chunkEndX, uint color) {
+    if(startX > chunkStartX && image[startX-1 + y*info.sizeX] == color) return false;
+    if(endX < chunkEndX && image[endX + y*info.sizeX] == color) return false;
+    for(uint x = startX; x < endX; x++) if(image[x + y*info.sizeX] != color) return false;
+    return true;
+}
+
+// Merged mesh of a flat grid, built from the image generated before it. Runs of cells with the same color in a row
+// are merged into one record, and so are identical runs in the rows below. Only the particle in the top left cell
+// of such a rectangle writes it, every other slot is empty. Rectangles never leave their chunk, so like in generate
+// only the particles of changed chunks have to be revisited.
+__kernel void generateMerged(global ParticleHot* particles, global Instance* output, global uint* image, global uint* activity, global uint* dirtyBlocks, const GridInfo info, uint particleCount, uint sinceTick) {
+    uint index = get_global_id(0);
+    if(index >= particleCount) return;
+
+    const ParticleHot hot = particles[index];
+    if(hot.type > 0 && !chunkChanged(activity, getBrickIndex(info, hot.position[0], hot.position[1], 0), sinceTick)) return;
+
+    Instance instance = emptyInstance();
+    if(hot.type > 0) {
+        const uint x = hot.position[0];
+        const uint y = hot.position[1];
+        const uint color = image[x + y*info.sizeX];
+        const uint chunkStartX = (x >> info.brickShift) << info.brickShift;
+        const uint chunkStartY = (y >> info.brickShift) << info.brickShift;
+        const uint chunkEndX = min(chunkStartX + (1 << info.brickShift), info.sizeX);
+        const uint chunkEndY = min(chunkStartY + (1 << info.brickShift), info.sizeY);
+
+        // Cells past the start of a run or below an identical one belong to a rectangle written by another particle.
+        // Empty cells are 0 as well, a particle of that color is never merged.
+        uint endX = x+1;
+        uint endY = y+1;
+        bool head = true;
+        if(color != 0) {
+            head = x == chunkStartX || image[x-1 + y*info.sizeX] != color;
+            while(head && endX < chunkEndX && image[endX + y*info.sizeX] == color) endX++;
+            head = head && (y == chunkStartY || !isRun(image, info, x, endX, y-1, chunkStartX, chunkEndX, color));
+            while(head && endY < chunkEndY && isRun(image, info, x, endX, endY, chunkStartX, chunkEndX, color)) endY++;
         }
-        w = 1.0;
-        for(int i = 0; i < 6; i++) 
-            output[index*6+i].color = (float4)(mix(
-                    baseColor.xyz,
-                    (float3)(particle.paintColor[0], particle.paintColor[1], particle.paintColor[2]),
-                    particle.paintColor[3]),
-                baseColor.w);
+        if(head) {
+            instance.position[0] = x;
+            instance.position[1] = y;
+            instance.size[0] = endX-x;
+            instance.size[1] = endY-y;
+            instance.color = color;
+        }
+    }
+    storeInstance(output, dirtyBlocks, index, instance);
+}
+
+// Image render mode, first clears every row of the chunks changed since sinceTick, one work item per row.
+__kernel void clearImage(global uint* image, global uint* activity, global uint* dirtyBlocks, const GridInfo info, uint sinceTick) {
+    uint index = get_global_id(0);
+    const uint brick = index >> info.brickShift;
+    if(brick >= info.bricksX*info.bricksY) return;
+    if(!chunkChanged(activity, brick, sinceTick)) return;
+
+    const uint y = ((brick / info.bricksX) << info.brickShift) + (index & ((1 << info.brickShift)-1));
+    const uint startX = (brick % info.bricksX) << info.brickShift;
+    const uint endX = min(startX + (1 << info.brickShift), info.sizeX);
+    if(y >= info.sizeY) return;
+    for(uint x = startX; x < endX; x++) image[x + y*info.sizeX] = 0;
+    markDirty(dirtyBlocks, startX + y*info.sizeX);
+    markDirty(dirtyBlocks, endX-1 + y*info.sizeX);
+}
+
+// Then every particle in those chunks writes its color into its cell of the sizeX x sizeY RGBA8 image.
+__kernel void generateImage(global ParticleHot* particles, global ParticleCold* particleData, global uint* image, constant ParticleInfo* particleInfo, global uint* activity, const GridInfo info, uint particleCount, uint sinceTick) {
+    uint index = get_global_id(0);
+    if(index >= particleCount) return;
+
+    const ParticleHot hot = particles[index];
+    if(hot.type == 0) return;
+    if(!chunkChanged(activity, getBrickIndex(info, hot.position[0], hot.position[1], 0), sinceTick)) return;
+    image[hot.position[0] + hot.position[1]*info.sizeX] = particleColor(hot, particleData, particleInfo, index);
+}
+
+// Builds a level of the image pyramid from the previous one, one work item per cell of the new level. A cell is
+// the average of its up to four children weighted by their alpha, its alpha is how much of it they cover.
+// Cells within a single chunk are only rebuilt if that chunk changed since sinceTick.
+__kernel void reduceImage(global uint* image, global uint* activity, global uint* dirtyBlocks, const GridInfo info, uint sourceOffset, uint sourceWidth, uint sourceHeight, uint offset, uint width, uint height, uint level, uint sinceTick) {
+    uint index = get_global_id(0);
+    if(index >= width*height) return;
+    const uint x = index % width;
+    const uint y = index / width;
+    if(level <= info.brickShift && !chunkChanged(activity, getBrickIndex(info, x << level, y << level, 0), sinceTick)) return;
+
+    float4 sum = (float4)(0.0f, 0.0f, 0.0f, 0.0f);
+    for(uint i = 0; i < 4; i++) {
+        const uint childX = x*2 + (i & 1);
+        const uint childY = y*2 + (i >> 1);
+        if(childX >= sourceWidth || childY >= sourceHeight) continue;
+        const uint child = image[sourceOffset + childX + childY*sourceWidth];
+        const float alpha = (float)(child >> 24) / 255.0f;
+        sum = sum + (float4)((float)(child & 0xFF)*alpha, (float)((child >> 8) & 0xFF)*alpha, (float)((child >> 16) & 0xFF)*alpha, alpha);
+    }
+    uint color = 0;
+    if(sum.w > 0.0f) {
+        const uint r = (uint)(sum.x/sum.w + 0.5f);
+        const uint g = (uint)(sum.y/sum.w + 0.5f);
+        const uint b = (uint)(sum.z/sum.w + 0.5f);
+        const uint a = (uint)(sum.w*0.25f*255.0f + 0.5f);
+        color = r | (g << 8) | (b << 16) | (max(a, 1u) << 24);
     }
+    if(image[offset + index] == color) return;
+    image[offset + index] = color;
+    markDirty(dirtyBlocks, offset + index);
+}
+
+// Packs the records inside the given cell area behind the draw command of the visible list, only those are uploaded
+// and drawn. The command is reset by the host, every packed record counts an instance into it.
+// The area is inclusive and already widened by half a cell for the quads reaching into it.
+__kernel void cull(global Instance* mesh, global DrawCommand* visible, uint minX, uint minY, uint maxX, uint maxY, uint particleCount) {
+    uint index = get_global_id(0);
+    if(index >= particleCount) return;
 
-    const float3 offset = (float3)((uint)particle.position[0], (uint)particle.position[1], 0);
-    const float4 v0 = (float4)((float3)(-0.5f, -0.5f, 0.0f)+offset, w);
-    const float4 v1 = (float4)((float3)(-0.5f,  0.5f, 0.0f)+offset, w);
-    const float4 v2 = (float4)((float3)( 0.5f, -0.5f, 0.0f)+offset, w);
-    const float4 v3 = (float4)((float3)( 0.5f,  0.5f, 0.0f)+offset, w);
-
-    output[index*6+0].vertex = v0;
-    output[index*6+1].vertex = v1;
-    output[index*6+2].vertex = v2;
-    output[index*6+3].vertex = v2;
-    output[index*6+4].vertex = v1;
-    output[index*6+5].vertex = v3;
+    const Instance instance = mesh[index];
+    if(instance.position[0] == EMPTY_INSTANCE) return;
+    if(instance.position[0] > maxX || instance.position[0] + instance.size[0] <= minX || instance.position[1] > maxY || instance.position[1] + instance.size[1] <= minY) return;
+    global Instance* records = (global Instance*)(visible + 1);
+    records[atomic_inc(&visible->instanceCount)] = instance;
 }
\ No newline at end of file
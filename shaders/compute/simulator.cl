@@ -7,16 +7,83 @@ typedef struct {
     float velocity[3];
     float position[3];
     uint state; // bits 0-23 for use by particle, 24-31 reserved
-    // There will be two shader runs, the first one will determine how much particles will be placed to allocate memory for them.
-    // The second run will be the simulation run which will do all of the simulation and place the particles.
-    // There will be a variable used in those two runs for different purposes, in the pre-sim run it acts as a newParticleCount variable,
-    // in the second run it acts as the first id in particles array that can be used to store the newly created particles.
+    // Particles created with emitParticle go through two runs, countEmits runs the update functions only to count
+    // the emitted particles and after an exclusive scan of those counts the simulation run places them.
 } Particle;
 
+// Particles are stored as two arrays and unpacked into a Particle by loadParticle. The hot array holds
+// everything the grid passes and the work list look at, the cold one is only read by the update functions.
+typedef struct {
+    ushort type;
+    ushort stype;
+    ushort position[3]; // cell of the particle
+    ushort padding;
+    uint state;
+} ParticleHot;
+
+typedef struct {
+    uchar paintColor[4];
+    int data[4];
+    float velocity[3];
+    ushort subPosition[3]; // position within the cell in 1/65536 units
+    ushort temperature;    // half
+} ParticleCold;
+
 typedef struct {
     uint particleOffset;
+    uint claim; // Lowest index+1 of a particle which wants to move into this cell during the current tick.
 } GridPoint;
 
+#define UNCLAIMED 0xFFFFFFFF
+// Claim of an emitted particle, it's below every move so emissions always keep their cell.
+#define EMIT_CLAIM 0u
+
+// The grid is stored as a two level brick map. The brick table holds slot+1 of the brick in the brick
+// pool for every brick of the world (0 if nothing lives in it), bricks are allocated every tick and only
+// where particles are, so both memory and the per tick cost scale with the occupied volume.
+typedef struct {
+    uint sizeX;
+    uint sizeY;
+    uint sizeZ;
+
+    uint brickShift;  // log2 of the brick size along X and Y
+    uint brickShiftZ; // log2 of the brick size along Z, 0 for flat worlds
+
+    uint bricksX;
+    uint bricksY;
+    uint bricksZ;
+} GridInfo;
+
+#define BRICK_MARKED 0x80000000
+#define NO_CELL 0xFFFFFFFF
+
+// Brick counters: 0 - allocated bricks, 1 - bricks which did not fit into the pool,
+// 2 - particles in the work list, 3 - awake chunks, 4 - sleeping chunks. Those are reset every tick,
+// 5 - particles which died on the device, is only reset by the compaction, 6 - first slot free for emitted particles,
+// 7 - particles emitted this tick, 8 - emitted particles which did not fit into the particle buffer this tick,
+// 9 - emitted particles which got a cell, summed up since the grid was created and never reset.
+#define COUNTER_BRICKS 0
+#define COUNTER_OVERFLOW 1
+#define COUNTER_ACTIVE 2
+#define COUNTER_AWAKE 3
+#define COUNTER_ASLEEP 4
+#define COUNTER_DEAD 5
+#define COUNTER_EMIT_BASE 6
+#define COUNTER_EMITTED 7
+#define COUNTER_EMIT_OVERFLOW 8
+#define COUNTER_EMIT_PLACED 9
+
+#define EMIT_NONE 0
+#define EMIT_COUNT 1
+#define EMIT_PLACE 2
+
+#define SCAN_BLOCK 256
+#define RADIX_BITS 4
+#define RADIX_BINS (1 << RADIX_BITS)
+
+// Bricks double as simulation chunks, a chunk falls asleep once nothing in or next to it has changed for this many ticks.
+#define SLEEP_TICKS 2
+
 typedef struct {
     float density;
     uint state; /**
@@ -26,74 +93,617 @@ typedef struct {
 } ParticleInfo;
 
 typedef struct {
-    global Particle* particles;
-    global GridPoint* grid;
+    global ParticleHot* particles;
+    global ParticleCold* particleData;
+    global uint* brickTable;
+    global GridPoint* bricks;
     constant ParticleInfo* particleInfo;
 
+    GridInfo info;
+
     uint sizeX;
     uint sizeY;
     uint sizeZ;
     uint particleCount;
+
+    // Particle emission state, see emitParticle.
+    global uint* activity;
+    global uint* emitOffsets;
+    global uint* counters;
+    uint* emitted;
+    uint emitMode;
+    uint emitBase;
+    uint work;
+    uint tick;
 } SimulationStructures;
 
 // Utility functions
-uint calculatePosition(const SimulationStructures simStruct, uint x, uint y, uint z);
+Particle loadParticle(global ParticleHot* particles, global ParticleCold* particleData, uint index);
+void storeParticle(global ParticleHot* particles, global ParticleCold* particleData, uint index, const Particle particle);
+uint getBrickIndex(const GridInfo info, uint x, uint y, uint z);
+uint getCell(const SimulationStructures simStruct, uint x, uint y, uint z);
 bool checkBounds(const SimulationStructures simStruct, int x, int y, int z);
 uint getOffset(const SimulationStructures simStruct, uint x, uint y, uint z);
 bool isEmpty(const SimulationStructures simStruct, uint x, uint y, uint z);
 Particle getParticle(const SimulationStructures simStruct, uint x, uint y, uint z);
 ParticleInfo getParticleInfo(const SimulationStructures simStruct, Particle particle);
+// Creates a new particle in an empty cell. The target cell should be checked with isEmpty first, the particle
+// is dropped if the cell was taken at the start of the tick or by an earlier emission into it.
+void emitParticle(const SimulationStructures simStruct, Particle particle);
 
 #pragma PARTICLE_TYPES
 
+// Type ids are below TYPE_COUNT, the work list is bucketed by type.
+#pragma TYPE_COUNT
+
 #pragma INCLUDE_CODE
 
 #pragma PARTICLE_CODE
 
-__kernel void simulate(global Particle* particles, global GridPoint* grid, constant ParticleInfo* particleInfo, uint sizeX, uint sizeY, uint sizeZ, uint particleCount, uint updatesPerSecond) {
-    uint index = get_global_id(0);
-    if(index >= particleCount) return;
-
+SimulationStructures createStructures(global ParticleHot* particles, global ParticleCold* particleData, global uint* brickTable, global GridPoint* bricks, constant ParticleInfo* particleInfo, const GridInfo info, uint particleCount) {
     SimulationStructures structs;
     structs.particles = particles;
-    structs.grid = grid;
+    structs.particleData = particleData;
+    structs.brickTable = brickTable;
+    structs.bricks = bricks;
     structs.particleInfo = particleInfo;
-    structs.sizeX = sizeX;
-    structs.sizeY = sizeY;
-    structs.sizeZ = sizeZ;
+    structs.info = info;
+    structs.sizeX = info.sizeX;
+    structs.sizeY = info.sizeY;
+    structs.sizeZ = info.sizeZ;
     structs.particleCount = particleCount;
+    structs.emitMode = EMIT_NONE;
+    return structs;
+}
+
+void setupEmission(SimulationStructures* structs, global uint* activity, global uint* emitOffsets, global uint* counters, uint* emitted, uint work, uint tick, uint emitMode) {
+    structs->activity = activity;
+    structs->emitOffsets = emitOffsets;
+    structs->counters = counters;
+    structs->emitted = emitted;
+    structs->emitMode = emitMode;
+    structs->emitBase = counters[COUNTER_EMIT_BASE];
+    structs->work = work;
+    structs->tick = tick;
+}
+
+// Particles without an update function never end up in the work list.
+bool hasUpdate(ushort type) {
+    switch(type) {
+        #pragma PARTICLE_UPDATED_TYPES
+            return true;
+        default: return false;
+    }
+}
+
+bool particleChanged(const Particle before, const Particle after) {
+    // The state includes the stuck bit (0x01), a particle getting stuck or free again wakes its neighbours.
+    if(before.type != after.type || before.stype != after.stype || before.state != after.state || before.temperature != after.temperature) return true;
+    if((uint)before.position[0] != (uint)after.position[0] || (uint)before.position[1] != (uint)after.position[1] || (uint)before.position[2] != (uint)after.position[2]) return true;
+    for(int i = 0; i < 4; i++) if(before.data[i] != after.data[i] || before.paintColor[i] != after.paintColor[i]) return true;
+    return false;
+}
+
+// Movement within a cell and velocity changes don't wake anything but still have to be stored,
+// otherwise a particle pressed against another one would keep its whole neighbourhood awake.
+bool particleMoved(const Particle before, const Particle after) {
+    for(int i = 0; i < 3; i++) if(before.velocity[i] != after.velocity[i]) return true;
+    return before.position[0] != after.position[0] || before.position[1] != after.position[1] || before.position[2] != after.position[2];
+}
+
+// Stamps the chunk of a cell and every chunk touching its neighbourhood as active during this tick.
+void wakeCell(global uint* activity, const GridInfo info, uint x, uint y, uint z, uint tick) {
+    const uint own = getBrickIndex(info, x, y, z);
+    activity[own] = tick;
+    const int rangeZ = info.sizeZ > 1 ? 1 : 0;
+    for(int dz = -rangeZ; dz <= rangeZ; dz++) {
+        for(int dy = -1; dy <= 1; dy++) {
+            for(int dx = -1; dx <= 1; dx++) {
+                const int nx = (int)x+dx;
+                const int ny = (int)y+dy;
+                const int nz = (int)z+dz;
+                if(nx < 0 || ny < 0 || nz < 0 || nx >= info.sizeX || ny >= info.sizeY || nz >= info.sizeZ) continue;
+                const uint brick = getBrickIndex(info, nx, ny, nz);
+                if(brick != own) activity[brick] = tick;
+            }
+        }
+    }
+}
+
+bool isAwake(global uint* activity, uint brick, uint tick) {
+    return tick - activity[brick] <= SLEEP_TICKS;
+}
 
-    Particle particle = particles[index];
+void finishUpdate(const SimulationStructures structs, global uint* activity, global uint* counters, uint index, const Particle start, const Particle particle, uint tick) {
+    if(start.type != 0 && particle.type == 0) atomic_inc(&counters[COUNTER_DEAD]);
+    if(particleChanged(start, particle)) {
+        wakeCell(activity, structs.info, (uint)start.position[0], (uint)start.position[1], (uint)start.position[2], tick);
+        if(checkBounds(structs, (int)particle.position[0], (int)particle.position[1], (int)particle.position[2]))
+            wakeCell(activity, structs.info, (uint)particle.position[0], (uint)particle.position[1], (uint)particle.position[2], tick);
+    } else if(!particleMoved(start, particle)) return;
 
+    storeParticle(structs.particles, structs.particleData, index, particle);
+}
+
+// Two phase variant of finishUpdate. Particles never change their cell in here, instead
+// they leave a move intent which is claimed in claimMoves. Positions only change in resolveMoves so
+// the grid stays valid for the whole tick and no two particles can end up in the same cell.
+void finishIntent(const SimulationStructures structs, global float4* intents, global uint* activity, global uint* counters, uint index, const Particle start, Particle particle, uint tick) {
+    if(start.type != 0 && particle.type == 0) atomic_inc(&counters[COUNTER_DEAD]);
+    // The target chunk is woken in resolveMoves, only once the move actually happens.
+    if(particleChanged(start, particle))
+        wakeCell(activity, structs.info, (uint)start.position[0], (uint)start.position[1], (uint)start.position[2], tick);
+
+    float4 intent = 0;
+    if(particle.type != 0 && ((uint)particle.position[0] != (uint)start.position[0] || (uint)particle.position[1] != (uint)start.position[1] || (uint)particle.position[2] != (uint)start.position[2])) {
+        // Only cells which were empty at the start of the tick can be claimed.
+        if(checkBounds(structs, (int)particle.position[0], (int)particle.position[1], (int)particle.position[2]) &&
+           isEmpty(structs, (uint)particle.position[0], (uint)particle.position[1], (uint)particle.position[2])) {
+            intent.x = particle.position[0];
+            intent.y = particle.position[1];
+            intent.z = particle.position[2];
+            intent.w = 1;
+            // The target might be in a brick which doesn't exist yet, have it allocated before the claims.
+            const uint brick = getBrickIndex(structs.info, (uint)intent.x, (uint)intent.y, (uint)intent.z);
+            if(structs.brickTable[brick] == 0) structs.brickTable[brick] = BRICK_MARKED;
+        }
+        particle.position[0] = start.position[0];
+        particle.position[1] = start.position[1];
+        particle.position[2] = start.position[2];
+    }
+    intents[index] = intent;
+
+    if(particleChanged(start, particle) || particleMoved(start, particle))
+        storeParticle(structs.particles, structs.particleData, index, particle);
+}
+
+// Every particle type with an update function gets its own simulate_<type> and simulateIntent_<type>
+// kernels which only walk the bucket of that type, so work groups don't diverge on the type switch.
+// The bucket size is only known on the device, the kernels loop over the bucket with whatever size they were launched with.
+#define UPDATE_KERNELS(TYPE, FUNCTION) \
+__kernel void simulate_##TYPE(global ParticleHot* particles, global ParticleCold* particleData, global uint* brickTable, global GridPoint* bricks, constant ParticleInfo* particleInfo, global uint* activity, global uint* workList, global uint* typeOffsets, global uint* counters, global uint* emitOffsets, const GridInfo info, uint particleCount, uint tick, uint emitMode, uint updatesPerSecond) { \
+    const uint end = typeOffsets[TYPE+1]; \
+    for(uint work = typeOffsets[TYPE]+get_global_id(0); work < end; work += get_global_size(0)) { \
+        SimulationStructures structs = createStructures(particles, particleData, brickTable, bricks, particleInfo, info, particleCount); \
+        uint emitted = 0; \
+        setupEmission(&structs, activity, emitOffsets, counters, &emitted, work, tick, emitMode); \
+        const uint index = workList[work]; \
+        const Particle start = loadParticle(particles, particleData, index); \
+        Particle particle = start; \
+        FUNCTION(structs, &particle); \
+        finishUpdate(structs, activity, counters, index, start, particle, tick); \
+    } \
+} \
+__kernel void simulateIntent_##TYPE(global ParticleHot* particles, global ParticleCold* particleData, global uint* brickTable, global GridPoint* bricks, constant ParticleInfo* particleInfo, global float4* intents, global uint* activity, global uint* workList, global uint* typeOffsets, global uint* counters, global uint* emitOffsets, const GridInfo info, uint particleCount, uint tick, uint emitMode, uint updatesPerSecond) { \
+    const uint end = typeOffsets[TYPE+1]; \
+    for(uint work = typeOffsets[TYPE]+get_global_id(0); work < end; work += get_global_size(0)) { \
+        SimulationStructures structs = createStructures(particles, particleData, brickTable, bricks, particleInfo, info, particleCount); \
+        uint emitted = 0; \
+        setupEmission(&structs, activity, emitOffsets, counters, &emitted, work, tick, emitMode); \
+        const uint index = workList[work]; \
+        const Particle start = loadParticle(particles, particleData, index); \
+        Particle particle = start; \
+        FUNCTION(structs, &particle); \
+        finishIntent(structs, intents, activity, counters, index, start, particle, tick); \
+    } \
+}
+
+#pragma PARTICLE_KERNELS
+
+__kernel void claimMoves(global uint* brickTable, global GridPoint* bricks, global float4* intents, global uint* workList, global uint* counters, const GridInfo info, uint particleCount) {
+    uint work = get_global_id(0);
+    if(work >= counters[COUNTER_ACTIVE]) return;
+    uint index = workList[work];
+
+    const float4 intent = intents[index];
+    if(intent.w == 0) return;
+
+    SimulationStructures structs = createStructures(0, 0, brickTable, bricks, 0, info, particleCount);
+    const uint cell = getCell(structs, (uint)intent.x, (uint)intent.y, (uint)intent.z);
+    if(cell == NO_CELL) return;
+    atomic_min(&bricks[cell].claim, index+1);
+}
+
+__kernel void resolveMoves(global ParticleHot* particles, global ParticleCold* particleData, global uint* brickTable, global GridPoint* bricks, global float4* intents, global uint* activity, global uint* workList, global uint* counters, const GridInfo info, uint particleCount, uint tick) {
+    uint work = get_global_id(0);
+    if(work >= counters[COUNTER_ACTIVE]) return;
+    uint index = workList[work];
+
+    const float4 intent = intents[index];
+    if(intent.w == 0) return;
+
+    SimulationStructures structs = createStructures(particles, particleData, brickTable, bricks, 0, info, particleCount);
+    const uint cell = getCell(structs, (uint)intent.x, (uint)intent.y, (uint)intent.z);
+    if(cell == NO_CELL || bricks[cell].claim != index+1) return;
+
+    Particle particle = loadParticle(particles, particleData, index);
+    particle.position[0] = intent.x;
+    particle.position[1] = intent.y;
+    particle.position[2] = intent.z;
+    storeParticle(particles, particleData, index, particle);
+    wakeCell(activity, info, (uint)intent.x, (uint)intent.y, (uint)intent.z, tick);
+}
+
+// Pre-simulation run which only counts the particles every work list entry is going to emit.
+// Entries past the work list count zero, the scan then turns the counts into offsets from COUNTER_EMIT_BASE.
+__kernel void countEmits(global ParticleHot* particles, global ParticleCold* particleData, global uint* brickTable, global GridPoint* bricks, constant ParticleInfo* particleInfo, global uint* workList, global uint* counters, global uint* emitOffsets, const GridInfo info, uint particleCount, uint tick) {
+    uint work = get_global_id(0);
+    if(work > particleCount) return;
+    if(work >= counters[COUNTER_ACTIVE]) {
+        emitOffsets[work] = 0;
+        return;
+    }
+
+    SimulationStructures structs = createStructures(particles, particleData, brickTable, bricks, particleInfo, info, particleCount);
+    uint emitted = 0;
+    setupEmission(&structs, 0, emitOffsets, counters, &emitted, work, tick, EMIT_COUNT);
+
+    Particle particle = loadParticle(particles, particleData, workList[work]);
     switch(particle.type) {
-        #pragma PARTICLE_SWITCH
+        #pragma PARTICLE_EMIT_SWITCH
         default: break;
     }
+    emitOffsets[work] = emitted;
+}
+
+// Moves the emission base past the particles placed in this tick.
+__kernel void commitEmits(global uint* emitOffsets, global uint* counters, uint particleCount) {
+    if(get_global_id(0) != 0) return;
 
-    particles[index] = particle;
+    const uint total = emitOffsets[particleCount];
+    const uint base = counters[COUNTER_EMIT_BASE];
+    const uint fit = base >= particleCount ? 0 : min(total, particleCount-base);
+    counters[COUNTER_EMIT_BASE] = base+fit;
+    counters[COUNTER_EMITTED] = fit;
+    counters[COUNTER_EMIT_OVERFLOW] = total-fit;
 }
 
-__kernel void resetGrid(global GridPoint* grid, uint sizeX, uint sizeY, uint sizeZ) {
+// Wakes the chunks of cells edited on the host.
+__kernel void wakeChunks(global uint* activity, global uint* cells, const GridInfo info, uint cellCount, uint tick) {
     uint index = get_global_id(0);
-    if(index >= sizeX*sizeY*sizeZ) return;
+    if(index >= cellCount) return;
 
-    grid[index].particleOffset = 0;
+    const uint cell = cells[index];
+    const uint x = cell % info.sizeX;
+    const uint y = (cell / info.sizeX) % info.sizeY;
+    const uint z = cell / (info.sizeX*info.sizeY);
+    wakeCell(activity, info, x, y, z, tick);
+}
+
+bool needsSimulation(const ParticleHot particle, global uint* activity, const GridInfo info, uint tick) {
+    if(particle.type == 0 || !hasUpdate(particle.type)) return false;
+    return isAwake(activity, getBrickIndex(info, particle.position[0], particle.position[1], particle.position[2]), tick);
+}
+
+// Counts the particles of every type living in awake chunks, only those are simulated.
+// The counts are scanned into the first work list entry of every type afterwards.
+// Nothing is counted if a brick of the grid didn't fit into the pool, the whole tick is skipped then
+// instead of simulating without the particles of that brick. The host grows the pool from the counters.
+__kernel void countTypes(global ParticleHot* particles, global uint* activity, global uint* typeCounts, global uint* counters, const GridInfo info, uint particleCount, uint tick) {
+    local uint histogram[TYPE_COUNT];
+    const uint index = get_global_id(0);
+    const uint lid = get_local_id(0);
+    if(counters[COUNTER_OVERFLOW] != 0) return;
+
+    for(uint i = lid; i < TYPE_COUNT; i += get_local_size(0)) histogram[i] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if(index < particleCount) {
+        const ParticleHot particle = particles[index];
+        if(needsSimulation(particle, activity, info, tick)) atomic_inc(&histogram[particle.type]);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    for(uint i = lid; i < TYPE_COUNT; i += get_local_size(0)) {
+        if(histogram[i] == 0) continue;
+        atomic_add(&typeCounts[i], histogram[i]);
+        atomic_add(&counters[COUNTER_ACTIVE], histogram[i]);
+    }
 }
 
-__kernel void buildGrid(global Particle* particles, global GridPoint* grid, uint sizeX, uint sizeY, uint sizeZ, uint particleCount) {
+__kernel void bucketParticles(global ParticleHot* particles, global uint* activity, global uint* workList, global uint* typeOffsets, global uint* typeCursors, const GridInfo info, uint particleCount, uint tick) {
+    uint index = get_global_id(0);
+    // Empty work list, the tick is skipped.
+    if(index >= particleCount || typeOffsets[TYPE_COUNT] == 0) return;
+
+    const ParticleHot particle = particles[index];
+    if(!needsSimulation(particle, activity, info, tick)) return;
+    workList[typeOffsets[particle.type] + atomic_inc(&typeCursors[particle.type])] = index;
+}
+
+__kernel void countChunks(global uint* brickTable, global uint* activity, global uint* counters, const GridInfo info, uint tick) {
+    uint index = get_global_id(0);
+    if(index >= info.bricksX*info.bricksY*info.bricksZ) return;
+    if(brickTable[index] == 0) return;
+
+    const bool awake = isAwake(activity, index, tick);
+    // A skipped tick doesn't count towards falling asleep.
+    if(awake && counters[COUNTER_OVERFLOW] != 0) activity[index]++;
+    atomic_inc(&counters[awake ? COUNTER_AWAKE : COUNTER_ASLEEP]);
+}
+
+__kernel void resetBricks(global uint* brickTable, global uint* counters, global uint* typeCounts, global uint* typeCursors, const GridInfo info) {
+    uint index = get_global_id(0);
+    if(index >= info.bricksX*info.bricksY*info.bricksZ) return;
+
+    brickTable[index] = 0;
+    if(index == 0) {
+        for(int i = 0; i <= COUNTER_ASLEEP; i++) counters[i] = 0;
+        counters[COUNTER_EMITTED] = 0;
+        counters[COUNTER_EMIT_OVERFLOW] = 0;
+        // One more entry than there are types, it holds the total after the scan.
+        for(int i = 0; i <= TYPE_COUNT; i++) {
+            typeCounts[i] = 0;
+            typeCursors[i] = 0;
+        }
+    }
+}
+
+__kernel void markBricks(global ParticleHot* particles, global uint* brickTable, const GridInfo info, uint particleCount) {
     uint index = get_global_id(0);
     if(index >= particleCount) return;
 
-    Particle particle = particles[index];
+    const ParticleHot particle = particles[index];
     if(particle.type == 0) return;
+    if(particle.position[0] >= info.sizeX || particle.position[1] >= info.sizeY || particle.position[2] >= info.sizeZ) return;
+
+    brickTable[getBrickIndex(info, particle.position[0], particle.position[1], particle.position[2])] = BRICK_MARKED;
+}
+
+// Gives every marked brick a slot in the brick pool and clears it. Runs once after markBricks
+// and once more after simulateIntent for the bricks that particles want to move into.
+// Every brick gets a work group of its own, the work items of the group clear its cells together.
+// A brick which doesn't fit into the pool stays marked and has no cells. Overflowing bricks of the grid
+// skip the tick, see countTypes, later overflows only leave emissions and move targets out for a tick.
+__kernel void allocateBricks(global uint* brickTable, global GridPoint* bricks, global uint* counters, const GridInfo info, uint brickCapacity) {
+    local uint slot;
+    const uint index = get_group_id(0);
+    const uint lid = get_local_id(0);
+    if(index >= info.bricksX*info.bricksY*info.bricksZ) return;
+    if(brickTable[index] != BRICK_MARKED) return;
+
+    // The table entry is only written after the barrier, so the whole group has seen it marked.
+    if(lid == 0) slot = atomic_inc(&counters[COUNTER_BRICKS]);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if(slot >= brickCapacity) {
+        if(lid == 0) atomic_inc(&counters[COUNTER_OVERFLOW]);
+        return;
+    }
+
+    const uint cellCount = 1 << (info.brickShift*2+info.brickShiftZ);
+    global GridPoint* brick = bricks+slot*cellCount;
+    for(uint i = lid; i < cellCount; i += get_local_size(0)) {
+        brick[i].particleOffset = 0;
+        brick[i].claim = UNCLAIMED;
+    }
+    if(lid == 0) brickTable[index] = slot+1;
+}
+
+__kernel void buildGrid(global ParticleHot* particles, global uint* brickTable, global GridPoint* bricks, const GridInfo info, uint particleCount) {
+    uint index = get_global_id(0);
+    if(index >= particleCount) return;
+
+    const ParticleHot particle = particles[index];
+    if(particle.type == 0) return;
+
+    SimulationStructures structs = createStructures(particles, 0, brickTable, bricks, 0, info, particleCount);
+    const uint cell = getCell(structs, particle.position[0], particle.position[1], particle.position[2]);
+    if(cell == NO_CELL) return;
+    bricks[cell].particleOffset = index+1;
+}
+
+// Compaction of dead particle slots. markLive and the scan produce the new slot of every live
+// particle, scatterLive packs them into a temporary buffer which finishCompaction copies back.
+__kernel void markLive(global ParticleHot* particles, global uint* offsets, uint particleCount) {
+    uint index = get_global_id(0);
+    if(index >= particleCount) return;
 
-    uint vertexGridOffset = (uint)(particle.position[0])+(uint)(particle.position[1])*sizeX+(uint)(particle.position[2])*sizeX*sizeY;
-    grid[vertexGridOffset].particleOffset = index+1;
+    offsets[index] = particles[index].type != 0 ? 1 : 0;
+}
+
+// Exclusive scan of SCAN_BLOCK values per work group, the total of every block is written to sums.
+__kernel void scanBlocks(global uint* values, global uint* sums, uint count) {
+    local uint scratch[SCAN_BLOCK];
+    const uint index = get_global_id(0);
+    const uint lid = get_local_id(0);
+
+    const uint value = index < count ? values[index] : 0;
+    scratch[lid] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for(uint offset = 1; offset < SCAN_BLOCK; offset <<= 1) {
+        const uint add = lid >= offset ? scratch[lid-offset] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        scratch[lid] += add;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if(index < count) values[index] = scratch[lid] - value;
+    if(lid == SCAN_BLOCK-1) sums[get_group_id(0)] = scratch[lid];
+}
+
+__kernel void addBlockOffsets(global uint* values, global uint* sums, uint count) {
+    uint index = get_global_id(0);
+    if(index >= count) return;
+
+    values[index] += sums[index / SCAN_BLOCK];
+}
+
+__kernel void scatterLive(global ParticleHot* particles, global ParticleCold* particleData, global ParticleHot* compacted, global ParticleCold* compactedData, global uint* offsets, global uint* liveCount, uint particleCount) {
+    uint index = get_global_id(0);
+    if(index >= particleCount) return;
+
+    const ParticleHot particle = particles[index];
+    const uint offset = offsets[index];
+    if(particle.type != 0) {
+        compacted[offset] = particle;
+        compactedData[offset] = particleData[index];
+    }
+    if(index == particleCount-1) *liveCount = offset + (particle.type != 0 ? 1 : 0);
+}
+
+__kernel void finishCompaction(global ParticleHot* particles, global ParticleCold* particleData, global ParticleHot* compacted, global ParticleCold* compactedData, global uint* liveCount, global uint* counters, uint capacity) {
+    uint index = get_global_id(0);
+    if(index >= capacity) return;
+
+    if(index == 0) {
+        counters[COUNTER_DEAD] = 0;
+        counters[COUNTER_EMIT_BASE] = *liveCount;
+    }
+    if(index < *liveCount) {
+        particles[index] = compacted[index];
+        particleData[index] = compactedData[index];
+    } else {
+        // Free slots are expected to be zeroed.
+        global uint* words = (global uint*)(particles+index);
+        for(uint i = 0; i < sizeof(ParticleHot)/sizeof(uint); i++) words[i] = 0;
+        words = (global uint*)(particleData+index);
+        for(uint i = 0; i < sizeof(ParticleCold)/sizeof(uint); i++) words[i] = 0;
+    }
+}
+
+// Periodic sort of the particles by the Z-order key of their cell, so particles of neighbouring
+// cells also sit next to each other in memory. Dead particles get a key past every cell and end up
+// at the back, gatherSorted followed by finishCompaction then works just like the compaction.
+uint spreadBits2(uint value) {
+    value &= 0x0000FFFF;
+    value = (value | (value << 8)) & 0x00FF00FF;
+    value = (value | (value << 4)) & 0x0F0F0F0F;
+    value = (value | (value << 2)) & 0x33333333;
+    value = (value | (value << 1)) & 0x55555555;
+    return value;
+}
+
+uint spreadBits3(uint value) {
+    value &= 0x000003FF;
+    value = (value | (value << 16)) & 0xFF0000FF;
+    value = (value | (value << 8)) & 0x0300F00F;
+    value = (value | (value << 4)) & 0x030C30C3;
+    value = (value | (value << 2)) & 0x09249249;
+    return value;
+}
+
+// keyShift drops the low bits of every coordinate in worlds wider than the key, live keys then never reach 1 << keyBits.
+__kernel void mortonKeys(global ParticleHot* particles, global uint* keys, global uint* values, const GridInfo info, uint particleCount, uint keyBits, uint keyShift) {
+    uint index = get_global_id(0);
+    if(index >= particleCount) return;
+
+    const ParticleHot particle = particles[index];
+    const uint x = particle.position[0] >> keyShift;
+    const uint y = particle.position[1] >> keyShift;
+    const uint z = particle.position[2] >> keyShift;
+    uint key;
+    if(particle.type == 0) key = 1 << keyBits;
+    else if(info.sizeZ > 1) key = spreadBits3(x) | (spreadBits3(y) << 1) | (spreadBits3(z) << 2);
+    else key = spreadBits2(x) | (spreadBits2(y) << 1);
+
+    keys[index] = key & ((2 << keyBits)-1);
+    values[index] = index;
+}
+
+// Digit histogram of every work group, stored digit major so a scan yields the scatter offsets.
+__kernel void radixCount(global uint* keys, global uint* offsets, uint count, uint shift) {
+    local uint histogram[RADIX_BINS];
+    const uint index = get_global_id(0);
+    const uint lid = get_local_id(0);
+
+    if(lid < RADIX_BINS) histogram[lid] = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if(index < count) atomic_inc(&histogram[(keys[index] >> shift) & (RADIX_BINS-1)]);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if(lid < RADIX_BINS) offsets[lid*get_num_groups(0) + get_group_id(0)] = histogram[lid];
+}
+
+__kernel void radixScatter(global uint* keysIn, global uint* valuesIn, global uint* keysOut, global uint* valuesOut, global uint* offsets, uint count, uint shift) {
+    local uint digits[SCAN_BLOCK];
+    const uint index = get_global_id(0);
+    const uint lid = get_local_id(0);
+
+    const uint key = index < count ? keysIn[index] : 0;
+    const uint digit = (key >> shift) & (RADIX_BINS-1);
+    digits[lid] = index < count ? digit : RADIX_BINS;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if(index >= count) return;
+
+    // Rank among the same digits of this group keeps the sort stable.
+    uint rank = 0;
+    for(uint i = 0; i < lid; i++) if(digits[i] == digit) rank++;
+
+    const uint target = offsets[digit*get_num_groups(0) + get_group_id(0)] + rank;
+    keysOut[target] = key;
+    valuesOut[target] = valuesIn[index];
+}
+
+__kernel void gatherSorted(global ParticleHot* particles, global ParticleCold* particleData, global ParticleHot* sorted, global ParticleCold* sortedData, global uint* keys, global uint* values, global uint* liveCount, uint particleCount, uint keyBits) {
+    uint index = get_global_id(0);
+    if(index >= particleCount) return;
+
+    const uint key = keys[index];
+    if(key == (1 << keyBits)) {
+        if(index == 0) *liveCount = 0;
+        return;
+    }
+    sorted[index] = particles[values[index]];
+    sortedData[index] = particleData[values[index]];
+    if(index == particleCount-1 || keys[index+1] == (1 << keyBits)) *liveCount = index+1;
 }
 
 // Utility functions
-uint calculatePosition(const SimulationStructures simStruct, uint x, uint y, uint z) {
-    return x + y*simStruct.sizeX + z*simStruct.sizeX*simStruct.sizeY;
+Particle loadParticle(global ParticleHot* particles, global ParticleCold* particleData, uint index) {
+    const ParticleHot hot = particles[index];
+    const ParticleCold cold = particleData[index];
+
+    Particle particle;
+    particle.type = hot.type;
+    particle.stype = hot.stype;
+    particle.state = hot.state;
+    for(int i = 0; i < 3; i++) {
+        particle.position[i] = hot.position[i] + cold.subPosition[i]/65536.0f;
+        particle.velocity[i] = cold.velocity[i];
+    }
+    for(int i = 0; i < 4; i++) {
+        particle.paintColor[i] = cold.paintColor[i]/255.0f;
+        particle.data[i] = cold.data[i];
+    }
+    particle.temperature = vload_half(0, (const half*)&cold.temperature);
+    return particle;
+}
+
+void storeParticle(global ParticleHot* particles, global ParticleCold* particleData, uint index, const Particle particle) {
+    ParticleHot hot;
+    ParticleCold cold;
+    hot.type = particle.type;
+    hot.stype = particle.stype;
+    hot.padding = 0;
+    hot.state = particle.state;
+    for(int i = 0; i < 3; i++) {
+        // Positions below 0 pack into cell 0, a plain cast would be undefined for them.
+        const uint cell = convert_uint_sat(particle.position[i]);
+        hot.position[i] = cell;
+        cold.subPosition[i] = (ushort)clamp((particle.position[i]-cell)*65536.0f, 0.0f, 65535.0f);
+        cold.velocity[i] = particle.velocity[i];
+    }
+    for(int i = 0; i < 4; i++) {
+        cold.paintColor[i] = (uchar)(clamp(particle.paintColor[i], 0.0f, 1.0f)*255.0f+0.5f);
+        cold.data[i] = particle.data[i];
+    }
+    vstore_half(particle.temperature, 0, (half*)&cold.temperature);
+
+    particles[index] = hot;
+    particleData[index] = cold;
+}
+
+uint getBrickIndex(const GridInfo info, uint x, uint y, uint z) {
+    return (x >> info.brickShift) + (y >> info.brickShift)*info.bricksX + (z >> info.brickShiftZ)*info.bricksX*info.bricksY;
+}
+
+uint getCell(const SimulationStructures simStruct, uint x, uint y, uint z) {
+    if(x >= simStruct.sizeX || y >= simStruct.sizeY || z >= simStruct.sizeZ) return NO_CELL;
+    const uint brick = simStruct.brickTable[getBrickIndex(simStruct.info, x, y, z)];
+    if(brick == 0 || (brick & BRICK_MARKED) != 0) return NO_CELL;
+
+    const uint mask = (1 << simStruct.info.brickShift)-1;
+    const uint maskZ = (1 << simStruct.info.brickShiftZ)-1;
+    const uint cellCount = 1 << (simStruct.info.brickShift*2+simStruct.info.brickShiftZ);
+    return (brick-1)*cellCount + (x&mask) + ((y&mask) << simStruct.info.brickShift) + ((z&maskZ) << (simStruct.info.brickShift*2));
 }
 
 bool checkBounds(const SimulationStructures simStruct, int x, int y, int z) {
@@ -101,7 +711,9 @@ bool checkBounds(const SimulationStructures simStruct, int x, int y, int z) {
 }
 
 uint getOffset(const SimulationStructures simStruct, uint x, uint y, uint z) {
-    return simStruct.grid[calculatePosition(simStruct, x, y, z)].particleOffset;
+    const uint cell = getCell(simStruct, x, y, z);
+    if(cell == NO_CELL) return 0;
+    return simStruct.bricks[cell].particleOffset;
 }
 
 bool isEmpty(const SimulationStructures simStruct, uint x, uint y, uint z) {
@@ -115,9 +727,41 @@ Particle getParticle(const SimulationStructures simStruct, uint x, uint y, uint
         part.type = 0;
         return part;
     }
-    return simStruct.particles[offset-1];
+    return loadParticle(simStruct.particles, simStruct.particleData, offset-1);
 }
 
 ParticleInfo getParticleInfo(const SimulationStructures simStruct, Particle particle) {
     return simStruct.particleInfo[(particle.type)-1];
 }
+
+void emitParticle(const SimulationStructures simStruct, Particle particle) {
+    if(particle.type == 0 || !checkBounds(simStruct, (int)particle.position[0], (int)particle.position[1], (int)particle.position[2])) return;
+    const uint x = (uint)particle.position[0];
+    const uint y = (uint)particle.position[1];
+    const uint z = (uint)particle.position[2];
+    if(simStruct.emitMode == EMIT_COUNT) {
+        // The target might be in a brick which doesn't exist yet, have it allocated before the simulation run.
+        const uint brick = getBrickIndex(simStruct.info, x, y, z);
+        if(simStruct.brickTable[brick] == 0) simStruct.brickTable[brick] = BRICK_MARKED;
+        (*simStruct.emitted)++;
+        return;
+    }
+    if(simStruct.emitMode != EMIT_PLACE) return;
+
+    // Never place more than the counting run has reserved.
+    const uint offset = simStruct.emitOffsets[simStruct.work] + *simStruct.emitted;
+    if(offset >= simStruct.emitOffsets[simStruct.work+1]) return;
+    (*simStruct.emitted)++;
+
+    // The slots past the end of the buffer are reported as an overflow by commitEmits.
+    const uint slot = simStruct.emitBase + offset;
+    if(slot >= simStruct.particleCount) return;
+    // Same claims as the moves, the cell has to be empty since the start of the tick and the first emission
+    // into it wins. Dropped particles leave their slot empty for the compaction.
+    const uint cell = getCell(simStruct, x, y, z);
+    if(cell == NO_CELL || simStruct.bricks[cell].particleOffset != 0) return;
+    if(atomic_cmpxchg(&simStruct.bricks[cell].claim, UNCLAIMED, EMIT_CLAIM) != UNCLAIMED) return;
+    storeParticle(simStruct.particles, simStruct.particleData, slot, particle);
+    wakeCell(simStruct.activity, simStruct.info, x, y, z, simStruct.tick);
+    atomic_inc(&simStruct.counters[COUNTER_EMIT_PLACED]);
+}
\ No newline at end of file
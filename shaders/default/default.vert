@@ -1,7 +1,9 @@
 #version 450
 
-layout (location = 0) in vec4 position;
-layout (location = 1) in vec4 vertexColor;
+// One instance per particle or merged rectangle of cells, the quad is expanded from the vertex index.
+layout (location = 0) in uvec2 cellPosition;
+layout (location = 1) in vec4 cellColor;
+layout (location = 2) in uvec2 cellSize;
 
 layout (set = 0, binding = 0) uniform GlobalMatricies {
     mat4 viewMatrix;
@@ -14,8 +16,25 @@ layout (set = 0, binding = 0) uniform GlobalMatricies {
 
 layout (location = 0) out vec4 pass_color;
 
+const vec2 corners[6] = vec2[](
+    vec2(-0.5, -0.5),
+    vec2(-0.5,  0.5),
+    vec2( 0.5, -0.5),
+    vec2( 0.5, -0.5),
+    vec2(-0.5,  0.5),
+    vec2( 0.5,  0.5)
+);
+
 void main() {
+    // Empty slots are moved outside of the clip volume.
+    if(cellPosition.x == 0xFFFF) {
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        pass_color = vec4(0.0);
+        return;
+    }
+    // Cells are centered on their coordinates, a rectangle reaches from its first to its last cell.
+    vec4 position = vec4(vec2(cellPosition) - 0.5 + (corners[gl_VertexIndex] + 0.5)*vec2(cellSize), 0.0, 1.0);
     gl_Position = globalMatricies.projectMatrix * globalMatricies.viewMatrix * position;
 
-    pass_color = vertexColor;
-}
\ No newline at end of file
+    pass_color = cellColor;
+}
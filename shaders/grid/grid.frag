@@ -0,0 +1,28 @@
+#version 450
+
+layout (location = 0) in vec2 pass_cell;
+
+// RGBA8 color of every cell, written by generateImage of meshGenerator.cl, or of a coarser level of the pyramid.
+layout (set = 1, binding = 0) readonly buffer GridImage {
+    uint cells[];
+} gridImage;
+
+layout (push_constant) uniform GridSize {
+    uvec2 size;
+    uint shift;
+    uint offset;
+} gridSize;
+
+layout (location = 0) out vec4 fragColor;
+
+void main() {
+    // Coarser levels of the pyramid hold a cell for every 2^shift x 2^shift cells of the grid.
+    uvec2 levelSize = (gridSize.size + (1 << gridSize.shift) - 1) >> gridSize.shift;
+    uvec2 cell = min(uvec2(pass_cell) >> gridSize.shift, levelSize - 1);
+    vec4 color = unpackUnorm4x8(gridImage.cells[gridSize.offset + cell.x + cell.y*levelSize.x]);
+    // Empty cells are left to the background just like in the mesh mode.
+    if(color.a == 0.0) discard;
+    // Alpha of a coarser cell is how much of it is covered, whole cells are opaque like the particle quads.
+    if(gridSize.shift == 0) color.a = 1.0;
+    fragColor = color;
+}
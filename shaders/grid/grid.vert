@@ -0,0 +1,31 @@
+#version 450
+
+layout (set = 0, binding = 0) uniform GlobalMatricies {
+    mat4 viewMatrix;
+    mat4 projectMatrix;
+} globalMatricies;
+
+layout (push_constant) uniform GridSize {
+    uvec2 size;
+    uint shift;
+    uint offset;
+} gridSize;
+
+layout (location = 0) out vec2 pass_cell;
+
+const vec2 corners[6] = vec2[](
+    vec2(0.0, 0.0),
+    vec2(0.0, 1.0),
+    vec2(1.0, 0.0),
+    vec2(1.0, 0.0),
+    vec2(0.0, 1.0),
+    vec2(1.0, 1.0)
+);
+
+void main() {
+    // One quad over the whole grid, cells are centered on their coordinates like the particle quads.
+    vec2 cell = corners[gl_VertexIndex]*vec2(gridSize.size);
+    gl_Position = globalMatricies.projectMatrix * globalMatricies.viewMatrix * vec4(cell - 0.5, 0.0, 1.0);
+
+    pass_cell = cell;
+}
@@ -0,0 +1,193 @@
+// OpenCL C compatibility header of the native backend. The assembled simulator and mesh generator
+// sources are compiled as C++ with this included first, see NativeEngine::compile. Only the subset
+// of OpenCL C used by the kernels and the particle packs is covered.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+typedef unsigned char uchar;
+typedef unsigned short ushort;
+typedef unsigned int uint;
+typedef unsigned long ulong;
+// Storage only, see vload_half and vstore_half.
+typedef unsigned short half;
+
+// Address spaces don't exist on the host.
+#define __kernel extern "C"
+#define __global
+#define global
+#define __local
+#define local
+#define __constant const
+#define constant const
+
+// Work items are run one after another, every work group is a single work item and barriers have
+// nothing to wait for. Kernels which need real work groups are replaced on the host.
+#define CLK_LOCAL_MEM_FENCE 1
+#define CLK_GLOBAL_MEM_FENCE 2
+inline void barrier(int) { }
+
+static thread_local size_t nativeGlobalId;
+static thread_local size_t nativeGlobalSize;
+
+extern "C" void nativeSetWorkItem(size_t id, size_t size) {
+    nativeGlobalId = id;
+    nativeGlobalSize = size;
+}
+
+inline size_t get_global_id(uint) { return nativeGlobalId; }
+inline size_t get_global_size(uint) { return nativeGlobalSize; }
+inline size_t get_local_id(uint) { return 0; }
+inline size_t get_local_size(uint) { return 1; }
+inline size_t get_group_id(uint) { return nativeGlobalId; }
+inline size_t get_num_groups(uint) { return nativeGlobalSize; }
+
+// OpenCL C leaves casts of out of range floats to an unsigned type undefined, kernels which depend on the
+// result use the convert_*_sat functions. The native build still clamps plain casts like most GPUs do
+// instead of wrapping negative values around like x86, so the backends agree on kernels which don't.
+// NativeEngine::compile turns (uint)x into NativeCast<uint>() ->* x, ->* binds tighter than every binary
+// operator, so it takes the same operand as the cast did.
+template<typename T> struct NativeCast { };
+template<typename T, typename V> inline T operator->*(NativeCast<T>, V value) {
+    if constexpr(std::is_floating_point_v<V>) {
+        if(!(value > 0)) return 0;
+        if(value >= (V)std::numeric_limits<T>::max()) return std::numeric_limits<T>::max();
+    }
+    return (T)value;
+}
+inline uint convert_uint_sat(float value) { return NativeCast<uint>() ->* value; }
+
+// Atomics
+template<typename T> inline T atomic_add(T* p, T value) { return __atomic_fetch_add(p, value, __ATOMIC_RELAXED); }
+template<typename T> inline T atomic_sub(T* p, T value) { return __atomic_fetch_sub(p, value, __ATOMIC_RELAXED); }
+template<typename T> inline T atomic_inc(T* p) { return __atomic_fetch_add(p, 1, __ATOMIC_RELAXED); }
+template<typename T> inline T atomic_dec(T* p) { return __atomic_fetch_sub(p, 1, __ATOMIC_RELAXED); }
+template<typename T> inline T atomic_xchg(T* p, T value) { return __atomic_exchange_n(p, value, __ATOMIC_RELAXED); }
+template<typename T> inline T atomic_and(T* p, T value) { return __atomic_fetch_and(p, value, __ATOMIC_RELAXED); }
+template<typename T> inline T atomic_or(T* p, T value) { return __atomic_fetch_or(p, value, __ATOMIC_RELAXED); }
+template<typename T> inline T atomic_xor(T* p, T value) { return __atomic_fetch_xor(p, value, __ATOMIC_RELAXED); }
+template<typename T> inline T atomic_cmpxchg(T* p, T compare, T value) {
+    __atomic_compare_exchange_n(p, &compare, value, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    return compare;
+}
+template<typename T> inline T atomic_min(T* p, T value) {
+    T current = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while(value < current && !__atomic_compare_exchange_n(p, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return current;
+}
+template<typename T> inline T atomic_max(T* p, T value) {
+    T current = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while(value > current && !__atomic_compare_exchange_n(p, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    return current;
+}
+#define atom_add atomic_add
+#define atom_inc atomic_inc
+#define atom_min atomic_min
+#define atom_max atomic_max
+
+// Vectors, vector literals like (float4)(a, b) are rewritten into constructor calls before compiling.
+struct float3 {
+    float x, y, z;
+
+    float3() = default;
+    float3(float v) : x(v), y(v), z(v) { }
+    float3(float x, float y, float z) : x(x), y(y), z(z) { }
+};
+
+// Same size and alignment as in OpenCL, structures holding it are shared with the host.
+struct alignas(16) float4 {
+    union {
+        struct { float x, y, z, w; };
+        float3 xyz;
+    };
+
+    float4() = default;
+    float4(float v) : x(v), y(v), z(v), w(v) { }
+    float4(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) { }
+    float4(float3 v, float w) : x(v.x), y(v.y), z(v.z), w(w) { }
+};
+
+inline float3 operator+(float3 a, float3 b) { return float3(a.x+b.x, a.y+b.y, a.z+b.z); }
+inline float3 operator-(float3 a, float3 b) { return float3(a.x-b.x, a.y-b.y, a.z-b.z); }
+inline float3 operator*(float3 a, float3 b) { return float3(a.x*b.x, a.y*b.y, a.z*b.z); }
+inline float3 operator/(float3 a, float3 b) { return float3(a.x/b.x, a.y/b.y, a.z/b.z); }
+inline float3 operator-(float3 a) { return float3(-a.x, -a.y, -a.z); }
+inline float4 operator+(float4 a, float4 b) { return float4(a.x+b.x, a.y+b.y, a.z+b.z, a.w+b.w); }
+inline float4 operator-(float4 a, float4 b) { return float4(a.x-b.x, a.y-b.y, a.z-b.z, a.w-b.w); }
+inline float4 operator*(float4 a, float4 b) { return float4(a.x*b.x, a.y*b.y, a.z*b.z, a.w*b.w); }
+inline float4 operator/(float4 a, float4 b) { return float4(a.x/b.x, a.y/b.y, a.z/b.z, a.w/b.w); }
+inline float4 operator-(float4 a) { return float4(-a.x, -a.y, -a.z, -a.w); }
+
+// Common and integer functions
+template<typename A, typename B> inline auto min(A a, B b) -> decltype(a+b) { return b < a ? b : a; }
+template<typename A, typename B> inline auto max(A a, B b) -> decltype(a+b) { return a < b ? b : a; }
+template<typename T, typename A, typename B> inline T clamp(T value, A low, B high) { return value < low ? low : (value > high ? high : value); }
+inline uint abs(uint value) { return value; }
+inline ushort abs(ushort value) { return value; }
+inline uchar abs(uchar value) { return value; }
+inline float mix(float a, float b, float t) { return a + (b-a)*t; }
+inline float3 mix(float3 a, float3 b, float t) { return a + (b-a)*float3(t); }
+inline float4 mix(float4 a, float4 b, float t) { return a + (b-a)*float4(t); }
+inline float sign(float v) { return v > 0 ? 1.0f : (v < 0 ? -1.0f : 0.0f); }
+
+// Half conversions round to the nearest even value like vstore_half does by default.
+inline float vload_half(size_t offset, const half* p) {
+    const uint value = p[offset];
+    const uint sign = (value & 0x8000) << 16;
+    int exponent = (value >> 10) & 0x1F;
+    uint mantissa = value & 0x3FF;
+
+    uint bits;
+    if(exponent == 0x1F) bits = sign | 0x7F800000 | (mantissa << 13);
+    else if(exponent != 0) bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    else if(mantissa == 0) bits = sign;
+    else {
+        exponent = 1;
+        while((mantissa & 0x400) == 0) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | ((exponent - 15 + 127) << 23) | ((mantissa & 0x3FF) << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+inline void vstore_half(float value, size_t offset, half* p) {
+    uint bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint sign = (bits >> 16) & 0x8000;
+    const uint exponentBits = (bits >> 23) & 0xFF;
+    const int exponent = (int)exponentBits - 127 + 15;
+    const uint mantissa = bits & 0x7FFFFF;
+
+    uint result;
+    if(exponentBits == 0xFF) result = sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0);
+    else if(exponent >= 31) result = sign | 0x7C00;
+    else if(exponent <= 0) {
+        if(exponent < -10) result = sign;
+        else {
+            const uint full = mantissa | 0x800000;
+            const uint shift = 14 - exponent;
+            uint rounded = full >> shift;
+            const uint rest = full & ((1u << shift)-1);
+            const uint halfway = 1u << (shift-1);
+            if(rest > halfway || (rest == halfway && (rounded & 1) != 0)) rounded++;
+            result = sign | rounded;
+        }
+    } else {
+        // A carry out of the mantissa correctly bumps the exponent, up to infinity.
+        result = (exponent << 10) | (mantissa >> 13);
+        const uint rest = mantissa & 0x1FFF;
+        if(rest > 0x1000 || (rest == 0x1000 && (result & 1) != 0)) result++;
+        result |= sign;
+    }
+    p[offset] = (half)result;
+}
@@ -2,19 +2,39 @@
 
 #include <spdlog/spdlog.h>
 
+#include <cstring>
+
+#include <dlfcn.h>
+
+// From cl_ext.h of newer headers.
+#ifndef CL_EXTERNAL_MEMORY_HANDLE_OPAQUE_FD_KHR
+#define CL_EXTERNAL_MEMORY_HANDLE_OPAQUE_FD_KHR 0x2060
+#endif
+#ifndef CL_DEVICE_HANDLE_LIST_KHR
+#define CL_DEVICE_HANDLE_LIST_KHR 0x2051
+#define CL_DEVICE_HANDLE_LIST_END_KHR 0
+#endif
+#ifndef CL_DEVICE_UUID_KHR
+#define CL_DEVICE_UUID_KHR 0x106A
+#endif
+
 using namespace unibox;
 
 ClEngine* ClEngine::instance = 0;
 
-ClEngine::ClEngine() {
+ClEngine::ClEngine(cl_device_type deviceType, cl_command_queue_properties queueProperties) {
     std::vector<cl::Platform> platforms;
     cl::Platform::get(&platforms);
 
     valid = false;
+    createBufferWithProperties = 0;
+    acquireExternalMemObjects = 0;
+    releaseExternalMemObjects = 0;
+    hasDeviceUUID = false;
 
     for(auto& platform : platforms) {
         std::vector<cl::Device> devices;
-        platform.getDevices(CL_DEVICE_TYPE_GPU, &devices);
+        platform.getDevices(deviceType, &devices);
         for(auto& device : devices) {
             // Select the first available device.
             this->device = device;
@@ -31,10 +51,88 @@ ClEngine::ClEngine() {
 
     context = cl::Context(device);
 
+    cl_int error;
+    computeQueue = cl::CommandQueue(context, device, queueProperties, &error);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL compute command queue creation failure: " + std::to_string(error));
+        valid = false;
+        return;
+    }
+    transferQueue = cl::CommandQueue(context, device, queueProperties, &error);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL transfer command queue creation failure: " + std::to_string(error));
+        valid = false;
+        return;
+    }
+
+    initExternalMemory();
+
     instance = this;
 }
 
+void ClEngine::initExternalMemory() {
+    const std::string extensions = device.getInfo<CL_DEVICE_EXTENSIONS>();
+    if(extensions.find("cl_khr_device_uuid") != std::string::npos) {
+        hasDeviceUUID = clGetDeviceInfo(device(), CL_DEVICE_UUID_KHR, sizeof(deviceUUID), deviceUUID, 0) == CL_SUCCESS;
+    }
+    if(extensions.find("cl_khr_external_memory_opaque_fd") == std::string::npos) return;
+
+    // clCreateBufferWithProperties is core in 3.0 and exported by the ICD loader, the rest are extension functions.
+    auto create = reinterpret_cast<CreateBufferWithPropertiesFn>(dlsym(RTLD_DEFAULT, "clCreateBufferWithProperties"));
+    cl_platform_id platform = device.getInfo<CL_DEVICE_PLATFORM>();
+    auto acquire = reinterpret_cast<ExternalMemObjectsFn>(clGetExtensionFunctionAddressForPlatform(platform, "clEnqueueAcquireExternalMemObjectsKHR"));
+    auto release = reinterpret_cast<ExternalMemObjectsFn>(clGetExtensionFunctionAddressForPlatform(platform, "clEnqueueReleaseExternalMemObjectsKHR"));
+    if(create == 0 || acquire == 0 || release == 0) return;
+
+    createBufferWithProperties = create;
+    acquireExternalMemObjects = acquire;
+    releaseExternalMemObjects = release;
+}
+
+bool ClEngine::supportsExternalMemory(const uint8_t* deviceUUID) {
+    if(createBufferWithProperties == 0 || !hasDeviceUUID) return false;
+    return memcmp(this->deviceUUID, deviceUUID, sizeof(this->deviceUUID)) == 0;
+}
+
+cl::Buffer* ClEngine::importBuffer(int fd, size_t size) {
+    if(createBufferWithProperties == 0) return 0;
+    const cl_ulong properties[] = {
+        CL_EXTERNAL_MEMORY_HANDLE_OPAQUE_FD_KHR, (cl_ulong)fd,
+        CL_DEVICE_HANDLE_LIST_KHR, (cl_ulong)device(), CL_DEVICE_HANDLE_LIST_END_KHR,
+        0
+    };
+    cl_int error;
+    cl_mem memory = createBufferWithProperties(context(), properties, CL_MEM_READ_WRITE, size, 0, &error);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL external memory import error: " + std::to_string(error));
+        return 0;
+    }
+    // The wrapper takes over the reference returned by the create call.
+    return new cl::Buffer(memory);
+}
+
+cl_int ClEngine::enqueueExternal(ExternalMemObjectsFn function, cl::Buffer& buffer, const std::vector<cl::Event>& wait, cl::Event& event) {
+    std::vector<cl_event> waitEvents;
+    for(auto& waitEvent : wait) if(waitEvent() != 0) waitEvents.push_back(waitEvent());
+    const cl_mem memory = buffer();
+    cl_event result;
+    cl_int error = function(computeQueue(), 1, &memory, waitEvents.size(), waitEvents.empty() ? 0 : waitEvents.data(), &result);
+    if(error == CL_SUCCESS) event = cl::Event(result);
+    return error;
+}
+
+cl_int ClEngine::acquireExternal(cl::Buffer& buffer, const std::vector<cl::Event>& wait, cl::Event& event) {
+    return enqueueExternal(acquireExternalMemObjects, buffer, wait, event);
+}
+
+cl_int ClEngine::releaseExternal(cl::Buffer& buffer, const std::vector<cl::Event>& wait, cl::Event& event) {
+    return enqueueExternal(releaseExternalMemObjects, buffer, wait, event);
+}
+
 ClEngine::~ClEngine() {
+    if(!valid) return;
+    computeQueue.finish();
+    transferQueue.finish();
 
 }
 
@@ -46,6 +144,14 @@ cl::Device& ClEngine::getDevice() {
     return device;
 }
 
+cl::CommandQueue& ClEngine::getComputeQueue() {
+    return computeQueue;
+}
+
+cl::CommandQueue& ClEngine::getTransferQueue() {
+    return transferQueue;
+}
+
 ClEngine* ClEngine::getInstance() {
     return instance;
 }
@@ -0,0 +1,1068 @@
+#include <compute/cl_pipeline.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+using namespace unibox;
+
+// Indices into the brick counters, see simulator.cl.
+#define COUNTER_BRICKS 0
+#define COUNTER_OVERFLOW 1
+#define COUNTER_AWAKE 3
+#define COUNTER_ASLEEP 4
+#define COUNTER_DEAD 5
+#define COUNTER_EMIT_BASE 6
+#define COUNTER_EMITTED 7
+#define COUNTER_EMIT_OVERFLOW 8
+#define COUNTER_EMIT_PLACED 9
+
+#define EMIT_NONE 0
+#define EMIT_PLACE 2
+
+#define SCAN_BLOCK 256
+// Work items per brick in allocateBricks.
+#define ALLOCATE_GROUP 64
+#define RADIX_BITS 4
+#define RADIX_BINS (1 << RADIX_BITS)
+
+ClGridPipeline::ClGridPipeline(Simulator& simulator, MeshGenPipeline& meshGenerator, const GridInfo& info) {
+    this->info = info;
+    imageLevels = MeshGenPipeline::getImageLevels(info.sizeX, info.sizeY);
+
+    cl::Context& context = ClEngine::getInstance()->getContext();
+    brickTable = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(uint)*info.getBrickCount());
+    // The emission sum is never reset, it has to start out zeroed.
+    for(uint& counter : counters) counter = 0;
+    brickCounters = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(counters), counters);
+    brickCapacity = 0;
+
+    // Every chunk starts awake, tick 1 is within SLEEP_TICKS of the zeroed activity.
+    std::vector<uint> activity(info.getBrickCount(), 0);
+    activityBuffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS | CL_MEM_COPY_HOST_PTR, sizeof(uint)*activity.size(), activity.data());
+    tick = 1;
+    profiling = false;
+
+    resetKernel = cl::Kernel(simulator.getProgram(), "resetBricks");
+    markKernel = cl::Kernel(simulator.getProgram(), "markBricks");
+    allocateKernel = cl::Kernel(simulator.getProgram(), "allocateBricks");
+    buildKernel = cl::Kernel(simulator.getProgram(), "buildGrid");
+    types = simulator.getUpdatedTypes();
+    for(ushort type : types) {
+        simKernels.push_back(cl::Kernel(simulator.getProgram(), ("simulate_" + std::to_string(type)).c_str()));
+        intentKernels.push_back(cl::Kernel(simulator.getProgram(), ("simulateIntent_" + std::to_string(type)).c_str()));
+    }
+    claimKernel = cl::Kernel(simulator.getProgram(), "claimMoves");
+    resolveKernel = cl::Kernel(simulator.getProgram(), "resolveMoves");
+    wakeKernel = cl::Kernel(simulator.getProgram(), "wakeChunks");
+    typeCountKernel = cl::Kernel(simulator.getProgram(), "countTypes");
+    bucketKernel = cl::Kernel(simulator.getProgram(), "bucketParticles");
+    countKernel = cl::Kernel(simulator.getProgram(), "countChunks");
+    liveKernel = cl::Kernel(simulator.getProgram(), "markLive");
+    scanKernel = cl::Kernel(simulator.getProgram(), "scanBlocks");
+    addKernel = cl::Kernel(simulator.getProgram(), "addBlockOffsets");
+    scatterKernel = cl::Kernel(simulator.getProgram(), "scatterLive");
+    finishKernel = cl::Kernel(simulator.getProgram(), "finishCompaction");
+    mortonKernel = cl::Kernel(simulator.getProgram(), "mortonKeys");
+    radixCountKernel = cl::Kernel(simulator.getProgram(), "radixCount");
+    radixScatterKernel = cl::Kernel(simulator.getProgram(), "radixScatter");
+    gatherKernel = cl::Kernel(simulator.getProgram(), "gatherSorted");
+    emitCountKernel = cl::Kernel(simulator.getProgram(), "countEmits");
+    emitCommitKernel = cl::Kernel(simulator.getProgram(), "commitEmits");
+    meshKernel = cl::Kernel(meshGenerator.getProgram(), "generate");
+    mergedKernel = cl::Kernel(meshGenerator.getProgram(), "generateMerged");
+    clearImageKernel = cl::Kernel(meshGenerator.getProgram(), "clearImage");
+    imageKernel = cl::Kernel(meshGenerator.getProgram(), "generateImage");
+    reduceKernel = cl::Kernel(meshGenerator.getProgram(), "reduceImage");
+    cullKernel = cl::Kernel(meshGenerator.getProgram(), "cull");
+
+    // Every type id has an entry, plus one for the total.
+    typeCount = simulator.getTypeCount();
+    typeOffsets = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(uint)*(typeCount+1));
+    typeCursors = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(uint)*(typeCount+1));
+    typeOffsetsHost = std::vector<uint>(typeCount+1, 0);
+    typeOffsetsValid = false;
+
+    resetKernel.setArg(0, brickTable);
+    resetKernel.setArg(1, brickCounters);
+    resetKernel.setArg(2, typeOffsets);
+    resetKernel.setArg(3, typeCursors);
+    resetKernel.setArg(4, info);
+
+    markKernel.setArg(1, brickTable);
+    markKernel.setArg(2, info);
+
+    allocateKernel.setArg(0, brickTable);
+    allocateKernel.setArg(2, brickCounters);
+    allocateKernel.setArg(3, info);
+
+    buildKernel.setArg(1, brickTable);
+    buildKernel.setArg(3, info);
+
+    setUpdateArg(2, brickTable);
+    setUpdateArg(4, simulator.getParticleInfo());
+    setUpdateArg(5, activityBuffer);
+    setUpdateArg(7, typeOffsets);
+    setUpdateArg(8, brickCounters);
+    setUpdateArg(10, info);
+    setUpdateArg(14, 60);
+
+    emitters = simulator.hasEmitters();
+    setUpdateArg(13, emitters ? EMIT_PLACE : EMIT_NONE);
+
+    emitCountKernel.setArg(2, brickTable);
+    emitCountKernel.setArg(4, simulator.getParticleInfo());
+    emitCountKernel.setArg(6, brickCounters);
+    emitCountKernel.setArg(8, info);
+
+    emitCommitKernel.setArg(1, brickCounters);
+    emitBase = 0;
+    emitBaseDirty = false;
+    emitTop = 0;
+    emitPlaced = 0;
+
+    claimKernel.setArg(0, brickTable);
+    claimKernel.setArg(4, brickCounters);
+    claimKernel.setArg(5, info);
+
+    resolveKernel.setArg(2, brickTable);
+    resolveKernel.setArg(5, activityBuffer);
+    resolveKernel.setArg(7, brickCounters);
+    resolveKernel.setArg(8, info);
+
+    wakeKernel.setArg(0, activityBuffer);
+    wakeKernel.setArg(2, info);
+
+    typeCountKernel.setArg(1, activityBuffer);
+    typeCountKernel.setArg(2, typeOffsets);
+    typeCountKernel.setArg(3, brickCounters);
+    typeCountKernel.setArg(4, info);
+
+    bucketKernel.setArg(1, activityBuffer);
+    bucketKernel.setArg(3, typeOffsets);
+    bucketKernel.setArg(4, typeCursors);
+    bucketKernel.setArg(5, info);
+
+    countKernel.setArg(0, brickTable);
+    countKernel.setArg(1, activityBuffer);
+    countKernel.setArg(2, brickCounters);
+    countKernel.setArg(3, info);
+
+    liveCount = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(uint));
+    compactedCount = 0;
+    compactionInterval = 0;
+    ticksSinceCompaction = 0;
+    sortInterval = 0;
+    ticksSinceSort = 0;
+
+    // Z-order keys interleave the cell coordinates, one more bit marks dead particles. Coordinates of worlds
+    // too wide for the key lose their low bits, so every live key stays below the dead one.
+    uint axisBits = 0;
+    while((1u << axisBits) < std::max(info.sizeX, std::max(info.sizeY, info.sizeZ))) axisBits++;
+    const uint keyAxisBits = std::min(axisBits, info.sizeZ > 1 ? 10u : 15u);
+    keyBits = keyAxisBits*(info.sizeZ > 1 ? 3 : 2);
+    keyShift = axisBits-keyAxisBits;
+    particleCapacity = 0;
+    particles = 0;
+    particleData = 0;
+    mapPending = false;
+    visibleSlots = 0;
+    for(int i = 0; i < 2; i++) sharedBuffers[i] = 0;
+
+    moveResolution = TWO_PHASE;
+
+    meshKernel.setArg(3, meshGenerator.getParticleInfo());
+    meshKernel.setArg(4, activityBuffer);
+    meshKernel.setArg(6, info);
+    mergedKernel.setArg(3, activityBuffer);
+    mergedKernel.setArg(5, info);
+    clearImageKernel.setArg(1, activityBuffer);
+    clearImageKernel.setArg(3, info);
+    imageKernel.setArg(3, meshGenerator.getParticleInfo());
+    imageKernel.setArg(4, activityBuffer);
+    imageKernel.setArg(5, info);
+    reduceKernel.setArg(1, activityBuffer);
+    reduceKernel.setArg(3, info);
+    visibleCount = 0;
+
+    reserveBricks(16);
+}
+
+ClGridPipeline::~ClGridPipeline() {
+    cl::CommandQueue& queue = ClEngine::getInstance()->getComputeQueue();
+    if(particles != 0) {
+        queue.enqueueUnmapMemObject(particleBuffer, particles);
+        queue.enqueueUnmapMemObject(particleDataBuffer, particleData);
+    }
+    queue.finish();
+    ClEngine::getInstance()->getTransferQueue().finish();
+    releaseSnapshots();
+}
+
+std::vector<cl::Event> ClGridPipeline::waitList(const cl::Event& event) {
+    if(event() == 0) return std::vector<cl::Event>();
+    return std::vector<cl::Event>{ event };
+}
+
+bool ClGridPipeline::enqueue(cl::Kernel& kernel, uint size, const cl::Event& waitEvent, cl::Event& event, const char* name) {
+    return enqueue(kernel, size, waitList(waitEvent), event, name);
+}
+
+bool ClGridPipeline::enqueue(cl::Kernel& kernel, uint size, const std::vector<cl::Event>& wait, cl::Event& event, const char* name, uint localSize) {
+    cl::NDRange local = localSize == 0 ? cl::NullRange : cl::NDRange(localSize);
+    cl_int error = ClEngine::getInstance()->getComputeQueue().enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(size), local, wait.empty() ? 0 : &wait, &event);
+    if(error != CL_SUCCESS) {
+        spdlog::error(std::string("OpenCL ") + name + " Error: " + std::to_string(error));
+        return false;
+    }
+    if(profiling) profiledEvents.push_back({ name, event });
+    return true;
+}
+
+void ClGridPipeline::setProfiling(bool enable) {
+    profiling = enable;
+    if(!enable) profiledEvents.clear();
+}
+
+void ClGridPipeline::collectProfile(std::map<std::string, double>& phases) {
+    std::vector<std::pair<const char*, cl::Event>> pending;
+    for(auto& [name, event] : profiledEvents) {
+        if(event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE) {
+            pending.push_back({ name, event });
+            continue;
+        }
+        const cl_ulong start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+        const cl_ulong end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+        phases[name] += (end-start)/1000000000.0;
+    }
+    profiledEvents = pending;
+}
+
+bool ClGridPipeline::resize(uint capacity, uint keptSlots) {
+    cl::Context& context = ClEngine::getInstance()->getContext();
+    cl::CommandQueue& queue = ClEngine::getInstance()->getComputeQueue();
+
+    cl_int error;
+    cl::Buffer grownBuffer(context, CL_MEM_READ_WRITE, sizeof(VoxelHot)*capacity, 0, &error);
+    cl::Buffer grownDataBuffer;
+    if(error == CL_SUCCESS) grownDataBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(VoxelCold)*capacity, 0, &error);
+    cl::Buffer grownMeshBuffer;
+    if(error == CL_SUCCESS) grownMeshBuffer = cl::Buffer(context, CL_MEM_READ_WRITE, sizeof(MeshInstance)*capacity, 0, &error);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL particle buffer allocation error: " + std::to_string(error));
+        return false;
+    }
+    if(particleCapacity > 0) {
+        queue.enqueueUnmapMemObject(particleBuffer, particles);
+        queue.enqueueUnmapMemObject(particleDataBuffer, particleData);
+        if(keptSlots > 0) {
+            queue.enqueueCopyBuffer(particleBuffer, grownBuffer, 0, 0, sizeof(VoxelHot)*keptSlots);
+            queue.enqueueCopyBuffer(particleDataBuffer, grownDataBuffer, 0, 0, sizeof(VoxelCold)*keptSlots);
+        }
+    }
+    particleBuffer = grownBuffer;
+    particleDataBuffer = grownDataBuffer;
+    particles = (VoxelHot*)queue.enqueueMapBuffer(particleBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, sizeof(VoxelHot)*capacity, 0, 0, &error);
+    if(error == CL_SUCCESS) particleData = (VoxelCold*)queue.enqueueMapBuffer(particleDataBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, sizeof(VoxelCold)*capacity, 0, 0, &error);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL particle buffer mapping error: " + std::to_string(error));
+        return false;
+    }
+    mapPending = false;
+    memset(particles+keptSlots, 0, sizeof(VoxelHot)*(capacity-keptSlots));
+    memset(particleData+keptSlots, 0, sizeof(VoxelCold)*(capacity-keptSlots));
+
+    meshBuffer = grownMeshBuffer;
+    particleCapacity = capacity;
+    bindBuffers();
+    return true;
+}
+
+uint ClGridPipeline::getCapacity() {
+    return particleCapacity;
+}
+
+VoxelHot* ClGridPipeline::getParticles() {
+    return particles;
+}
+
+VoxelCold* ClGridPipeline::getParticleData() {
+    return particleData;
+}
+
+bool ClGridPipeline::releaseParticles() {
+    if(particles == 0) return true;
+    cl::CommandQueue& queue = ClEngine::getInstance()->getComputeQueue();
+    cl::Event unmapEvent;
+    cl_int error = queue.enqueueUnmapMemObject(particleBuffer, particles);
+    if(error == CL_SUCCESS) error = queue.enqueueUnmapMemObject(particleDataBuffer, particleData, 0, &unmapEvent);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL particle buffer unmapping error: " + std::to_string(error));
+        return false;
+    }
+    particles = 0;
+    particleData = 0;
+    lastEvent = unmapEvent;
+    return true;
+}
+
+bool ClGridPipeline::acquireParticles() {
+    if(particles != 0) return true;
+    cl::CommandQueue& queue = ClEngine::getInstance()->getComputeQueue();
+    std::vector<cl::Event> wait = waitList(lastEvent);
+    cl_int error;
+    particles = (VoxelHot*)queue.enqueueMapBuffer(particleBuffer, CL_FALSE, CL_MAP_READ | CL_MAP_WRITE, 0, sizeof(VoxelHot)*particleCapacity, wait.empty() ? 0 : &wait, 0, &error);
+    // The queue is in order, once the second map completes both halves are available.
+    if(error == CL_SUCCESS) particleData = (VoxelCold*)queue.enqueueMapBuffer(particleDataBuffer, CL_FALSE, CL_MAP_READ | CL_MAP_WRITE, 0, sizeof(VoxelCold)*particleCapacity, wait.empty() ? 0 : &wait, &mapEvent, &error);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL particle buffer mapping error: " + std::to_string(error));
+        return false;
+    }
+    mapPending = true;
+    queue.flush();
+    return true;
+}
+
+void ClGridPipeline::waitParticles() {
+    if(!mapPending) return;
+    mapEvent.wait();
+    mapPending = false;
+}
+
+void ClGridPipeline::finish() {
+    ClEngine::getInstance()->getComputeQueue().finish();
+    ClEngine::getInstance()->getTransferQueue().finish();
+}
+
+void ClGridPipeline::bindBuffers() {
+    cl::Context& context = ClEngine::getInstance()->getContext();
+    intentBuffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(float)*4*particleCapacity);
+    workList = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(uint)*particleCapacity);
+
+    markKernel.setArg(0, particleBuffer);
+    buildKernel.setArg(0, particleBuffer);
+    setUpdateArg(0, particleBuffer);
+    setUpdateArg(1, particleDataBuffer);
+    setUpdateArg(6, workList);
+    for(auto& kernel : intentKernels) kernel.setArg(5, intentBuffer);
+    claimKernel.setArg(2, intentBuffer);
+    claimKernel.setArg(3, workList);
+    resolveKernel.setArg(0, particleBuffer);
+    resolveKernel.setArg(1, particleDataBuffer);
+    resolveKernel.setArg(4, intentBuffer);
+    resolveKernel.setArg(6, workList);
+    typeCountKernel.setArg(0, particleBuffer);
+    bucketKernel.setArg(0, particleBuffer);
+    bucketKernel.setArg(2, workList);
+    emitOffsets = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(uint)*(particleCapacity+1));
+    setUpdateArg(9, emitOffsets);
+    emitCountKernel.setArg(0, particleBuffer);
+    emitCountKernel.setArg(1, particleDataBuffer);
+    emitCountKernel.setArg(5, workList);
+    emitCountKernel.setArg(7, emitOffsets);
+    emitCommitKernel.setArg(0, emitOffsets);
+
+    meshKernel.setArg(0, particleBuffer);
+    meshKernel.setArg(1, particleDataBuffer);
+    meshKernel.setArg(2, meshBuffer);
+    mergedKernel.setArg(0, particleBuffer);
+    mergedKernel.setArg(1, meshBuffer);
+    cullKernel.setArg(0, meshBuffer);
+    imageKernel.setArg(0, particleBuffer);
+    imageKernel.setArg(1, particleDataBuffer);
+
+    // Enough blocks for the mesh of the whole capacity or the image pyramid of the grid, whichever is larger.
+    if(dirtyEvent() != 0) dirtyEvent.wait();
+    const ImageLevel& top = imageLevels.back();
+    const uint blocks = (std::max(particleCapacity, top.offset + top.width*top.height) + MeshGenPipeline::DIRTY_BLOCK_SIZE-1) / MeshGenPipeline::DIRTY_BLOCK_SIZE;
+    dirtyBlocks = std::vector<uint>((blocks+31)/32, 0);
+    dirtyBuffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(uint)*dirtyBlocks.size(), dirtyBlocks.data());
+    dirtyEvent = cl::Event();
+    meshKernel.setArg(5, dirtyBuffer);
+    mergedKernel.setArg(4, dirtyBuffer);
+    clearImageKernel.setArg(2, dirtyBuffer);
+    reduceKernel.setArg(2, dirtyBuffer);
+}
+
+void ClGridPipeline::setMoveResolution(MoveResolution resolution) {
+    moveResolution = resolution;
+}
+
+void ClGridPipeline::reserveBricks(size_t bricks) {
+    if(bricks <= brickCapacity || brickCapacity == info.getBrickCount()) return;
+    brickCapacity = std::min<size_t>(bricks + bricks/2 + 16, info.getBrickCount());
+
+    // Bricks are reallocated every tick, the old contents don't have to be kept.
+    brickPool = cl::Buffer(ClEngine::getInstance()->getContext(), CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(GridPoint)*info.getCellsPerBrick()*brickCapacity);
+
+    allocateKernel.setArg(1, brickPool);
+    allocateKernel.setArg(4, brickCapacity);
+    buildKernel.setArg(2, brickPool);
+    setUpdateArg(3, brickPool);
+    emitCountKernel.setArg(3, brickPool);
+    claimKernel.setArg(1, brickPool);
+    resolveKernel.setArg(3, brickPool);
+}
+
+uint ClGridPipeline::getBrickCapacity() {
+    return brickCapacity;
+}
+
+void ClGridPipeline::wake(uint x, uint y, uint z) {
+    if(x >= info.sizeX || y >= info.sizeY || z >= info.sizeZ) return;
+    wokenCells.push_back(x + y*info.sizeX + z*info.sizeX*info.sizeY);
+}
+
+uint ClGridPipeline::getAwakeChunks() {
+    return counters[COUNTER_AWAKE];
+}
+
+uint ClGridPipeline::getAsleepChunks() {
+    return counters[COUNTER_ASLEEP];
+}
+
+uint ClGridPipeline::getDispatchSize(ushort type, uint particleCount) {
+    if(!typeOffsetsValid) return particleCount;
+    // Leave some room for the bucket to grow, the kernels loop over the rest if it grew even more.
+    const uint count = typeOffsetsHost[type+1] - typeOffsetsHost[type];
+    return std::max<uint>((count + count/4 + 63)/64*64, 64);
+}
+
+bool ClGridPipeline::enqueueWakes(cl::Event& event) {
+    if(wokenCells.empty()) return true;
+    // The buffer is released once the kernel is done with it.
+    cl::Buffer cells(ClEngine::getInstance()->getContext(), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(uint)*wokenCells.size(), wokenCells.data());
+    wakeKernel.setArg(1, cells);
+    wakeKernel.setArg(3, (uint)wokenCells.size());
+    wakeKernel.setArg(4, tick);
+    cl::Event wakeEvent;
+    if(!enqueue(wakeKernel, wokenCells.size(), event, wakeEvent, "Chunk Wake")) return false;
+    event = wakeEvent;
+    wokenCells.clear();
+    return true;
+}
+
+void ClGridPipeline::checkCounters() {
+    if(counterEvent() == 0 || counterEvent.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() != CL_COMPLETE) return;
+    typeOffsetsValid = true;
+    // Grow before running out, a tick is skipped whenever the bricks of the grid don't fit.
+    if(counters[COUNTER_OVERFLOW] > 0 || counters[COUNTER_BRICKS] > brickCapacity/4*3) reserveBricks(counters[COUNTER_BRICKS] + counters[COUNTER_OVERFLOW]);
+    counterEvent = cl::Event();
+}
+
+bool ClGridPipeline::simulate(uint particleCount) {
+    cl::CommandQueue& queue = ClEngine::getInstance()->getComputeQueue();
+    checkCounters();
+
+    const uint brickCount = info.getBrickCount();
+    cl::Event resetEvent, markEvent, allocateEvent, buildEvent, collectEvent, countEvent;
+    // The counters of the previous tick might still be on their way to the host.
+    std::vector<cl::Event> wait = waitList(lastEvent);
+    if(counterEvent() != 0) wait.push_back(counterEvent);
+    if(emitBaseDirty) {
+        cl::Event writeEvent;
+        cl_int error = queue.enqueueWriteBuffer(brickCounters, CL_FALSE, sizeof(uint)*COUNTER_EMIT_BASE, sizeof(uint), &emitBase, wait.empty() ? 0 : &wait, &writeEvent);
+        if(error != CL_SUCCESS) {
+            spdlog::error("OpenCL emission base write error: " + std::to_string(error));
+            return false;
+        }
+        wait = waitList(writeEvent);
+        emitBaseDirty = false;
+    }
+    if(!enqueue(resetKernel, brickCount, wait, resetEvent, "Brick Reset")) return false;
+
+    if(!enqueueWakes(resetEvent)) return false;
+
+    markKernel.setArg(3, particleCount);
+    if(!enqueue(markKernel, particleCount, resetEvent, markEvent, "Brick Mark")) return false;
+    if(!enqueue(allocateKernel, brickCount*ALLOCATE_GROUP, waitList(markEvent), allocateEvent, "Brick Allocation", ALLOCATE_GROUP)) return false;
+    // A brick which didn't fit skips the tick on the device, the pool is grown once the counters arrive.
+    buildKernel.setArg(4, particleCount);
+    if(!enqueue(buildKernel, particleCount, allocateEvent, buildEvent, "Grid Build")) return false;
+
+    // Work list bucketed by type: count, scan into the first entry of every type and fill.
+    cl::Event typeEvent;
+    typeCountKernel.setArg(5, particleCount);
+    typeCountKernel.setArg(6, tick);
+    if(!enqueue(typeCountKernel, (particleCount+SCAN_BLOCK-1)/SCAN_BLOCK*SCAN_BLOCK, waitList(buildEvent), typeEvent, "Work List", SCAN_BLOCK)) return false;
+    if(!scan(typeOffsets, typeCount+1, typeEvent)) return false;
+    bucketKernel.setArg(6, particleCount);
+    bucketKernel.setArg(7, tick);
+    if(!enqueue(bucketKernel, particleCount, typeEvent, collectEvent, "Work List")) return false;
+
+    countKernel.setArg(4, tick);
+    if(!enqueue(countKernel, brickCount, collectEvent, countEvent, "Chunk Count")) return false;
+
+    if(emitters) {
+        // Counting run and scan, the simulation run then knows where to place emitted particles.
+        cl::Event emitEvent;
+        emitCountKernel.setArg(9, particleCount);
+        emitCountKernel.setArg(10, tick);
+        if(!enqueue(emitCountKernel, particleCount+1, countEvent, emitEvent, "Emission Count")) return false;
+        // Particles can be emitted into bricks which are still empty, the counting run has marked those.
+        cl::Event emitBrickEvent;
+        if(!enqueue(allocateKernel, brickCount*ALLOCATE_GROUP, waitList(emitEvent), emitBrickEvent, "Brick Allocation", ALLOCATE_GROUP)) return false;
+        emitEvent = emitBrickEvent;
+        if(!scan(emitOffsets, particleCount+1, emitEvent)) return false;
+        countEvent = emitEvent;
+    }
+
+    // One launch per type with an update function, static types are never launched.
+    setUpdateArg(11, particleCount);
+    setUpdateArg(12, tick);
+    std::vector<cl::Kernel>& kernels = moveResolution == SINGLE_PASS ? simKernels : intentKernels;
+    std::vector<cl::Event> updateEvents;
+    for(size_t i = 0; i < kernels.size(); i++) {
+        cl::Event updateEvent;
+        if(!enqueue(kernels[i], getDispatchSize(types[i], particleCount), countEvent, updateEvent, "Simulate")) return false;
+        updateEvents.push_back(updateEvent);
+    }
+    if(updateEvents.empty()) updateEvents.push_back(countEvent);
+
+    if(moveResolution == SINGLE_PASS) {
+        // Nothing left to do, the marker just gives the following stages a single event to wait on.
+        cl_int error = queue.enqueueMarkerWithWaitList(&updateEvents, &lastEvent);
+        if(error != CL_SUCCESS) {
+            spdlog::error("OpenCL Simulate Error: " + std::to_string(error));
+            return false;
+        }
+    } else {
+        cl::Event targetEvent, claimEvent;
+        // Allocate the bricks particles want to move into.
+        if(!enqueue(allocateKernel, brickCount*ALLOCATE_GROUP, updateEvents, targetEvent, "Brick Allocation", ALLOCATE_GROUP)) return false;
+
+        claimKernel.setArg(6, particleCount);
+        if(!enqueue(claimKernel, particleCount, targetEvent, claimEvent, "Move Claim")) return false;
+
+        resolveKernel.setArg(9, particleCount);
+        resolveKernel.setArg(10, tick);
+        if(!enqueue(resolveKernel, particleCount, claimEvent, lastEvent, "Move Resolve")) return false;
+    }
+    if(emitters) {
+        cl::Event commitEvent;
+        emitCommitKernel.setArg(2, particleCount);
+        if(!enqueue(emitCommitKernel, 1, lastEvent, commitEvent, "Emission Commit")) return false;
+        // The host has to learn which slots got used before it allocates any on its own.
+        std::vector<cl::Event> commitWait = waitList(commitEvent);
+        cl::Event topEvent;
+        cl_int error = queue.enqueueReadBuffer(brickCounters, CL_FALSE, sizeof(uint)*COUNTER_EMIT_BASE, sizeof(uint), &emitTop, &commitWait, &topEvent);
+        if(error != CL_SUCCESS) {
+            spdlog::error("OpenCL emission base read error: " + std::to_string(error));
+            return false;
+        }
+        std::vector<cl::Event> topWait = waitList(topEvent);
+        error = queue.enqueueReadBuffer(brickCounters, CL_FALSE, sizeof(uint)*COUNTER_EMIT_PLACED, sizeof(uint), &emitPlaced, &topWait, &lastEvent);
+        if(error != CL_SUCCESS) {
+            spdlog::error("OpenCL emission count read error: " + std::to_string(error));
+            return false;
+        }
+    }
+    tick++;
+    ticksSinceCompaction++;
+    ticksSinceSort++;
+
+    if(counterEvent() == 0) {
+        cl::CommandQueue& transferQueue = ClEngine::getInstance()->getTransferQueue();
+        wait = waitList(lastEvent);
+        cl_int error = transferQueue.enqueueReadBuffer(brickCounters, CL_FALSE, 0, sizeof(counters), counters, &wait, 0);
+        if(error != CL_SUCCESS) spdlog::error("OpenCL brick counter read error: " + std::to_string(error));
+        // The type buckets of this tick size the launches of the following ones.
+        error = transferQueue.enqueueReadBuffer(typeOffsets, CL_FALSE, 0, sizeof(uint)*typeOffsetsHost.size(), typeOffsetsHost.data(), &wait, &counterEvent);
+        if(error != CL_SUCCESS) spdlog::error("OpenCL type bucket read error: " + std::to_string(error));
+        transferQueue.flush();
+    }
+
+    queue.flush();
+    return true;
+}
+
+bool ClGridPipeline::needsCompaction(uint slotCount, uint hostHoles) {
+    // Counters read before the last compaction could still be in flight.
+    checkCounters();
+    if(counterEvent() != 0) return false;
+    if(compactionInterval != 0 && ticksSinceCompaction >= compactionInterval) return true;
+    const uint dead = counters[COUNTER_DEAD] + hostHoles;
+    return dead >= 256 && dead >= slotCount/4;
+}
+
+void ClGridPipeline::setCompactionInterval(uint ticks) {
+    compactionInterval = ticks;
+}
+
+bool ClGridPipeline::scan(cl::Buffer& values, uint count, cl::Event& event) {
+    const uint blocks = (count+SCAN_BLOCK-1)/SCAN_BLOCK;
+    cl::Buffer sums(ClEngine::getInstance()->getContext(), CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(uint)*blocks);
+
+    scanKernel.setArg(0, values);
+    scanKernel.setArg(1, sums);
+    scanKernel.setArg(2, count);
+    cl::Event scanEvent;
+    if(!enqueue(scanKernel, blocks*SCAN_BLOCK, waitList(event), scanEvent, "Scan", SCAN_BLOCK)) return false;
+    event = scanEvent;
+    if(blocks == 1) return true;
+
+    // Block totals are scanned the same way and added back onto every block.
+    if(!scan(sums, blocks, event)) return false;
+    addKernel.setArg(0, values);
+    addKernel.setArg(1, sums);
+    addKernel.setArg(2, count);
+    cl::Event addEvent;
+    if(!enqueue(addKernel, count, event, addEvent, "Scan")) return false;
+    event = addEvent;
+    return true;
+}
+
+bool ClGridPipeline::compact(uint slotCount) {
+    if(slotCount == 0) return true;
+    cl::Context& context = ClEngine::getInstance()->getContext();
+    cl::CommandQueue& queue = ClEngine::getInstance()->getComputeQueue();
+
+    cl::Buffer offsets(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(uint)*slotCount);
+    cl::Buffer compacted(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(VoxelHot)*slotCount);
+    cl::Buffer compactedData(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(VoxelCold)*slotCount);
+
+    liveKernel.setArg(0, particleBuffer);
+    liveKernel.setArg(1, offsets);
+    liveKernel.setArg(2, slotCount);
+    cl::Event event;
+    if(!enqueue(liveKernel, slotCount, lastEvent, event, "Compaction")) return false;
+    if(!scan(offsets, slotCount, event)) return false;
+
+    scatterKernel.setArg(0, particleBuffer);
+    scatterKernel.setArg(1, particleDataBuffer);
+    scatterKernel.setArg(2, compacted);
+    scatterKernel.setArg(3, compactedData);
+    scatterKernel.setArg(4, offsets);
+    scatterKernel.setArg(5, liveCount);
+    scatterKernel.setArg(6, slotCount);
+    cl::Event scatterEvent;
+    if(!enqueue(scatterKernel, slotCount, event, scatterEvent, "Compaction")) return false;
+
+    return finishCompaction(compacted, compactedData, scatterEvent);
+}
+
+bool ClGridPipeline::finishCompaction(cl::Buffer& compacted, cl::Buffer& compactedData, const cl::Event& waitEvent) {
+    cl::CommandQueue& queue = ClEngine::getInstance()->getComputeQueue();
+
+    finishKernel.setArg(0, particleBuffer);
+    finishKernel.setArg(1, particleDataBuffer);
+    finishKernel.setArg(2, compacted);
+    finishKernel.setArg(3, compactedData);
+    finishKernel.setArg(4, liveCount);
+    finishKernel.setArg(5, brickCounters);
+    finishKernel.setArg(6, particleCapacity);
+    cl::Event finishEvent;
+    if(!enqueue(finishKernel, particleCapacity, waitEvent, finishEvent, "Compaction")) return false;
+
+    std::vector<cl::Event> wait = waitList(finishEvent);
+    cl_int error = queue.enqueueReadBuffer(liveCount, CL_FALSE, 0, sizeof(uint), &compactedCount, &wait, &lastEvent);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL compaction count read error: " + std::to_string(error));
+        return false;
+    }
+    // The dead counter on the host is stale until the next read, don't compact again because of it.
+    counters[COUNTER_DEAD] = 0;
+    ticksSinceCompaction = 0;
+    ticksSinceSort = 0;
+    // finishCompaction moves the emission base right after the live particles.
+    emitBaseDirty = false;
+
+    queue.flush();
+    return true;
+}
+
+bool ClGridPipeline::needsSort() {
+    return sortInterval != 0 && ticksSinceSort >= sortInterval;
+}
+
+void ClGridPipeline::setSortInterval(uint ticks) {
+    sortInterval = ticks;
+}
+
+bool ClGridPipeline::sort(uint slotCount) {
+    if(slotCount == 0) return true;
+    cl::Context& context = ClEngine::getInstance()->getContext();
+
+    const uint blocks = (slotCount+SCAN_BLOCK-1)/SCAN_BLOCK;
+    cl::Buffer keys[2] = {
+        cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(uint)*slotCount),
+        cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(uint)*slotCount)
+    };
+    cl::Buffer values[2] = {
+        cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(uint)*slotCount),
+        cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(uint)*slotCount)
+    };
+    cl::Buffer histogram(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(uint)*RADIX_BINS*blocks);
+    cl::Buffer sorted(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(VoxelHot)*slotCount);
+    cl::Buffer sortedData(context, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, sizeof(VoxelCold)*slotCount);
+
+    mortonKernel.setArg(0, particleBuffer);
+    mortonKernel.setArg(1, keys[0]);
+    mortonKernel.setArg(2, values[0]);
+    mortonKernel.setArg(3, info);
+    mortonKernel.setArg(4, slotCount);
+    mortonKernel.setArg(5, keyBits);
+    mortonKernel.setArg(6, keyShift);
+    cl::Event event;
+    if(!enqueue(mortonKernel, slotCount, lastEvent, event, "Sort")) return false;
+
+    // Least significant digit first, every pass is stable.
+    uint current = 0;
+    for(uint shift = 0; shift <= keyBits; shift += RADIX_BITS) {
+        radixCountKernel.setArg(0, keys[current]);
+        radixCountKernel.setArg(1, histogram);
+        radixCountKernel.setArg(2, slotCount);
+        radixCountKernel.setArg(3, shift);
+        cl::Event countEvent;
+        if(!enqueue(radixCountKernel, blocks*SCAN_BLOCK, waitList(event), countEvent, "Sort", SCAN_BLOCK)) return false;
+        if(!scan(histogram, RADIX_BINS*blocks, countEvent)) return false;
+
+        radixScatterKernel.setArg(0, keys[current]);
+        radixScatterKernel.setArg(1, values[current]);
+        radixScatterKernel.setArg(2, keys[1-current]);
+        radixScatterKernel.setArg(3, values[1-current]);
+        radixScatterKernel.setArg(4, histogram);
+        radixScatterKernel.setArg(5, slotCount);
+        radixScatterKernel.setArg(6, shift);
+        if(!enqueue(radixScatterKernel, blocks*SCAN_BLOCK, waitList(countEvent), event, "Sort", SCAN_BLOCK)) return false;
+        current = 1-current;
+    }
+
+    gatherKernel.setArg(0, particleBuffer);
+    gatherKernel.setArg(1, particleDataBuffer);
+    gatherKernel.setArg(2, sorted);
+    gatherKernel.setArg(3, sortedData);
+    gatherKernel.setArg(4, keys[current]);
+    gatherKernel.setArg(5, values[current]);
+    gatherKernel.setArg(6, liveCount);
+    gatherKernel.setArg(7, slotCount);
+    gatherKernel.setArg(8, keyBits);
+    cl::Event gatherEvent;
+    if(!enqueue(gatherKernel, slotCount, event, gatherEvent, "Sort")) return false;
+
+    return finishCompaction(sorted, sortedData, gatherEvent);
+}
+
+uint ClGridPipeline::getCompactedCount() {
+    return compactedCount;
+}
+
+void ClGridPipeline::setEmitBase(uint slot) {
+    if(!emitters) return;
+    emitBase = slot;
+    emitBaseDirty = true;
+}
+
+uint ClGridPipeline::getEmitTop() {
+    return emitTop;
+}
+
+uint ClGridPipeline::getEmitPlaced() {
+    return emitPlaced;
+}
+
+uint ClGridPipeline::getRequiredSpace(uint particleCapacity, uint ticks) {
+    if(!emitters) return 0;
+    // Keep room for a few more ticks of emission at the current rate, or for the whole batch if it is longer.
+    const uint wanted = counters[COUNTER_EMITTED]*std::max<uint>(ticks, 4) + counters[COUNTER_EMIT_OVERFLOW];
+    const uint top = std::max(emitTop, counters[COUNTER_EMIT_BASE]);
+    const uint free = top < particleCapacity ? particleCapacity - top : 0;
+    if(counters[COUNTER_EMIT_OVERFLOW] == 0 && wanted <= free) return 0;
+    return wanted - std::min(wanted, free) + 256;
+}
+
+std::vector<cl::Event> ClGridPipeline::meshWaitList() {
+    std::vector<cl::Event> wait = waitList(lastEvent);
+    if(readEvent() != 0) wait.push_back(readEvent);
+    return wait;
+}
+
+bool ClGridPipeline::generateMesh(uint particleCount, uint sinceTick) {
+    cl::CommandQueue& queue = ClEngine::getInstance()->getComputeQueue();
+
+    std::vector<cl::Event> events = meshWaitList();
+    // Host edits wake their chunks only on the next tick, the mesh has to see them now.
+    cl::Event wakeEvent;
+    if(!enqueueWakes(wakeEvent)) return false;
+    if(wakeEvent() != 0) events.push_back(wakeEvent);
+    meshKernel.setArg(7, particleCount);
+    meshKernel.setArg(8, sinceTick);
+    if(!enqueue(meshKernel, particleCount, events, meshEvent, "Mesh Gen")) return false;
+    lastEvent = meshEvent;
+    if(!readDirtyBlocks()) return false;
+
+    queue.flush();
+    return true;
+}
+
+bool ClGridPipeline::allocateImage() {
+    if(imageBuffer() != 0) return true;
+    const ImageLevel& top = imageLevels.back();
+    cl_int error;
+    imageBuffer = cl::Buffer(ClEngine::getInstance()->getContext(), CL_MEM_READ_WRITE, sizeof(uint)*(top.offset + top.width*top.height), 0, &error);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL image buffer allocation error: " + std::to_string(error));
+        imageBuffer = cl::Buffer();
+        return false;
+    }
+    return true;
+}
+
+bool ClGridPipeline::generateImage(uint particleCount, uint sinceTick) {
+    if(!allocateImage()) return false;
+    return enqueueImageGeneration(imageBuffer, particleCount, meshWaitList(), sinceTick);
+}
+
+bool ClGridPipeline::enqueueImageGeneration(cl::Buffer& image, uint particleCount, const std::vector<cl::Event>& wait, uint sinceTick) {
+    cl::CommandQueue& queue = ClEngine::getInstance()->getComputeQueue();
+
+    std::vector<cl::Event> events;
+    for(auto& event : wait) if(event() != 0) events.push_back(event);
+    cl::Event wakeEvent;
+    if(!enqueueWakes(wakeEvent)) return false;
+    if(wakeEvent() != 0) events.push_back(wakeEvent);
+    if(!enqueueImage(image, particleCount, events, sinceTick)) return false;
+    lastEvent = meshEvent;
+    if(!readDirtyBlocks()) return false;
+
+    queue.flush();
+    return true;
+}
+
+bool ClGridPipeline::generateMergedMesh(uint particleCount, uint sinceTick) {
+    cl::CommandQueue& queue = ClEngine::getInstance()->getComputeQueue();
+    if(!allocateImage()) return false;
+
+    std::vector<cl::Event> events = meshWaitList();
+    cl::Event wakeEvent;
+    if(!enqueueWakes(wakeEvent)) return false;
+    if(wakeEvent() != 0) events.push_back(wakeEvent);
+    // The rectangles are merged from the colors of the image.
+    if(!enqueueImage(imageBuffer, particleCount, events, sinceTick)) return false;
+    cl::Event imageEvent = meshEvent;
+    mergedKernel.setArg(2, imageBuffer);
+    mergedKernel.setArg(6, particleCount);
+    mergedKernel.setArg(7, sinceTick);
+    if(!enqueue(mergedKernel, particleCount, imageEvent, meshEvent, "Mesh Merge")) return false;
+    lastEvent = meshEvent;
+    if(!readDirtyBlocks()) return false;
+
+    queue.flush();
+    return true;
+}
+
+bool ClGridPipeline::enqueueImage(cl::Buffer& image, uint particleCount, const std::vector<cl::Event>& wait, uint sinceTick) {
+    // Cells of the changed chunks are cleared first, so the ones left empty stay transparent.
+    cl::Event clearEvent;
+    clearImageKernel.setArg(0, image);
+    clearImageKernel.setArg(4, sinceTick);
+    if(!enqueue(clearImageKernel, (info.bricksX*info.bricksY) << info.brickShift, wait, clearEvent, "Image Clear")) return false;
+    imageKernel.setArg(2, image);
+    imageKernel.setArg(6, particleCount);
+    imageKernel.setArg(7, sinceTick);
+    if(!enqueue(imageKernel, particleCount, clearEvent, meshEvent, "Image Gen")) return false;
+    // Every level is reduced from the one before it.
+    reduceKernel.setArg(0, image);
+    reduceKernel.setArg(11, sinceTick);
+    for(size_t i = 1; i < imageLevels.size(); i++) {
+        const ImageLevel& source = imageLevels[i-1];
+        const ImageLevel& level = imageLevels[i];
+        reduceKernel.setArg(4, source.offset);
+        reduceKernel.setArg(5, source.width);
+        reduceKernel.setArg(6, source.height);
+        reduceKernel.setArg(7, level.offset);
+        reduceKernel.setArg(8, level.width);
+        reduceKernel.setArg(9, level.height);
+        reduceKernel.setArg(10, (uint)i);
+        cl::Event reduceEvent;
+        if(!enqueue(reduceKernel, level.width*level.height, meshEvent, reduceEvent, "Image Reduce")) return false;
+        meshEvent = reduceEvent;
+    }
+    return true;
+}
+
+bool ClGridPipeline::readDirtyBlocks() {
+    cl::CommandQueue& transferQueue = ClEngine::getInstance()->getTransferQueue();
+    std::vector<cl::Event> wait = waitList(meshEvent);
+    cl_int error = transferQueue.enqueueReadBuffer(dirtyBuffer, CL_FALSE, 0, sizeof(uint)*dirtyBlocks.size(), dirtyBlocks.data(), &wait, &dirtyEvent);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL dirty block read error: " + std::to_string(error));
+        return false;
+    }
+    transferQueue.flush();
+
+    // The next generation starts from a clean mask, the compute queue is in order.
+    wait = waitList(dirtyEvent);
+    const uint zero = 0;
+    error = ClEngine::getInstance()->getComputeQueue().enqueueFillBuffer(dirtyBuffer, zero, 0, sizeof(uint)*dirtyBlocks.size(), &wait, 0);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL dirty block clear error: " + std::to_string(error));
+        return false;
+    }
+    return true;
+}
+
+uint ClGridPipeline::getTick() {
+    return tick;
+}
+
+bool ClGridPipeline::areDirtyBlocksReady(bool wait) {
+    if(dirtyEvent() == 0) return true;
+    if(wait) dirtyEvent.wait();
+    return dirtyEvent.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() == CL_COMPLETE;
+}
+
+const std::vector<uint>& ClGridPipeline::getDirtyBlocks() {
+    return dirtyBlocks;
+}
+
+bool ClGridPipeline::cullMesh(uint particleCount, const uint area[4]) {
+    if(visibleSlots < particleCount || visibleBuffer() == 0) {
+        cl_int error;
+        visibleBuffer = cl::Buffer(ClEngine::getInstance()->getContext(), CL_MEM_READ_WRITE, getVisibleSize(particleCount), 0, &error);
+        if(error != CL_SUCCESS) {
+            spdlog::error("OpenCL visible buffer allocation error: " + std::to_string(error));
+            visibleBuffer = cl::Buffer();
+            visibleSlots = 0;
+            return false;
+        }
+        visibleSlots = particleCount;
+    }
+    if(!enqueueCull(visibleBuffer, particleCount, area, meshWaitList())) return false;
+    // The copy is sized by the count, drawing takes it from the command.
+    return readVisibleCount();
+}
+
+bool ClGridPipeline::enqueueCull(cl::Buffer& visible, uint particleCount, const uint area[4], const std::vector<cl::Event>& wait) {
+    cl::CommandQueue& queue = ClEngine::getInstance()->getComputeQueue();
+
+    // The count of the previous cull has to be read before it's cleared. Every record is a quad of 6 vertices.
+    std::vector<cl::Event> events;
+    for(auto& event : wait) if(event() != 0) events.push_back(event);
+    if(visibleEvent() != 0) events.push_back(visibleEvent);
+    const MeshDrawCommand command = { 6, 0, 0, 0 };
+    cl::Event clearEvent;
+    cl_int error = queue.enqueueFillBuffer(visible, command, 0, sizeof(command), &events, &clearEvent);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL draw command clear error: " + std::to_string(error));
+        return false;
+    }
+    cullKernel.setArg(1, visible);
+    for(uint i = 0; i < 4; i++) cullKernel.setArg(2+i, area[i]);
+    cullKernel.setArg(6, particleCount);
+    if(!enqueue(cullKernel, particleCount, clearEvent, meshEvent, "Mesh Cull")) return false;
+    queue.flush();
+    return true;
+}
+
+bool ClGridPipeline::readVisibleCount() {
+    cl::CommandQueue& transferQueue = ClEngine::getInstance()->getTransferQueue();
+    std::vector<cl::Event> events = waitList(meshEvent);
+    cl_int error = transferQueue.enqueueReadBuffer(visibleBuffer, CL_FALSE, offsetof(MeshDrawCommand, instanceCount), sizeof(uint), &visibleCount, &events, &visibleEvent);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL visible count read error: " + std::to_string(error));
+        return false;
+    }
+    transferQueue.flush();
+    return true;
+}
+
+bool ClGridPipeline::isVisibleCountReady() {
+    return visibleEvent() == 0 || visibleEvent.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() == CL_COMPLETE;
+}
+
+uint ClGridPipeline::getVisibleCount() {
+    return visibleCount;
+}
+
+bool ClGridPipeline::readMesh(void* target, bool image, size_t source, const std::vector<std::pair<size_t, size_t>>& ranges) {
+    // The transfer queue is in order, the target is complete once the last copy is.
+    cl::CommandQueue& transferQueue = ClEngine::getInstance()->getTransferQueue();
+    std::vector<cl::Event> wait = waitList(meshEvent);
+    for(auto& range : ranges) {
+        cl_int error = transferQueue.enqueueReadBuffer(image ? imageBuffer : visibleBuffer, CL_FALSE, source+range.first, range.second, (char*)target+range.first, &wait, &readEvent);
+        if(error != CL_SUCCESS) {
+            spdlog::error("OpenCL mesh read error: " + std::to_string(error));
+            transferQueue.finish();
+            return false;
+        }
+    }
+    transferQueue.flush();
+    return true;
+}
+
+bool ClGridPipeline::isReadComplete() {
+    return readEvent() == 0 || readEvent.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() == CL_COMPLETE;
+}
+
+void ClGridPipeline::waitRead() {
+    if(readEvent() != 0) readEvent.wait();
+}
+
+bool ClGridPipeline::supportsSharedSnapshots(const uint8_t* deviceUUID) {
+    return ClEngine::getInstance()->supportsExternalMemory(deviceUUID);
+}
+
+bool ClGridPipeline::importSnapshot(uint snapshot, int fd, size_t size) {
+    if(sharedBuffers[snapshot] != 0) delete sharedBuffers[snapshot];
+    sharedBuffers[snapshot] = ClEngine::getInstance()->importBuffer(fd, size);
+    return sharedBuffers[snapshot] != 0;
+}
+
+void ClGridPipeline::releaseSnapshots() {
+    // Kernels still writing into them have to finish first.
+    waitRead();
+    for(int i = 0; i < 2; i++) {
+        if(sharedBuffers[i] != 0) delete sharedBuffers[i];
+        sharedBuffers[i] = 0;
+    }
+}
+
+bool ClGridPipeline::generateSharedImage(uint snapshot, uint particleCount, uint sinceTick) {
+    if(sharedBuffers[snapshot] == 0) return false;
+    // Kernels may only touch imported memory between an acquire and a release.
+    ClEngine* engine = ClEngine::getInstance();
+    cl::Buffer& target = *sharedBuffers[snapshot];
+    cl::Event acquireEvent, releaseEvent;
+    cl_int error = engine->acquireExternal(target, meshWaitList(), acquireEvent);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL external memory acquire error: " + std::to_string(error));
+        return false;
+    }
+    if(!enqueueImageGeneration(target, particleCount, { acquireEvent }, sinceTick)) return false;
+    std::vector<cl::Event> meshWait = { meshEvent };
+    error = engine->releaseExternal(target, meshWait, releaseEvent);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL external memory release error: " + std::to_string(error));
+        return false;
+    }
+    engine->getComputeQueue().flush();
+    // Nothing to read back, the snapshot is complete once the release is.
+    readEvent = releaseEvent;
+    return true;
+}
+
+bool ClGridPipeline::cullSharedMesh(uint snapshot, uint particleCount, const uint area[4]) {
+    if(sharedBuffers[snapshot] == 0) return false;
+    ClEngine* engine = ClEngine::getInstance();
+    cl::Buffer& target = *sharedBuffers[snapshot];
+    cl::Event acquireEvent, releaseEvent;
+    cl_int error = engine->acquireExternal(target, meshWaitList(), acquireEvent);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL external memory acquire error: " + std::to_string(error));
+        return false;
+    }
+    if(!enqueueCull(target, particleCount, area, { acquireEvent })) return false;
+    std::vector<cl::Event> meshWait = { meshEvent };
+    error = engine->releaseExternal(target, meshWait, releaseEvent);
+    if(error != CL_SUCCESS) {
+        spdlog::error("OpenCL external memory release error: " + std::to_string(error));
+        return false;
+    }
+    engine->getComputeQueue().flush();
+    // The instance count never leaves the device.
+    readEvent = releaseEvent;
+    return true;
+}
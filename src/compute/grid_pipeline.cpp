@@ -0,0 +1,15 @@
+#include <compute/grid_pipeline.hpp>
+#include <compute/cl_pipeline.hpp>
+#include <compute/native_pipeline.hpp>
+#include <native-engine/engine.hpp>
+
+using namespace unibox;
+
+GridPipeline* GridPipeline::create(Simulator& simulator, MeshGenPipeline& meshGenerator, const GridInfo& info) {
+    if(NativeEngine::getInstance() != 0) return new NativeGridPipeline(simulator, meshGenerator, info);
+    return new ClGridPipeline(simulator, meshGenerator, info);
+}
+
+size_t GridPipeline::getVisibleSize(size_t slots) {
+    return sizeof(MeshDrawCommand) + sizeof(MeshInstance)*slots;
+}
@@ -23,6 +23,8 @@ using namespace unibox;
 
 cl::Buffer* MeshGenPipeline::pib = 0;
 cl::Program* MeshGenPipeline::program = 0;
+NativeProgram* MeshGenPipeline::nativeProgram = 0;
+std::vector<ParticleInfoPacket> MeshGenPipeline::particleInfo;
 
 MeshGenPipeline::MeshGenPipeline() {
     
@@ -32,33 +34,15 @@ MeshGenPipeline::~MeshGenPipeline() {
     
 }
 
-void MeshGenPipeline::generate(uint32_t particleCount, cl::Buffer& particleBuffer, cl::Buffer& meshBuffer) {
-    kernel.setArg(0, particleBuffer);
-    kernel.setArg(1, meshBuffer);
-    kernel.setArg(3, particleCount);
-
-    cl_int error;
-    cl::CommandQueue queue(ClEngine::getInstance()->getContext(), ClEngine::getInstance()->getDevice(), 0, &error);
-    if(error != CL_SUCCESS) {
-        spdlog::error("OpenCL Mesh Generator command queue creation failure: " + std::to_string(error));
-        return;
-    }
-    error = queue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(particleCount));
-    if(error != CL_SUCCESS) {
-        spdlog::error("OpenCL Mesh Gen Error: " + std::to_string(error));
-        return;
-    }
-
-    queue.flush();
-
-    error = queue.finish();
-    if(error != CL_SUCCESS) {
-        spdlog::error("OpenCL Mesh Gen Finish Error: " + std::to_string(error));
+void MeshGenPipeline::createMeshGenerationInformation() {
+    if(NativeEngine::getInstance() != 0) {
+        if(particleInfo.empty()) {
+            std::vector<Particle*>& particles = Particle::getParticleArray();
+            particleInfo = std::vector<ParticleInfoPacket>(particles.size());
+            for(int i = 0; i < particles.size(); i++) particles[i]->fillPip(particleInfo[i]);
+        }
         return;
     }
-}
-
-void MeshGenPipeline::createMeshGenerationInformation() {
     if(pib == 0) {
         std::vector<Particle*>& particles = Particle::getParticleArray();
 
@@ -68,11 +52,12 @@ void MeshGenPipeline::createMeshGenerationInformation() {
         pib = new cl::Buffer(ClEngine::getInstance()->getContext(), CL_MEM_READ_ONLY | CL_MEM_HOST_NO_ACCESS | CL_MEM_COPY_HOST_PTR, sizeof(ParticleInfoPacket)*particles.size(), pip);
         Finalizer::addCallback([](){ delete pib; });
     }
-    kernel.setArg(2, *pib);
 }
 
 void MeshGenPipeline::createMeshGenerationShader() {
-    if(program == 0) {
+    // Compiled once per backend, a process can run grids on both of them.
+    const bool native = NativeEngine::getInstance() != 0;
+    if(native ? nativeProgram == 0 : program == 0) {
         ShaderAssembler assembler = ShaderAssembler("shaders/compute/meshGenerator.cl");
         assembler.pragmaInsert("PARTICLE_CODE", Particle::constructMeshFunctions());
         assembler.pragmaInsert("PARTICLE_SWITCH", Particle::constructMeshSwitchCode());
@@ -80,9 +65,42 @@ void MeshGenPipeline::createMeshGenerationShader() {
         assembler.pragmaInsert("INCLUDE_CODE", Particle::getMeshIncludeCode());
         std::ofstream stream = std::ofstream("meshGenDump.cl", std::ios::binary);
         assembler.dump(stream);
+        if(native) {
+            nativeProgram = assembler.compile(*NativeEngine::getInstance(), "meshGenerator");
+            Finalizer::addCallback([](){ delete nativeProgram; });
+            return;
+        }
         program = assembler.compile(ClEngine::getInstance()->getContext(), ClEngine::getInstance()->getDevice());
         Finalizer::addCallback([](){ delete program; });
     }
+}
+
+cl::Program& MeshGenPipeline::getProgram() {
+    return *program;
+}
+
+cl::Buffer& MeshGenPipeline::getParticleInfo() {
+    return *pib;
+}
 
-    kernel = cl::Kernel(*program, "generate");
+NativeProgram& MeshGenPipeline::getNativeProgram() {
+    return *nativeProgram;
+}
+
+const ParticleInfoPacket* MeshGenPipeline::getParticleInfoData() {
+    return particleInfo.data();
+}
+
+std::vector<ImageLevel> MeshGenPipeline::getImageLevels(uint32_t sizeX, uint32_t sizeY) {
+    std::vector<ImageLevel> levels;
+    ImageLevel level = { 0, sizeX, sizeY };
+    while(true) {
+        levels.push_back(level);
+        if(level.width == 1 && level.height == 1) break;
+        const uint32_t end = level.offset + level.width*level.height;
+        level.offset = (end + DIRTY_BLOCK_SIZE-1) / DIRTY_BLOCK_SIZE * DIRTY_BLOCK_SIZE;
+        level.width = (level.width+1) / 2;
+        level.height = (level.height+1) / 2;
+    }
+    return levels;
 }
@@ -0,0 +1,463 @@
+#include <compute/native_pipeline.hpp>
+#include <native-engine/engine.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cstring>
+
+using namespace unibox;
+
+// Indices into the brick counters, see simulator.cl.
+#define COUNTER_BRICKS 0
+#define COUNTER_OVERFLOW 1
+#define COUNTER_AWAKE 3
+#define COUNTER_ASLEEP 4
+#define COUNTER_DEAD 5
+#define COUNTER_EMIT_BASE 6
+#define COUNTER_EMITTED 7
+#define COUNTER_EMIT_OVERFLOW 8
+#define COUNTER_EMIT_PLACED 9
+
+#define EMIT_NONE 0
+#define EMIT_PLACE 2
+
+#define SCAN_BLOCK 65536
+
+NativeGridPipeline::NativeGridPipeline(Simulator& simulator, MeshGenPipeline& meshGenerator, const GridInfo& info) :
+    program(simulator.getNativeProgram()), meshProgram(meshGenerator.getNativeProgram()) {
+    this->info = info;
+    imageLevels = MeshGenPipeline::getImageLevels(info.sizeX, info.sizeY);
+    simulationInfo = simulator.getParticleInfoData();
+    meshInfo = meshGenerator.getParticleInfoData();
+
+    brickTable = std::vector<uint>(info.getBrickCount(), 0);
+    for(uint& counter : counters) counter = 0;
+    brickCapacity = 0;
+
+    // Every chunk starts awake, tick 1 is within SLEEP_TICKS of the zeroed activity.
+    activity = std::vector<uint>(info.getBrickCount(), 0);
+    tick = 1;
+    profiling = false;
+
+    resetKernel = reinterpret_cast<ResetKernel>(program.getSymbol("resetBricks"));
+    markKernel = reinterpret_cast<MarkKernel>(program.getSymbol("markBricks"));
+    allocateKernel = reinterpret_cast<AllocateKernel>(program.getSymbol("allocateBricks"));
+    buildKernel = reinterpret_cast<BuildKernel>(program.getSymbol("buildGrid"));
+    types = simulator.getUpdatedTypes();
+    for(ushort type : types) {
+        simKernels.push_back(reinterpret_cast<SimulateKernel>(program.getSymbol("simulate_" + std::to_string(type))));
+        intentKernels.push_back(reinterpret_cast<IntentKernel>(program.getSymbol("simulateIntent_" + std::to_string(type))));
+    }
+    claimKernel = reinterpret_cast<ClaimKernel>(program.getSymbol("claimMoves"));
+    resolveKernel = reinterpret_cast<ResolveKernel>(program.getSymbol("resolveMoves"));
+    wakeKernel = reinterpret_cast<WakeKernel>(program.getSymbol("wakeChunks"));
+    typeCountKernel = reinterpret_cast<TypeCountKernel>(program.getSymbol("countTypes"));
+    bucketKernel = reinterpret_cast<BucketKernel>(program.getSymbol("bucketParticles"));
+    countKernel = reinterpret_cast<CountKernel>(program.getSymbol("countChunks"));
+    liveKernel = reinterpret_cast<LiveKernel>(program.getSymbol("markLive"));
+    scatterKernel = reinterpret_cast<ScatterKernel>(program.getSymbol("scatterLive"));
+    finishKernel = reinterpret_cast<FinishKernel>(program.getSymbol("finishCompaction"));
+    mortonKernel = reinterpret_cast<MortonKernel>(program.getSymbol("mortonKeys"));
+    gatherKernel = reinterpret_cast<GatherKernel>(program.getSymbol("gatherSorted"));
+    emitCountKernel = reinterpret_cast<EmitCountKernel>(program.getSymbol("countEmits"));
+    emitCommitKernel = reinterpret_cast<EmitCommitKernel>(program.getSymbol("commitEmits"));
+    meshKernel = reinterpret_cast<MeshKernel>(meshProgram.getSymbol("generate"));
+    mergedKernel = reinterpret_cast<MergedKernel>(meshProgram.getSymbol("generateMerged"));
+    clearImageKernel = reinterpret_cast<ClearImageKernel>(meshProgram.getSymbol("clearImage"));
+    imageKernel = reinterpret_cast<ImageKernel>(meshProgram.getSymbol("generateImage"));
+    reduceKernel = reinterpret_cast<ReduceKernel>(meshProgram.getSymbol("reduceImage"));
+    cullKernel = reinterpret_cast<CullKernel>(meshProgram.getSymbol("cull"));
+
+    typeCount = simulator.getTypeCount();
+    typeOffsets = std::vector<uint>(typeCount+1, 0);
+    typeCursors = std::vector<uint>(typeCount+1, 0);
+
+    emitters = simulator.hasEmitters();
+    emitBase = 0;
+    emitBaseDirty = false;
+
+    liveCount = 0;
+    compactionInterval = 0;
+    ticksSinceCompaction = 0;
+    sortInterval = 0;
+    ticksSinceSort = 0;
+
+    // Same keys as the OpenCL pipeline, see its constructor.
+    uint axisBits = 0;
+    while((1u << axisBits) < std::max(info.sizeX, std::max(info.sizeY, info.sizeZ))) axisBits++;
+    const uint keyAxisBits = std::min(axisBits, info.sizeZ > 1 ? 10u : 15u);
+    keyBits = keyAxisBits*(info.sizeZ > 1 ? 3 : 2);
+    keyShift = axisBits-keyAxisBits;
+
+    particleCapacity = 0;
+    visibleCount = 0;
+
+    moveResolution = TWO_PHASE;
+
+    reserveBricks(16);
+}
+
+NativeGridPipeline::~NativeGridPipeline() {
+
+}
+
+void NativeGridPipeline::setProfiling(bool enable) {
+    profiling = enable;
+    if(!enable) profiledPhases.clear();
+}
+
+void NativeGridPipeline::collectProfile(std::map<std::string, double>& phases) {
+    for(auto& [name, time] : profiledPhases) phases[name] += time;
+    profiledPhases.clear();
+}
+
+bool NativeGridPipeline::resize(uint capacity, uint keptSlots) {
+    particles.resize(capacity);
+    particleData.resize(capacity);
+    std::fill(particles.begin()+keptSlots, particles.end(), VoxelHot());
+    std::fill(particleData.begin()+keptSlots, particleData.end(), VoxelCold());
+    mesh = std::vector<MeshInstance>(capacity);
+    particleCapacity = capacity;
+    intents = std::vector<Intent>(particleCapacity);
+    workList = std::vector<uint>(particleCapacity);
+    emitOffsets = std::vector<uint>(particleCapacity+1);
+
+    const ImageLevel& top = imageLevels.back();
+    const uint blocks = (std::max(particleCapacity, top.offset + top.width*top.height) + MeshGenPipeline::DIRTY_BLOCK_SIZE-1) / MeshGenPipeline::DIRTY_BLOCK_SIZE;
+    dirtyBlocks = std::vector<uint>((blocks+31)/32, 0);
+    return true;
+}
+
+uint NativeGridPipeline::getCapacity() {
+    return particleCapacity;
+}
+
+VoxelHot* NativeGridPipeline::getParticles() {
+    return particles.data();
+}
+
+VoxelCold* NativeGridPipeline::getParticleData() {
+    return particleData.data();
+}
+
+bool NativeGridPipeline::releaseParticles() {
+    return true;
+}
+
+bool NativeGridPipeline::acquireParticles() {
+    return true;
+}
+
+void NativeGridPipeline::waitParticles() {
+
+}
+
+void NativeGridPipeline::finish() {
+
+}
+
+void NativeGridPipeline::setMoveResolution(MoveResolution resolution) {
+    moveResolution = resolution;
+}
+
+void NativeGridPipeline::reserveBricks(size_t bricks) {
+    if(bricks <= brickCapacity || brickCapacity == info.getBrickCount()) return;
+    brickCapacity = std::min<size_t>(bricks + bricks/2 + 16, info.getBrickCount());
+    brickPool = std::vector<GridPoint>((size_t)info.getCellsPerBrick()*brickCapacity);
+}
+
+uint NativeGridPipeline::getBrickCapacity() {
+    return brickCapacity;
+}
+
+void NativeGridPipeline::wake(uint x, uint y, uint z) {
+    if(x >= info.sizeX || y >= info.sizeY || z >= info.sizeZ) return;
+    wokenCells.push_back(x + y*info.sizeX + z*info.sizeX*info.sizeY);
+}
+
+uint NativeGridPipeline::getAwakeChunks() {
+    return counters[COUNTER_AWAKE];
+}
+
+uint NativeGridPipeline::getAsleepChunks() {
+    return counters[COUNTER_ASLEEP];
+}
+
+uint NativeGridPipeline::scan(uint* values, uint count) {
+    const uint blocks = (count+SCAN_BLOCK-1)/SCAN_BLOCK;
+    if(blocks <= 1) {
+        uint sum = 0;
+        for(uint i = 0; i < count; i++) {
+            const uint value = values[i];
+            values[i] = sum;
+            sum += value;
+        }
+        return sum;
+    }
+
+    // Every block is scanned on its own and the block totals are added back, like scanBlocks on the device.
+    ThreadPool& pool = NativeEngine::getInstance()->getThreadPool();
+    std::vector<uint> sums(blocks);
+    pool.parallelFor(blocks, 1, [&](uint begin, uint end) {
+        for(uint block = begin; block < end; block++) {
+            uint sum = 0;
+            for(uint i = block*SCAN_BLOCK; i < std::min(count, (block+1)*SCAN_BLOCK); i++) {
+                const uint value = values[i];
+                values[i] = sum;
+                sum += value;
+            }
+            sums[block] = sum;
+        }
+    });
+    const uint total = scan(sums.data(), blocks);
+    pool.parallelFor(blocks, 1, [&](uint begin, uint end) {
+        for(uint block = begin; block < end; block++) {
+            for(uint i = block*SCAN_BLOCK; i < std::min(count, (block+1)*SCAN_BLOCK); i++) values[i] += sums[block];
+        }
+    });
+    return total;
+}
+
+void NativeGridPipeline::applyWakes() {
+    if(wokenCells.empty()) return;
+    run(program, "Chunk Wake", wakeKernel, wokenCells.size(), activity.data(), (const uint*)wokenCells.data(), info, (uint)wokenCells.size(), tick);
+    wokenCells.clear();
+}
+
+bool NativeGridPipeline::simulate(uint particleCount) {
+    const uint brickCount = info.getBrickCount();
+    if(emitBaseDirty) {
+        counters[COUNTER_EMIT_BASE] = emitBase;
+        emitBaseDirty = false;
+    }
+    run(program, "Brick Reset", resetKernel, brickCount, brickTable.data(), counters, typeOffsets.data(), typeCursors.data(), info);
+
+    applyWakes();
+
+    run(program, "Brick Mark", markKernel, particleCount, particles.data(), brickTable.data(), info, particleCount);
+    run(program, "Brick Allocation", allocateKernel, brickCount, brickTable.data(), brickPool.data(), counters, info, brickCapacity);
+    // A brick which didn't fit skips the tick, like on OpenCL, the pool is grown at the end of it.
+    run(program, "Grid Build", buildKernel, particleCount, particles.data(), brickTable.data(), brickPool.data(), info, particleCount);
+
+    // Work list bucketed by type, the counts are exact so every simulate launch gets the size of its bucket.
+    run(program, "Work List", typeCountKernel, particleCount, particles.data(), activity.data(), typeOffsets.data(), counters, info, particleCount, tick);
+    scan(typeOffsets.data(), typeCount+1);
+    run(program, "Work List", bucketKernel, particleCount, particles.data(), activity.data(), workList.data(), typeOffsets.data(), typeCursors.data(), info, particleCount, tick);
+    run(program, "Chunk Count", countKernel, brickCount, brickTable.data(), activity.data(), counters, info, tick);
+
+    if(emitters) {
+        run(program, "Emission Count", emitCountKernel, particleCount+1, particles.data(), particleData.data(), brickTable.data(), brickPool.data(), simulationInfo, workList.data(), counters, emitOffsets.data(), info, particleCount, tick);
+        // Particles can be emitted into bricks which are still empty, the counting run has marked those.
+        run(program, "Brick Allocation", allocateKernel, brickCount, brickTable.data(), brickPool.data(), counters, info, brickCapacity);
+        scan(emitOffsets.data(), particleCount+1);
+    }
+
+    const uint emitMode = emitters ? EMIT_PLACE : EMIT_NONE;
+    for(size_t i = 0; i < types.size(); i++) {
+        const uint size = typeOffsets[types[i]+1] - typeOffsets[types[i]];
+        if(moveResolution == SINGLE_PASS) {
+            run(program, "Simulate", simKernels[i], size, particles.data(), particleData.data(), brickTable.data(), brickPool.data(), simulationInfo, activity.data(), workList.data(), typeOffsets.data(), counters, emitOffsets.data(), info, particleCount, tick, emitMode, 60u);
+        } else {
+            run(program, "Simulate", intentKernels[i], size, particles.data(), particleData.data(), brickTable.data(), brickPool.data(), simulationInfo, intents.data(), activity.data(), workList.data(), typeOffsets.data(), counters, emitOffsets.data(), info, particleCount, tick, emitMode, 60u);
+        }
+    }
+
+    if(moveResolution == TWO_PHASE) {
+        run(program, "Brick Allocation", allocateKernel, brickCount, brickTable.data(), brickPool.data(), counters, info, brickCapacity);
+        run(program, "Move Claim", claimKernel, particleCount, brickTable.data(), brickPool.data(), intents.data(), workList.data(), counters, info, particleCount);
+        run(program, "Move Resolve", resolveKernel, particleCount, particles.data(), particleData.data(), brickTable.data(), brickPool.data(), intents.data(), activity.data(), workList.data(), counters, info, particleCount, tick);
+    }
+    if(emitters) run(program, "Emission Commit", emitCommitKernel, 1, emitOffsets.data(), counters, particleCount);
+    tick++;
+    ticksSinceCompaction++;
+    ticksSinceSort++;
+
+    if(counters[COUNTER_OVERFLOW] > 0 || counters[COUNTER_BRICKS] > brickCapacity/4*3) reserveBricks(counters[COUNTER_BRICKS] + counters[COUNTER_OVERFLOW]);
+    return true;
+}
+
+bool NativeGridPipeline::needsCompaction(uint slotCount, uint hostHoles) {
+    if(compactionInterval != 0 && ticksSinceCompaction >= compactionInterval) return true;
+    const uint dead = counters[COUNTER_DEAD] + hostHoles;
+    return dead >= 256 && dead >= slotCount/4;
+}
+
+void NativeGridPipeline::setCompactionInterval(uint ticks) {
+    compactionInterval = ticks;
+}
+
+bool NativeGridPipeline::compact(uint slotCount) {
+    if(slotCount == 0) return true;
+    std::vector<uint> offsets(slotCount);
+    std::vector<VoxelHot> compacted(slotCount);
+    std::vector<VoxelCold> compactedData(slotCount);
+
+    run(program, "Compaction", liveKernel, slotCount, particles.data(), offsets.data(), slotCount);
+    scan(offsets.data(), slotCount);
+    run(program, "Compaction", scatterKernel, slotCount, particles.data(), particleData.data(), compacted.data(), compactedData.data(), offsets.data(), &liveCount, slotCount);
+
+    finishCompaction(compacted, compactedData);
+    return true;
+}
+
+void NativeGridPipeline::finishCompaction(std::vector<VoxelHot>& compacted, std::vector<VoxelCold>& compactedData) {
+    run(program, "Compaction", finishKernel, particleCapacity, particles.data(), particleData.data(), compacted.data(), compactedData.data(), &liveCount, counters, particleCapacity);
+    ticksSinceCompaction = 0;
+    ticksSinceSort = 0;
+    emitBaseDirty = false;
+}
+
+bool NativeGridPipeline::needsSort() {
+    return sortInterval != 0 && ticksSinceSort >= sortInterval;
+}
+
+void NativeGridPipeline::setSortInterval(uint ticks) {
+    sortInterval = ticks;
+}
+
+bool NativeGridPipeline::sort(uint slotCount) {
+    if(slotCount == 0) return true;
+    std::vector<uint> keys(slotCount), values(slotCount);
+    std::vector<VoxelHot> sorted(slotCount);
+    std::vector<VoxelCold> sortedData(slotCount);
+
+    run(program, "Sort", mortonKernel, slotCount, particles.data(), keys.data(), values.data(), info, slotCount, keyBits, keyShift);
+
+    // Stable like the radix sort of the device, so both backends end up with the same order.
+    const auto start = std::chrono::steady_clock::now();
+    std::stable_sort(values.begin(), values.end(), [&keys](uint a, uint b) { return keys[a] < keys[b]; });
+    std::vector<uint> sortedKeys(slotCount);
+    for(uint i = 0; i < slotCount; i++) sortedKeys[i] = keys[values[i]];
+    if(profiling) profiledPhases["Sort"] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    run(program, "Sort", gatherKernel, slotCount, particles.data(), particleData.data(), sorted.data(), sortedData.data(), sortedKeys.data(), values.data(), &liveCount, slotCount, keyBits);
+
+    finishCompaction(sorted, sortedData);
+    return true;
+}
+
+uint NativeGridPipeline::getCompactedCount() {
+    return liveCount;
+}
+
+void NativeGridPipeline::setEmitBase(uint slot) {
+    if(!emitters) return;
+    emitBase = slot;
+    emitBaseDirty = true;
+}
+
+uint NativeGridPipeline::getEmitTop() {
+    return counters[COUNTER_EMIT_BASE];
+}
+
+uint NativeGridPipeline::getEmitPlaced() {
+    return counters[COUNTER_EMIT_PLACED];
+}
+
+uint NativeGridPipeline::getRequiredSpace(uint particleCapacity, uint ticks) {
+    if(!emitters) return 0;
+    const uint wanted = counters[COUNTER_EMITTED]*std::max<uint>(ticks, 4) + counters[COUNTER_EMIT_OVERFLOW];
+    const uint top = counters[COUNTER_EMIT_BASE];
+    const uint free = top < particleCapacity ? particleCapacity - top : 0;
+    if(counters[COUNTER_EMIT_OVERFLOW] == 0 && wanted <= free) return 0;
+    return wanted - std::min(wanted, free) + 256;
+}
+
+bool NativeGridPipeline::generateMesh(uint particleCount, uint sinceTick) {
+    applyWakes();
+    std::fill(dirtyBlocks.begin(), dirtyBlocks.end(), 0);
+    run(meshProgram, "Mesh Gen", meshKernel, particleCount, particles.data(), particleData.data(), mesh.data(), meshInfo, activity.data(), dirtyBlocks.data(), info, particleCount, sinceTick);
+    return true;
+}
+
+bool NativeGridPipeline::generateImage(uint particleCount, uint sinceTick) {
+    applyWakes();
+    std::fill(dirtyBlocks.begin(), dirtyBlocks.end(), 0);
+    runImage(particleCount, sinceTick);
+    return true;
+}
+
+bool NativeGridPipeline::generateMergedMesh(uint particleCount, uint sinceTick) {
+    applyWakes();
+    std::fill(dirtyBlocks.begin(), dirtyBlocks.end(), 0);
+    runImage(particleCount, sinceTick);
+    run(meshProgram, "Mesh Merge", mergedKernel, particleCount, particles.data(), mesh.data(), image.data(), activity.data(), dirtyBlocks.data(), info, particleCount, sinceTick);
+    return true;
+}
+
+void NativeGridPipeline::runImage(uint particleCount, uint sinceTick) {
+    const ImageLevel& top = imageLevels.back();
+    if(image.empty()) image = std::vector<uint>(top.offset + top.width*top.height);
+    run(meshProgram, "Image Clear", clearImageKernel, (info.bricksX*info.bricksY) << info.brickShift, image.data(), activity.data(), dirtyBlocks.data(), info, sinceTick);
+    run(meshProgram, "Image Gen", imageKernel, particleCount, particles.data(), particleData.data(), image.data(), meshInfo, activity.data(), info, particleCount, sinceTick);
+    for(size_t i = 1; i < imageLevels.size(); i++) {
+        const ImageLevel& source = imageLevels[i-1];
+        const ImageLevel& level = imageLevels[i];
+        run(meshProgram, "Image Reduce", reduceKernel, level.width*level.height, image.data(), activity.data(), dirtyBlocks.data(), info, source.offset, source.width, source.height, level.offset, level.width, level.height, (uint)i, sinceTick);
+    }
+}
+
+uint NativeGridPipeline::getTick() {
+    return tick;
+}
+
+bool NativeGridPipeline::areDirtyBlocksReady(bool wait) {
+    return true;
+}
+
+const std::vector<uint>& NativeGridPipeline::getDirtyBlocks() {
+    return dirtyBlocks;
+}
+
+bool NativeGridPipeline::cullMesh(uint particleCount, const uint area[4]) {
+    const size_t size = getVisibleSize(particleCount)/sizeof(uint);
+    if(visible.size() < size) visible = std::vector<uint>(size);
+    MeshDrawCommand* command = reinterpret_cast<MeshDrawCommand*>(visible.data());
+    *command = { 6, 0, 0, 0 };
+    run(meshProgram, "Mesh Cull", cullKernel, particleCount, mesh.data(), command, area[0], area[1], area[2], area[3], particleCount);
+    visibleCount = command->instanceCount;
+    return true;
+}
+
+bool NativeGridPipeline::isVisibleCountReady() {
+    return true;
+}
+
+uint NativeGridPipeline::getVisibleCount() {
+    return visibleCount;
+}
+
+bool NativeGridPipeline::readMesh(void* target, bool image, size_t source, const std::vector<std::pair<size_t, size_t>>& ranges) {
+    const char* data = (image ? (const char*)this->image.data() : (const char*)visible.data()) + source;
+    for(auto& range : ranges) memcpy((char*)target+range.first, data+range.first, range.second);
+    return true;
+}
+
+bool NativeGridPipeline::isReadComplete() {
+    return true;
+}
+
+void NativeGridPipeline::waitRead() {
+
+}
+
+bool NativeGridPipeline::supportsSharedSnapshots(const uint8_t* deviceUUID) {
+    return false;
+}
+
+bool NativeGridPipeline::importSnapshot(uint snapshot, int fd, size_t size) {
+    return false;
+}
+
+void NativeGridPipeline::releaseSnapshots() {
+
+}
+
+bool NativeGridPipeline::generateSharedImage(uint snapshot, uint particleCount, uint sinceTick) {
+    return false;
+}
+
+bool NativeGridPipeline::cullSharedMesh(uint snapshot, uint particleCount, const uint area[4]) {
+    return false;
+}
@@ -13,6 +13,7 @@ using namespace unibox::gui;
 GuiEngine::GuiEngine(const RenderEngine& renderEngine) {
     this->renderEngine = renderEngine;
     nextHandle = 1;
+    changed = true;
 
     gui_resource_handle shader = createShader("shaders/gui/texture/vertex.spv", "shaders/gui/texture/fragment.spv", SPIRV, "default_textured_shader");
     gui_resource_handle shader2 = createShader("shaders/gui/color/vertex.spv", "shaders/gui/color/fragment.spv", SPIRV, "default_colored_shader");
@@ -59,6 +60,7 @@ gui_handle GuiEngine::addItem(GuiObject* object) {
     auto last = guiObjects.begin();
     gui_handle handle = nextHandle;
     nextHandle++;
+    changed = true;
     for(auto iter = guiObjects.begin(); iter != guiObjects.end(); iter++) {
         if((*iter)->getLayer() < object->getLayer()) {
             auto ins = guiObjects.insert(iter, object);
@@ -77,6 +79,7 @@ void GuiEngine::removeItem(gui_handle handle) {
     if(map != mappings.end()) {
         guiObjects.remove(map->second);
         mappings.erase(handle);
+        changed = true;
     }
 }
 
@@ -123,6 +126,12 @@ void GuiEngine::render(double frameTime, double x, double y) {
     });
 }
 
+bool GuiEngine::takeChanges() {
+    const bool result = changed;
+    changed = false;
+    return result;
+}
+
 gui_resource_handle GuiEngine::createTexture(const std::string& filepath) {
     int width, height, channels;
     stbi_uc* pixels = stbi_load(filepath.c_str(), &width, &height, &channels, STBI_rgb_alpha);
@@ -0,0 +1,122 @@
+#include <spdlog/spdlog.h>
+
+#include <cl-engine/engine.hpp>
+#include <simulator/particle.hpp>
+#include <simulator/particle_grid.hpp>
+#include <util/savefile.hpp>
+#include <util/finalizer.hpp>
+
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+using namespace unibox;
+
+// Runs a save without a window: unibox-headless <save.ubs> [ticks] [--output <file.ubs>] [--batch <ticks>] [--single-pass] [--sort <ticks>]
+// Only OpenCL is needed, any device works including CPU implementations like PoCL. The grid is simulated through
+// ParticleGrid with the same move resolution as unibox, so the numbers include everything a tick costs in the app.
+
+static void printUsage() {
+    printf("Usage: unibox-headless <save.ubs> [ticks] [--output <file.ubs>] [--batch <ticks>] [--single-pass] [--sort <ticks>]\n");
+}
+
+static int run(const std::string& savePath, const std::string& outputPath, uint ticks, uint batch, uint sortInterval, MoveResolution resolution) {
+    Particle::loadParticles();
+
+    SaveFile save = SaveFile(savePath);
+    if(!save.readParticles()) {
+        spdlog::error("Could not load '" + savePath + "'.");
+        return -1;
+    }
+    const uint sizeX = save.getSizeX();
+    const uint sizeY = save.getSizeY();
+    const uint sizeZ = std::max<uint>(save.getSizeZ(), 1);
+
+    ParticleGrid::initCompute();
+    if(!ParticleGrid::waitInitComplete()) return -1;
+
+    ParticleGrid grid(sizeX, sizeY, sizeZ);
+    grid.setMoveResolution(resolution);
+    grid.setSortInterval(sortInterval);
+    // Same rules as in the app, one particle per cell and nothing out of bounds.
+    if(!grid.addVoxels(0, 0, 0, save.getParticles())) {
+        spdlog::error("Could not make room for the particles of '" + savePath + "'.");
+        return -1;
+    }
+    spdlog::info("Loaded " + std::to_string(grid.getParticleCount()) + " particles, " + std::to_string(sizeX) + "x" + std::to_string(sizeY) + "x" + std::to_string(sizeZ));
+
+    // The first tick also pays for the driver's setup work, it runs on its own and is not part of the measurement.
+    grid.setProfiling(true);
+    std::map<std::string, double> phases;
+    if(ticks > 0) {
+        grid.simulate(1);
+        grid.finish();
+        grid.collectProfile(phases);
+        phases.clear();
+    }
+    const uint measured = ticks > 0 ? ticks-1 : 0;
+    uint done = 0;
+    double seconds = 0;
+    while(done < measured) {
+        const uint steps = std::min(batch, measured-done);
+        auto start = std::chrono::high_resolution_clock::now();
+        grid.simulate(steps);
+        grid.finish();
+        auto end = std::chrono::high_resolution_clock::now();
+        seconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end-start).count()/1000000000.0;
+        grid.collectProfile(phases);
+        done += steps;
+    }
+
+    if(seconds > 0) printf("%u ticks in %.3f s, %.1f ticks per second\n", measured, seconds, measured/seconds);
+    double total = 0;
+    for(auto& [name, time] : phases) total += time;
+    for(auto& [name, time] : phases) printf("%-18s %10.3f ms %8.3f ms/tick %6.1f%%\n", name.c_str(), time*1000.0, time*1000.0/std::max<uint>(measured, 1), total > 0 ? time/total*100.0 : 0.0);
+    printf("%u awake chunks, %u asleep chunks\n", grid.getAwakeChunks(), grid.getAsleepChunks());
+
+    if(!outputPath.empty()) {
+        const std::vector<Voxel> voxels = grid.getVoxels();
+        if(!SaveFile::write(outputPath, save.getName(), save.getDescription(), sizeX, sizeY, sizeZ, voxels)) return -1;
+        spdlog::info("Wrote " + std::to_string(voxels.size()) + " particles to " + outputPath);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if(argc < 2) {
+        printUsage();
+        return -1;
+    }
+
+    std::string savePath = argv[1];
+    std::string outputPath;
+    uint ticks = 1000;
+    uint batch = 100;
+    uint sortInterval = 0;
+    MoveResolution resolution = TWO_PHASE;
+    for(int i = 2; i < argc; i++) {
+        if(strcmp(argv[i], "--output") == 0 && i+1 < argc) outputPath = argv[++i];
+        else if(strcmp(argv[i], "--batch") == 0 && i+1 < argc) batch = std::max(atoi(argv[++i]), 1);
+        else if(strcmp(argv[i], "--sort") == 0 && i+1 < argc) sortInterval = std::max(atoi(argv[++i]), 0);
+        else if(strcmp(argv[i], "--single-pass") == 0) resolution = SINGLE_PASS;
+        else if(argv[i][0] != '-') ticks = std::max(atoi(argv[i]), 0);
+        else {
+            printUsage();
+            return -1;
+        }
+    }
+
+    Finalizer* finalizer = new Finalizer();
+    int result = -1;
+    {
+        // Any device will do, the queues are profiled for the per phase times.
+        ClEngine clEngine = ClEngine(CL_DEVICE_TYPE_ALL, CL_QUEUE_PROFILING_ENABLE);
+        if(ClEngine::getInstance() != 0) {
+            spdlog::info("Running on " + clEngine.getDevice().getInfo<CL_DEVICE_NAME>());
+            result = run(savePath, outputPath, ticks, batch, sortInterval, resolution);
+        }
+    }
+    delete finalizer;
+    return result;
+}
@@ -6,7 +6,9 @@
 #include <renderer/camera.hpp>
 #include <util/savefile.hpp>
 #include <simulator/particle_grid.hpp>
+#include <simulator/simulation_thread.hpp>
 #include <cl-engine/engine.hpp>
+#include <native-engine/engine.hpp>
 #include <util/finalizer.hpp>
 #include <util/global_resources.hpp>
 #include <util/font.hpp>
@@ -20,6 +22,8 @@
 #include <chrono>
 #include <future>
 #include <cmath>
+#include <string>
+#include <ctime>
 
 #include <glm/vec4.hpp>
 
@@ -31,7 +35,26 @@ int main(int argc, char** argv) {
     Finalizer* finalizer = new Finalizer();
     util::GlobalResources resourceManager = util::GlobalResources();
 
-    ClEngine clEngine = ClEngine();
+    // --backend native runs the simulation on the CPU, it's also used when there is no OpenCL device.
+    bool nativeBackend = false;
+    for(int i = 1; i+1 < argc; i++) {
+        if(std::string(argv[i]) == "--backend") nativeBackend = std::string(argv[i+1]) == "native";
+    }
+    // --continuous draws a frame on every iteration even when nothing changes, to compare the utilisation against.
+    bool continuous = false;
+    for(int i = 1; i < argc; i++) {
+        if(std::string(argv[i]) == "--continuous") continuous = true;
+    }
+    ClEngine* clEngine = 0;
+    NativeEngine* nativeEngine = 0;
+    if(!nativeBackend) {
+        clEngine = new ClEngine();
+        if(ClEngine::getInstance() == 0) {
+            spdlog::warn("Falling back to the native simulation backend.");
+            nativeBackend = true;
+        }
+    }
+    if(nativeBackend) nativeEngine = new NativeEngine();
 
     Window window = Window();
     if(!window.init()) return -1;
@@ -60,7 +83,8 @@ int main(int argc, char** argv) {
     //gui::Button but = gui::Button(guiEngine, guiEngine.getShader("default_textured_shader"), tex, tex2, tex, 1280/2, 720/2, 64, 64);
 
     float zoom = 600.0f;
-    float dir = 0;//-0.1f;
+    // Zoom change per second of the demo animation, it only runs in continuous mode.
+    float dir = 0;//-6.0f;
 
     Camera* camera = new Camera();
     camera->setPosition(glm::vec3(450.0f, 450.0f, 1.0f));
@@ -141,22 +165,52 @@ int main(int argc, char** argv) {
     window.getEngine().addRenderFunction(ParticleGrid::renderAll);
     window.getEngine().addRenderFunction([&renderer](VkCommandBuffer cmd) { renderer.render(cmd); });
 
-    auto last = std::chrono::high_resolution_clock::now();
-
-    int f = 1;
+    // Space pauses, the right arrow steps while paused and F toggles fast forward.
+    SimulationThread simulation = SimulationThread(60.0);
+    window.addKeyDownCallback([&simulation](int key, int mods) {
+        switch(key) {
+            case GLFW_KEY_SPACE:
+                if(simulation.isPaused()) simulation.resume();
+                else simulation.pause();
+                break;
+            case GLFW_KEY_RIGHT:
+                simulation.step();
+                break;
+            case GLFW_KEY_F:
+                simulation.setSpeed(simulation.getSpeed() > 1.0 ? 1.0 : 4.0);
+                break;
+        }
+    });
+    // Ticks with awake chunks wake the loop up, the simulation thread requests the frames.
+    ParticleGrid::setFrameCallback([&window]() { window.wakeUp(); });
+    simulation.start();
+
+    // Utilisation is logged every second. The CPU time covers every thread of the process, the frames drawn
+    // stand in for the GPU load since every one of them renders and presents the whole scene.
+    auto last = std::chrono::steady_clock::now();
+    std::clock_t lastClock = std::clock();
+    uint frames = 0;
+    uint wakeUps = 0;
+    auto lastFrame = last;
 
     while(!window.shouldClose()) {
-        window.frameStart();
-        if(f == 0) {
-            auto now = std::chrono::high_resolution_clock::now();
-            auto dur = std::chrono::duration_cast<std::chrono::microseconds>(now-last);
-            last=now;
-            
-            spdlog::info(std::to_string(1.0/(dur.count()/60000000.0)) + " FPS");
+        // Sleeps until something changes, the timeout only keeps the utilisation log going while idle.
+        if(continuous) window.frameStart();
+        else window.waitEvents(1.0);
+        wakeUps++;
+
+        const auto now = std::chrono::steady_clock::now();
+        const double elapsed = std::chrono::duration<double>(now-last).count();
+        if(elapsed >= 1.0) {
+            const std::clock_t clock = std::clock();
+            const double cpu = double(clock-lastClock)/CLOCKS_PER_SEC/elapsed;
+            spdlog::info(std::to_string(frames/elapsed) + " FPS, " + std::to_string(wakeUps/elapsed) + " wake ups/s, " + std::to_string(cpu*100.0) + "% CPU, " + std::to_string(simulation.getTickCount()) + " ticks");
+            last = now;
+            lastClock = clock;
+            frames = 0;
+            wakeUps = 0;
         }
 
-        if(f == 0 || f==15 || f == 30 || f == 45)grid->simulate();
-
         glm::vec2 mouse = window.getCursorPos();
         mouse /= glm::vec2(1280/2.0, -720/2.0);
         mouse -= glm::vec2(1.0, -1.0);
@@ -179,24 +233,36 @@ int main(int argc, char** argv) {
             });
         }*/
 
-        zoom += dir;
-        if(zoom < 10.0f) dir = -dir;
-        if(zoom > 600.0f) dir = -dir;
+        // Scaled by the time since the last frame, so the speed doesn't depend on how often the loop runs.
+        if(continuous) {
+            zoom += dir*std::chrono::duration<float>(now-lastFrame).count();
+            if(zoom < 10.0f) dir = -dir;
+            if(zoom > 600.0f) dir = -dir;
+        }
+
+        // Every source is taken on each iteration, so a request isn't carried over to a later frame.
+        const bool input = window.takeInput();
+        const bool gui = guiEngine.takeChanges();
+        const bool grids = ParticleGrid::takeFrameRequest();
+        if(!continuous && !input && !gui && !grids) continue;
+        lastFrame = now;
 
         camera->orthographic(1280.0f/720.0f, -10.0f, 10.0f, zoom);
         camera->updateBuffer();
 
         window.render();
-        f++;
-        f = f%60;
+        frames++;
     }
 
+    simulation.stop();
     window.waitIdle();
 
     delete camera;
     delete grid;
 
     delete finalizer;
+    if(nativeEngine != 0) delete nativeEngine;
+    if(clEngine != 0) delete clEngine;
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,142 @@
+#include <native-engine/engine.hpp>
+#include <native-engine/program.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <regex>
+#include <cstdlib>
+#include <cerrno>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace unibox;
+
+NativeEngine* NativeEngine::instance = 0;
+
+NativeEngine::NativeEngine(uint32_t threads) :
+    pool(threads) {
+    const char* cxx = std::getenv("CXX");
+    compiler = cxx != 0 ? cxx : "c++";
+    cacheDirectory = (std::filesystem::temp_directory_path() / ("unibox-native-" + std::to_string(getpid()))).string();
+
+    std::error_code error;
+    std::filesystem::create_directories(cacheDirectory, error);
+    if(error) {
+        spdlog::error("Could not create the native kernel directory '" + cacheDirectory + "'.");
+        return;
+    }
+    spdlog::info("Native backend running on " + std::to_string(pool.getThreadCount()) + " threads.");
+
+    instance = this;
+}
+
+NativeEngine::~NativeEngine() {
+    if(instance == this) instance = 0;
+    std::error_code error;
+    std::filesystem::remove_all(cacheDirectory, error);
+}
+
+ThreadPool& NativeEngine::getThreadPool() {
+    return pool;
+}
+
+bool NativeEngine::runCompiler(const std::vector<std::string>& arguments, const std::string& logPath) {
+    std::vector<char*> argv;
+    for(const std::string& argument : arguments) argv.push_back(const_cast<char*>(argument.c_str()));
+    argv.push_back(0);
+
+    const int log = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(log < 0) {
+        spdlog::error("Could not create the native build log '" + logPath + "'.");
+        return false;
+    }
+    const pid_t pid = fork();
+    if(pid == 0) {
+        dup2(log, STDERR_FILENO);
+        close(log);
+        execvp(argv[0], argv.data());
+        _exit(127);
+    }
+    close(log);
+    if(pid < 0) {
+        spdlog::error("Could not start the native compiler: " + std::to_string(errno));
+        return false;
+    }
+
+    int status;
+    while(waitpid(pid, &status, 0) < 0) {
+        if(errno != EINTR) return false;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+NativeProgram* NativeEngine::compile(const std::string& source, const std::string& name) {
+    // Vector literals are the only OpenCL C syntax which isn't valid C++, (float4)(a, b) becomes float4(a, b).
+    static const std::regex vectorLiteral("\\(\\s*((?:u?char|u?short|u?int|u?long|float|double)(?:2|3|4|8|16))\\s*\\)\\s*\\(");
+    const std::string vectorCode = std::regex_replace(source, vectorLiteral, "$1(");
+
+    // Unsigned casts have to saturate like on the device, see NativeCast in opencl.hpp. sizeof(uint) stays as it is.
+    static const std::regex unsignedCast("(sizeof\\s*)?\\(\\s*(uchar|ushort|uint|ulong)\\s*\\)");
+    std::string code;
+    size_t last = 0;
+    for(auto it = std::sregex_iterator(vectorCode.begin(), vectorCode.end(), unsignedCast); it != std::sregex_iterator(); it++) {
+        const std::smatch& match = *it;
+        code += vectorCode.substr(last, match.position() - last);
+        if(match[1].matched) code += match.str();
+        else code += "NativeCast<" + match.str(2) + ">() ->* ";
+        last = match.position() + match.length();
+    }
+    code += vectorCode.substr(last);
+
+    const std::string sourcePath = cacheDirectory + "/" + name + ".cpp";
+    const std::string libraryPath = cacheDirectory + "/" + name + ".so";
+    const std::string logPath = cacheDirectory + "/" + name + ".log";
+    {
+        std::ofstream stream = std::ofstream(sourcePath, std::ios::binary);
+        if(!stream.is_open()) {
+            spdlog::error("Could not write the native kernel source '" + sourcePath + "'.");
+            return 0;
+        }
+        stream << code;
+    }
+
+    // Contraction is off so the results don't depend on whether the compiler fuses multiply-adds.
+    const std::string header = std::filesystem::absolute("shaders/native/opencl.hpp").string();
+    if(!std::filesystem::exists(header)) {
+        spdlog::error("Native kernel header '" + header + "' is missing.");
+        return 0;
+    }
+    // Arguments are passed as they are instead of through a shell, so paths with quotes or spaces can't break the command.
+    // CXX may hold a launcher in front of the compiler, its words become separate arguments.
+    std::vector<std::string> arguments;
+    std::istringstream compilerWords(compiler);
+    for(std::string word; compilerWords >> word;) arguments.push_back(word);
+    if(arguments.empty()) arguments.push_back("c++");
+    for(const char* flag : { "-std=c++17", "-O2", "-fPIC", "-shared", "-ffp-contract=off", "-include" }) arguments.push_back(flag);
+    arguments.insert(arguments.end(), { header, "-o", libraryPath, sourcePath });
+    if(!runCompiler(arguments, logPath)) {
+        std::ifstream logStream = std::ifstream(logPath, std::ios::binary);
+        std::stringstream log;
+        log << logStream.rdbuf();
+        spdlog::error("Could not build native program '" + name + "'.");
+        spdlog::error("Log: " + log.str());
+        return 0;
+    }
+
+    void* handle = dlopen(libraryPath.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if(handle == 0) {
+        spdlog::error(std::string("Could not load native program: ") + dlerror());
+        return 0;
+    }
+    return new NativeProgram(handle);
+}
+
+NativeEngine* NativeEngine::getInstance() {
+    return instance;
+}
@@ -0,0 +1,22 @@
+#include <native-engine/program.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <dlfcn.h>
+
+using namespace unibox;
+
+NativeProgram::NativeProgram(void* handle) {
+    this->handle = handle;
+    setWorkItem = reinterpret_cast<void (*)(size_t, size_t)>(dlsym(handle, "nativeSetWorkItem"));
+}
+
+NativeProgram::~NativeProgram() {
+    dlclose(handle);
+}
+
+void* NativeProgram::getSymbol(const std::string& name) {
+    void* symbol = dlsym(handle, name.c_str());
+    if(symbol == 0) spdlog::error("Native kernel '" + name + "' not found.");
+    return symbol;
+}
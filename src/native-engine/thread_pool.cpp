@@ -0,0 +1,93 @@
+#include <native-engine/thread_pool.hpp>
+
+#include <algorithm>
+
+using namespace unibox;
+
+ThreadPool::ThreadPool(uint32_t threadCount) {
+    if(threadCount == 0) threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+    queued = 0;
+    running = true;
+
+    // The calling thread works too, so one thread less is started.
+    for(uint32_t i = 0; i < threadCount; i++) workers.push_back(new Worker());
+    for(uint32_t i = 0; i+1 < threadCount; i++) threads.push_back(std::thread(&ThreadPool::run, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lck(sleepLock);
+        running = false;
+    }
+    wakeup.notify_all();
+    for(auto& thread : threads) thread.join();
+    for(auto worker : workers) delete worker;
+}
+
+uint32_t ThreadPool::getThreadCount() {
+    return workers.size();
+}
+
+bool ThreadPool::runTask(uint32_t worker) {
+    std::function<void()> task;
+    for(uint32_t i = 0; i < workers.size() && !task; i++) {
+        Worker* victim = workers[(worker+i) % workers.size()];
+        std::lock_guard lck(victim->lock);
+        if(victim->tasks.empty()) continue;
+        if(i == 0) {
+            task = std::move(victim->tasks.front());
+            victim->tasks.pop_front();
+        } else {
+            task = std::move(victim->tasks.back());
+            victim->tasks.pop_back();
+        }
+    }
+    if(!task) return false;
+    queued--;
+    task();
+    return true;
+}
+
+void ThreadPool::run(uint32_t worker) {
+    while(true) {
+        if(runTask(worker)) continue;
+        std::unique_lock lck(sleepLock);
+        wakeup.wait(lck, [this]() { return !running || queued > 0; });
+        if(!running) return;
+    }
+}
+
+void ThreadPool::parallelFor(uint32_t count, uint32_t grain, const std::function<void(uint32_t, uint32_t)>& body) {
+    if(count == 0) return;
+    // A few ranges per thread, so the ones finishing early have something to steal.
+    const uint32_t ranges = std::min<uint32_t>((count+grain-1)/std::max(grain, 1u), workers.size()*4);
+    if(ranges <= 1) {
+        body(0, count);
+        return;
+    }
+
+    std::atomic<uint32_t> remaining = ranges;
+    const uint32_t size = (count+ranges-1)/ranges;
+    for(uint32_t i = 0; i < ranges; i++) {
+        const uint32_t begin = i*size;
+        const uint32_t end = std::min(begin+size, count);
+        Worker* worker = workers[i % workers.size()];
+        {
+            std::lock_guard lck(worker->lock);
+            worker->tasks.push_back([&body, &remaining, begin, end]() {
+                if(begin < end) body(begin, end);
+                remaining--;
+            });
+        }
+        queued++;
+    }
+    {
+        std::lock_guard lck(sleepLock);
+    }
+    wakeup.notify_all();
+
+    const uint32_t self = workers.size()-1;
+    while(remaining > 0) {
+        if(!runTask(self)) std::this_thread::yield();
+    }
+}
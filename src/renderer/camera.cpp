@@ -8,6 +8,9 @@
 
 #include <vk-engine/engine.hpp>
 
+#include <limits>
+#include <algorithm>
+
 using namespace unibox;
 
 Camera* Camera::instance = 0;
@@ -53,6 +56,29 @@ glm::mat4 Camera::getProjectionMatrix() {
     return projection;
 }
 
+glm::vec4 Camera::getVisibleArea(float z) {
+    const float infinity = std::numeric_limits<float>::infinity();
+    glm::mat4 view;
+    getViewMatrix(&view);
+    const glm::mat4 inverse = glm::inverse(projection * view);
+
+    glm::vec4 area = glm::vec4(infinity, infinity, -infinity, -infinity);
+    for(int i = 0; i < 4; i++) {
+        // Ray through a corner of the screen from the near to the far plane, depth goes from 0 to 1.
+        const float x = (i & 1) ? 1.0f : -1.0f;
+        const float y = (i & 2) ? 1.0f : -1.0f;
+        const glm::vec4 nearPoint = inverse * glm::vec4(x, y, 0.0f, 1.0f);
+        const glm::vec4 farPoint = inverse * glm::vec4(x, y, 1.0f, 1.0f);
+        const glm::vec3 start = glm::vec3(nearPoint) / nearPoint.w;
+        const glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - start;
+        const float t = direction.z != 0.0f ? (z - start.z) / direction.z : -1.0f;
+        if(t < 0.0f) return glm::vec4(-infinity, -infinity, infinity, infinity);
+        const glm::vec3 point = start + direction*t;
+        area = glm::vec4(std::min(area.x, point.x), std::min(area.y, point.y), std::max(area.z, point.x), std::max(area.w, point.y));
+    }
+    return area;
+}
+
 void Camera::perspective(float fov, float aspect) {
     projection = glm::perspective(glm::radians(fov), aspect, 0.1f, 1000.0f);
     projection[1][0] = -projection[1][0];
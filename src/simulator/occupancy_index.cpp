@@ -0,0 +1,69 @@
+#include <simulator/occupancy_index.hpp>
+
+#include <cstring>
+
+using namespace unibox;
+
+OccupancyIndex::OccupancyIndex(uint sizeX, uint sizeY, uint sizeZ) {
+    info = GridInfo::create(sizeX, sizeY, sizeZ);
+
+    bricks = std::vector<uint*>(info.getBrickCount(), 0);
+    allocatedBricks = 0;
+}
+
+OccupancyIndex::~OccupancyIndex() {
+    for(auto brick : bricks) if(brick != 0) delete[] brick;
+}
+
+uint* OccupancyIndex::getBrick(uint x, uint y, uint z, bool allocate) {
+    const uint index = (x >> info.brickShift) + (y >> info.brickShift)*info.bricksX + (z >> info.brickShiftZ)*info.bricksX*info.bricksY;
+    uint* brick = bricks[index];
+    if(brick == 0 && allocate) {
+        const uint cellCount = info.getCellsPerBrick();
+        brick = new uint[cellCount];
+        memset(brick, 0, sizeof(uint)*cellCount);
+        bricks[index] = brick;
+        allocatedBricks++;
+    }
+    return brick;
+}
+
+uint OccupancyIndex::getBrickOffset(uint x, uint y, uint z) {
+    const uint mask = (1 << info.brickShift)-1;
+    const uint maskZ = (1 << info.brickShiftZ)-1;
+    return (x&mask) + ((y&mask) << info.brickShift) + ((z&maskZ) << (info.brickShift*2));
+}
+
+bool OccupancyIndex::inBounds(uint x, uint y, uint z) {
+    return x < info.sizeX && y < info.sizeY && z < info.sizeZ;
+}
+
+std::optional<uint> OccupancyIndex::get(uint x, uint y, uint z) {
+    if(!inBounds(x, y, z)) return std::nullopt;
+    uint* brick = getBrick(x, y, z, false);
+    if(brick == 0) return std::nullopt;
+    uint value = brick[getBrickOffset(x, y, z)];
+    if(value == 0) return std::nullopt;
+    return std::optional(value-1);
+}
+
+void OccupancyIndex::set(uint x, uint y, uint z, uint slot) {
+    if(!inBounds(x, y, z)) return;
+    getBrick(x, y, z, true)[getBrickOffset(x, y, z)] = slot+1;
+}
+
+void OccupancyIndex::erase(uint x, uint y, uint z) {
+    if(!inBounds(x, y, z)) return;
+    uint* brick = getBrick(x, y, z, false);
+    if(brick != 0) brick[getBrickOffset(x, y, z)] = 0;
+}
+
+void OccupancyIndex::clear() {
+    // Bricks are kept allocated, particles rarely travel far between two rebuilds.
+    const uint cellCount = info.getCellsPerBrick();
+    for(auto brick : bricks) if(brick != 0) memset(brick, 0, sizeof(uint)*cellCount);
+}
+
+size_t OccupancyIndex::getAllocatedBricks() {
+    return allocatedBricks;
+}
@@ -144,6 +144,13 @@ Particle::Particle(const std::string& particleDir) {
             if(densityJson->is_number()) properties.density = densityJson->get<float>();
             else spdlog::warn("Density of an element must be a number.");
         } else properties.density = 1;
+
+        auto emitsJson = propJson.find("emits");
+        properties.emits = false;
+        if(emitsJson != propJson.end()) {
+            if(emitsJson->is_boolean()) properties.emits = emitsJson->get<bool>();
+            else spdlog::warn("Emits property of an element must be a boolean.");
+        }
     }
 
     {
@@ -403,12 +410,50 @@ void Particle::fillSimPip(SimulationParticleInfoPacket& simPip) {
     simPip.state = properties.state | (properties.affectedByGravity << 2);
 }
 
-std::string Particle::constructSwitchCode() {
+std::string Particle::constructUpdateKernels() {
     std::string output;
     for(auto& particle : particles) {
         if(!particle.second.updateScript.has_value()) continue;
         const std::string& scriptStr = particle.second.updateScript.value();
         const std::string funcName = scriptStr.find(':') == std::string::npos ? scriptStr : scriptStr.substr(scriptStr.find(':')+1);
+        output.append("UPDATE_KERNELS(");
+        output.append(std::to_string(particle.second.typeId));
+        output.append(", ");
+        output.append(funcName);
+        output.append(")\n");
+    }
+    return output;
+}
+
+std::string Particle::constructUpdatedTypes() {
+    std::string output;
+    for(ushort type : getUpdatedTypes()) {
+        output.append("case ");
+        output.append(std::to_string(type));
+        output.append(":\n");
+    }
+    return output;
+}
+
+std::vector<ushort> Particle::getUpdatedTypes() {
+    std::vector<ushort> types;
+    for(auto& particle : particles) {
+        if(particle.second.updateScript.has_value()) types.push_back(particle.second.typeId);
+    }
+    return types;
+}
+
+std::string Particle::constructEmitSwitchCode() {
+    // Only particles declared as emitting in their properties go through the counting run.
+    std::string output;
+    for(auto& particle : particles) {
+        if(!particle.second.properties.emits) continue;
+        if(!particle.second.updateScript.has_value()) {
+            spdlog::warn("Particle '" + particle.first + "' emits particles but has no update script.");
+            continue;
+        }
+        const std::string& scriptStr = particle.second.updateScript.value();
+        const std::string funcName = scriptStr.find(':') == std::string::npos ? scriptStr : scriptStr.substr(scriptStr.find(':')+1);
         output.append("case ");
         output.append(std::to_string(particle.second.typeId));
         output.append(": ");
@@ -446,6 +491,11 @@ uint Particle::getParticleId(const std::string& name) {
     return getParticle(name).typeId;
 }
 
+std::string Particle::getParticleName(uint id) {
+    for(auto& particle : particles) if(particle.second.typeId == id) return particle.first;
+    return "";
+}
+
 std::string Particle::constructMeshSwitchCode() {
     std::string output;
     for(auto& particle : particles) {
@@ -6,6 +6,13 @@
 #include <glm/mat4x4.hpp>
 #include <util/finalizer.hpp>
 
+#include <cstring>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+#include <unistd.h>
+
 using namespace unibox;
 
 std::list<ParticleGrid*> ParticleGrid::grids = std::list<ParticleGrid*>();
@@ -14,166 +21,738 @@ Simulator* ParticleGrid::simulator = 0;
 MeshGenPipeline* ParticleGrid::meshGenerator = 0;
 
 GraphicsPipeline* ParticleGrid::pipeline = 0;
+GraphicsPipeline* ParticleGrid::imagePipeline = 0;
+
+Buffer* ParticleGrid::snapshotPool = 0;
+size_t ParticleGrid::snapshotPoolSize = 0;
+size_t ParticleGrid::snapshotPoolUsed = 0;
+Buffer* ParticleGrid::drawCommands = 0;
+size_t ParticleGrid::drawCommandCount = 0;
+
+glm::vec4 ParticleGrid::viewArea = glm::vec4(-std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity());
 
 std::mutex ParticleGrid::simLock = std::mutex();
 std::mutex ParticleGrid::meshGenLock = std::mutex();
 
+std::atomic<bool> ParticleGrid::frameRequested = true;
+std::function<void()> ParticleGrid::frameCallback = std::function<void()>();
+
 std::future<void> simInitSync;
+std::atomic<bool> simulatorReady = false;
 std::future<void> meshInitSync;
 std::future<void> pipelineCreatSync;
 
 ParticleGrid::ParticleGrid(uint width, uint height, uint length) :
-    gridBuffer(ClEngine::getInstance()->getContext(), CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, width*height*length*sizeof(GridPoint)) {
+    occupancy(width, height, length) {
     this->sizeX = width;
     this->sizeY = height;
     this->sizeZ = length;
 
     this->particleCount = 0;
-    this->particleBuffer = new cl::Buffer(ClEngine::getInstance()->getContext(), CL_MEM_READ_WRITE, sizeof(Voxel)*256);
-    cl::CommandQueue queue(ClEngine::getInstance()->getContext(), ClEngine::getInstance()->getDevice());
-    particles = (Voxel*)queue.enqueueMapBuffer(*this->particleBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, sizeof(Voxel)*256);
-    
+    this->slotCount = 0;
+    this->emitPlaced = 0;
+    for(int i = 0; i < 2; i++) {
+        snapshotOffset[i] = 0;
+        snapshotSize[i] = 0;
+        snapshotSlots[i] = 0;
+        snapshotImage[i] = false;
+        snapshotStale[i] = true;
+        for(int j = 0; j < 4; j++) snapshotArea[i][j] = 0;
+        snapshotLevel[i] = 0;
+        sharedSnapshots[i] = 0;
+        sharedTicks[i] = 0;
+        imageSets[i] = 0;
+        imageSetsStale[i] = true;
+    }
+    sharedMesh = false;
+    frontSnapshot = 0;
+    meshReadPending = false;
+    meshSlots = 0;
+    meshImage = false;
+    for(int i = 0; i < 4; i++) cullArea[i] = 0;
+    meshBufferTick = 0;
+    imageBufferTick = 0;
+    dirtyBlocksPending = false;
+    imageMode = false;
+    mergeMode = false;
+    meshMerged = false;
+    imageLevels = MeshGenPipeline::getImageLevels(width, height);
+    imageLevel = 0;
     for(int i = 0; i < 256; i++) freeIndices.push_back(i);
 
-    meshBuffer = new cl::Buffer(ClEngine::getInstance()->getContext(), CL_MEM_READ_WRITE, (sizeof(float)*4*2)*6*256);
-    meshBufferV = new Buffer((sizeof(float)*4*2)*6*256, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_SHARING_MODE_EXCLUSIVE, VMA_MEMORY_USAGE_CPU_TO_GPU);
-
     dirty = true;
+    meshDirty = false;
+    occupancyStale = false;
+    compactionPending = false;
+
+    gridPipeline = GridPipeline::create(*simulator, *meshGenerator, GridInfo::create(width, height, length));
+    gridPipeline->resize(256, 0);
+    // Both APIs have to be on the same device for the mesh to be shared, headless runs have no Vulkan engine at all.
+    Engine* engine = Engine::getInstance();
+    sharedMesh = engine != 0 && engine->supportsExternalMemory() && gridPipeline->supportsSharedSnapshots(engine->getDeviceUUID());
 
     grids.push_back(this);
 }
 
 ParticleGrid::~ParticleGrid() {
     grids.remove(this);
-    cl::CommandQueue queue(ClEngine::getInstance()->getContext(), ClEngine::getInstance()->getDevice());
-    queue.enqueueUnmapMemObject(*particleBuffer, particles);
-    delete particleBuffer;
-    delete meshBuffer;
-    delete meshBufferV;
-}
-
-uint ParticleGrid::allocateParticleIndex() {
-    if(freeIndices.size() == 0) {
-        size_t base = particleCount;
-        cl::Buffer* oldBuffer = this->particleBuffer;
-
-        cl::CommandQueue queue(ClEngine::getInstance()->getContext(), ClEngine::getInstance()->getDevice());
-
-        this->particleBuffer = new cl::Buffer(ClEngine::getInstance()->getContext(), CL_MEM_READ_WRITE, sizeof(Voxel)*(particleCount+256));
-        queue.enqueueUnmapMemObject(*oldBuffer, this->particles);
-        queue.enqueueCopyBuffer(*oldBuffer, *this->particleBuffer, 0, 0, sizeof(Voxel)*particleCount);
-        cl_int error;
-        this->particles = (Voxel*)queue.enqueueMapBuffer(*this->particleBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, sizeof(Voxel)*(particleCount+256), 0, 0, &error);
-        if(error != CL_SUCCESS) {
-            spdlog::error("OpenCL particle buffer mapping error: " + std::to_string(error));
-            return -1;
-        }
-
-        delete oldBuffer;
+    gridPipeline->waitRead();
+    if(meshReadPending && !sharedMesh) snapshotPool->unmap();
+    // Imported snapshots have to be dropped before their memory is freed.
+    gridPipeline->releaseSnapshots();
+    for(int i = 0; i < 2; i++) if(sharedSnapshots[i] != 0) delete sharedSnapshots[i];
+    delete gridPipeline;
+    // The parts of the pool are left unused until it is laid out again.
+}
 
-        for(int i = 0; i < 256; i++) freeIndices.push_back(i+base);
+bool ParticleGrid::growParticles(uint count) {
+    const size_t base = gridPipeline->getCapacity();
+    const size_t capacity = base + count;
+    {
+        // Snapshots are resized by the renderer, only a read from the old mesh has to finish.
+        std::lock_guard meshLck(meshGenLock);
+        gridPipeline->waitRead();
+        // The image survives the growth, its last changes still have to reach the snapshots.
+        collectDirtyBlocks(true);
+        if(!gridPipeline->resize(capacity, base)) return false;
+        // Nothing was generated into the new mesh yet, the renderer keeps drawing the front snapshot.
+        meshSlots = 0;
+        meshDirty = false;
+    }
+    for(uint i = 0; i < count; i++) freeIndices.push_back(i+base);
+    // Mesh records are kept per slot, the new mesh has to be generated whole.
+    meshBufferTick = 0;
+    dirty = true;
+    return true;
+}
 
-        meshGenLock.lock();
-        while(Engine::getInstance()->isRendering());
-        delete this->meshBuffer;
-        delete this->meshBufferV;
-        meshGenLock.unlock();
+bool ParticleGrid::allocateParticleIndex(uint& index) {
+    if(freeIndices.size() == 0 && !growParticles(256)) return false;
+    index = *freeIndices.begin();
+    freeIndices.pop_front();
+    if(index >= slotCount) {
+        slotCount = index+1;
+        gridPipeline->setEmitBase(slotCount);
+    }
+    return true;
+}
 
-        this->meshBuffer = new cl::Buffer(ClEngine::getInstance()->getContext(), CL_MEM_READ_WRITE, (sizeof(float)*4*2)*6*(particleCount+256));
-        this->meshBufferV = new Buffer((sizeof(float)*4*2)*6*(particleCount+256), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_SHARING_MODE_EXCLUSIVE, VMA_MEMORY_USAGE_CPU_TO_GPU);
+void ParticleGrid::syncParticles() {
+    gridPipeline->waitParticles();
+    applyDeviceChanges();
+    if(occupancyStale) {
+        rebuildOccupancy();
+        occupancyStale = false;
     }
-    uint index = *freeIndices.begin();
-    freeIndices.pop_front();
-    return index;
 }
 
-void ParticleGrid::addVoxel(const Voxel& voxel) {
+void ParticleGrid::applyDeviceChanges() {
+    if(compactionPending) applyCompaction();
+    applyEmission();
+}
+
+void ParticleGrid::applyEmission() {
+    // Only emissions which got their cell are particles, the slots of the others stay empty below the top
+    // and are counted as holes by the compaction.
+    const uint placed = gridPipeline->getEmitPlaced();
+    particleCount += placed - emitPlaced;
+    emitPlaced = placed;
+    // Slots from slotCount up to the top were taken by particles emitted on the device.
+    const uint top = gridPipeline->getEmitTop();
+    if(top <= slotCount) return;
+    const uint first = slotCount;
+    freeIndices.remove_if([first, top](uint slot) { return slot >= first && slot < top; });
+    slotCount = top;
+}
+
+void ParticleGrid::applyCompaction() {
+    // Live particles are packed at the front now, every slot after them is free.
+    const uint capacity = gridPipeline->getCapacity();
+    particleCount = gridPipeline->getCompactedCount();
+    slotCount = particleCount;
+    freeIndices.clear();
+    for(uint i = particleCount; i < capacity; i++) freeIndices.push_back(i);
+    compactionPending = false;
+}
+
+bool ParticleGrid::addVoxel(const Voxel& voxel) {
     std::lock_guard lck(simLock);
-    if(!isEmpty(static_cast<uint>(voxel.position[0]), static_cast<uint>(voxel.position[1]), static_cast<uint>(voxel.position[2]))) return;
-    uint index = allocateParticleIndex();
-    particles[index] = voxel;
+    syncParticles();
+    const uint x = static_cast<uint>(voxel.position[0]);
+    const uint y = static_cast<uint>(voxel.position[1]);
+    const uint z = static_cast<uint>(voxel.position[2]);
+    if(!occupancy.inBounds(x, y, z) || occupancy.get(x, y, z).has_value()) return true;
+    uint index;
+    if(!allocateParticleIndex(index)) return false;
+    storeVoxel(index, voxel);
+    occupancy.set(x, y, z, index);
+    wake(x, y, z);
     this->particleCount++;
     dirty = true;
+    return true;
 }
 
-void ParticleGrid::addVoxels(int x, int y, int z, const std::vector<Voxel>& voxels) {
+bool ParticleGrid::addVoxels(int x, int y, int z, const std::vector<Voxel>& voxels) {
     std::lock_guard lck(simLock);
+    syncParticles();
     for(int i = 0; i < voxels.size(); i++) {
         Voxel v = voxels[i];
         v.position[0] += x;
         v.position[1] += y;
         v.position[2] += z;
-        if(!isEmpty(static_cast<uint>(v.position[0]), static_cast<uint>(v.position[1]), static_cast<uint>(v.position[2]))) continue;
-        particles[allocateParticleIndex()] = v;
+        const uint vx = static_cast<uint>(v.position[0]);
+        const uint vy = static_cast<uint>(v.position[1]);
+        const uint vz = static_cast<uint>(v.position[2]);
+        if(!occupancy.inBounds(vx, vy, vz) || occupancy.get(vx, vy, vz).has_value()) continue;
+        uint index;
+        if(!allocateParticleIndex(index)) {
+            dirty = true;
+            return false;
+        }
+        storeVoxel(index, v);
+        occupancy.set(vx, vy, vz, index);
+        wake(vx, vy, vz);
         this->particleCount++;
     }
     dirty = true;
+    return true;
 }
 
 void ParticleGrid::eraseVoxel(uint x, uint y, uint z) {
-    for(int i = 0; i < particleCount; i++) {
-        if(static_cast<uint>(particles[i].position[0]) == x &&
-           static_cast<uint>(particles[i].position[1]) == y &&
-           static_cast<uint>(particles[i].position[2]) == z) {
-            particles[i] = {};
-            freeIndices.push_front(i);
-            particleCount--;
-            dirty = true;
-            return;
-        }
-    }
+    std::lock_guard lck(simLock);
+    syncParticles();
+    auto slot = occupancy.get(x, y, z);
+    if(!slot.has_value()) return;
+    gridPipeline->getParticles()[slot.value()] = {};
+    gridPipeline->getParticleData()[slot.value()] = {};
+    freeIndices.push_front(slot.value());
+    occupancy.erase(x, y, z);
+    wake(x, y, z);
+    particleCount--;
+    dirty = true;
 }
 
-std::optional<Voxel*> ParticleGrid::getVoxel(uint x, uint y, uint z) {
-    for(int i = 0; i < particleCount; i++) {
-        if(static_cast<uint>(particles[i].position[0]) == x &&
-           static_cast<uint>(particles[i].position[1]) == y &&
-           static_cast<uint>(particles[i].position[2]) == z) {
-            return std::optional(&particles[i]);
-        }
+std::optional<Voxel> ParticleGrid::getVoxel(uint x, uint y, uint z) {
+    std::lock_guard lck(simLock);
+    syncParticles();
+    auto slot = occupancy.get(x, y, z);
+    if(!slot.has_value()) return std::nullopt;
+    return std::optional(unpackVoxel(gridPipeline->getParticles()[slot.value()], gridPipeline->getParticleData()[slot.value()]));
+}
+
+std::vector<Voxel> ParticleGrid::getVoxels() {
+    std::lock_guard lck(simLock);
+    syncParticles();
+    std::vector<Voxel> voxels;
+    const uint capacity = gridPipeline->getCapacity();
+    for(uint i = 0; i < capacity; i++) {
+        if(gridPipeline->getParticles()[i].type == 0) continue;
+        voxels.push_back(unpackVoxel(gridPipeline->getParticles()[i], gridPipeline->getParticleData()[i]));
     }
-    return std::nullopt;
+    return voxels;
+}
+
+uint ParticleGrid::getParticleCount() {
+    std::lock_guard lck(simLock);
+    syncParticles();
+    return particleCount;
+}
+
+void ParticleGrid::storeVoxel(uint index, const Voxel& voxel) {
+    packVoxel(voxel, gridPipeline->getParticles()[index], gridPipeline->getParticleData()[index]);
 }
 
 bool ParticleGrid::isEmpty(uint x, uint y, uint z) {
-    for(int i = 0; i < particleCount; i++) {
-        if(static_cast<uint>(particles[i].position[0]) == x &&
-           static_cast<uint>(particles[i].position[1]) == y &&
-           static_cast<uint>(particles[i].position[2]) == z) {
-            return false;
+    std::lock_guard lck(simLock);
+    syncParticles();
+    return !occupancy.get(x, y, z).has_value();
+}
+
+void ParticleGrid::wake(uint x, uint y, uint z) {
+    gridPipeline->wake(x, y, z);
+}
+
+void ParticleGrid::setSortInterval(uint ticks) {
+    std::lock_guard lck(simLock);
+    gridPipeline->setSortInterval(ticks);
+}
+
+void ParticleGrid::setMoveResolution(MoveResolution resolution) {
+    std::lock_guard lck(simLock);
+    gridPipeline->setMoveResolution(resolution);
+}
+
+void ParticleGrid::finish() {
+    std::lock_guard lck(simLock);
+    gridPipeline->finish();
+}
+
+void ParticleGrid::setProfiling(bool enable) {
+    std::lock_guard lck(simLock);
+    gridPipeline->setProfiling(enable);
+}
+
+void ParticleGrid::collectProfile(std::map<std::string, double>& phases) {
+    std::lock_guard lck(simLock);
+    gridPipeline->collectProfile(phases);
+}
+
+uint ParticleGrid::getAwakeChunks() {
+    std::lock_guard lck(simLock);
+    return gridPipeline->getAwakeChunks();
+}
+
+uint ParticleGrid::getAsleepChunks() {
+    std::lock_guard lck(simLock);
+    return gridPipeline->getAsleepChunks();
+}
+
+void ParticleGrid::rebuildOccupancy() {
+    // Particles have moved on the device, re-insert every live slot. Slots freed
+    // on the host are zeroed so a type of 0 covers both them and dead particles.
+    occupancy.clear();
+    const uint capacity = gridPipeline->getCapacity();
+    const VoxelHot* particles = gridPipeline->getParticles();
+    for(uint i = 0; i < capacity; i++) {
+        const VoxelHot& voxel = particles[i];
+        if(voxel.type == 0) continue;
+        occupancy.set(voxel.position[0], voxel.position[1], voxel.position[2], i);
+    }
+}
+
+void ParticleGrid::updateMesh() {
+    std::lock_guard lck(simLock);
+    if(!dirty) return;
+    // Host edits have to reach the device before the mesh can be regenerated.
+    gridPipeline->releaseParticles();
+    {
+        std::lock_guard meshLck(meshGenLock);
+        generateMesh(gridPipeline->getCapacity());
+    }
+    gridPipeline->acquireParticles();
+    dirty = false;
+    requestFrame();
+}
+
+void ParticleGrid::updateRenderMode() {
+    // Only flat grids can be drawn as an image or merged, the mesh ignores z as well but keeps every particle.
+    if(sizeZ > 1) return;
+    const float fill = float(particleCount)/(sizeX*sizeY);
+    if(!mergeMode && fill > MERGE_ENTER_FILL) mergeMode = true;
+    else if(mergeMode && fill < MERGE_LEAVE_FILL) mergeMode = false;
+    const float pixels = getCellPixels();
+    if(!imageMode && (fill > IMAGE_ENTER_FILL || pixels < IMAGE_ENTER_PIXELS)) imageMode = true;
+    else if(imageMode && fill < IMAGE_LEAVE_FILL && pixels > IMAGE_LEAVE_PIXELS) imageMode = false;
+}
+
+float ParticleGrid::getCellPixels() {
+    Engine* engine = Engine::getInstance();
+    const float cells = viewArea.w - viewArea.y;
+    if(engine == 0 || !std::isfinite(cells) || cells <= 0.0f) return std::numeric_limits<float>::infinity();
+    return engine->getHeight() / cells;
+}
+
+void ParticleGrid::updateImageLevel() {
+    // The finest level whose cells still cover a pixel.
+    const float pixels = getCellPixels();
+    uint level = 0;
+    if(pixels < 1.0f) level = std::min((uint)std::ceil(std::log2(1.0f/pixels)), (uint)imageLevels.size()-1);
+    if(level == imageLevel) return;
+    imageLevel = level;
+    // Copied snapshots only hold the level they were read at.
+    if(meshImage && !sharedMesh) meshDirty = true;
+}
+
+size_t ParticleGrid::getImageSize() {
+    const ImageLevel& top = imageLevels.back();
+    return sizeof(uint)*(top.offset + top.width*top.height);
+}
+
+size_t ParticleGrid::getMeshSize() {
+    // Copied image snapshots hold a single level, the first one is the largest.
+    return meshImage ? sizeof(uint)*sizeX*sizeY : GridPipeline::getVisibleSize(meshSlots);
+}
+
+bool ParticleGrid::collectDirtyBlocks(bool wait) {
+    if(!dirtyBlocksPending) return true;
+    if(!gridPipeline->areDirtyBlocksReady(wait)) return false;
+    foldDirtyBlocks(gridPipeline->getDirtyBlocks());
+    dirtyBlocksPending = false;
+    return true;
+}
+
+void ParticleGrid::foldDirtyBlocks(const std::vector<uint>& blocks) {
+    for(int i = 0; i < 2; i++) {
+        std::vector<uint>& pending = snapshotDirty[i];
+        if(pending.size() < blocks.size()) pending.resize(blocks.size(), 0);
+        for(size_t j = 0; j < blocks.size(); j++) pending[j] |= blocks[j];
+    }
+}
+
+bool ParticleGrid::isSnapshotCurrent(uint snapshot) {
+    if(snapshotStale[snapshot] || snapshotImage[snapshot] != meshImage) return false;
+    // The visible part of the mesh changes with the cull area as well.
+    if(!meshImage && memcmp(snapshotArea[snapshot], cullArea, sizeof(cullArea)) != 0) return false;
+    if(meshImage && snapshotLevel[snapshot] != imageLevel) return false;
+    // Only the blocks of the drawn level matter for an image.
+    const std::vector<uint>& blocks = snapshotDirty[snapshot];
+    size_t first = 0, last = blocks.size()*32;
+    if(meshImage) {
+        const ImageLevel& level = imageLevels[imageLevel];
+        first = level.offset / MeshGenPipeline::DIRTY_BLOCK_SIZE;
+        last = std::min<size_t>(last, (level.offset + level.width*level.height + MeshGenPipeline::DIRTY_BLOCK_SIZE-1) / MeshGenPipeline::DIRTY_BLOCK_SIZE);
+    }
+    for(size_t i = first; i < last; i++) if(blocks[i/32] & (1u << (i%32))) return false;
+    return true;
+}
+
+bool ParticleGrid::updateCullArea() {
+    // Cells with quads reaching into the view, widened by the margin.
+    const float marginX = (viewArea.z - viewArea.x)*CULL_MARGIN;
+    const float marginY = (viewArea.w - viewArea.y)*CULL_MARGIN;
+    const float view[4] = { viewArea.x - 0.5f, viewArea.y - 0.5f, viewArea.z + 0.5f, viewArea.w + 0.5f };
+    const float wide[4] = { view[0] - marginX, view[1] - marginY, view[2] + marginX, view[3] + marginY };
+    auto toCell = [](float value, uint size) { return (uint)std::clamp(value, 0.0f, float(size-1)); };
+
+    const bool covered = cullArea[0] <= toCell(std::floor(view[0]), sizeX) && cullArea[1] <= toCell(std::floor(view[1]), sizeY)
+        && cullArea[2] >= toCell(std::ceil(view[2]), sizeX) && cullArea[3] >= toCell(std::ceil(view[3]), sizeY);
+    const uint area[4] = {
+        toCell(std::floor(wide[0]), sizeX), toCell(std::floor(wide[1]), sizeY),
+        toCell(std::ceil(wide[2]), sizeX), toCell(std::ceil(wide[3]), sizeY)
+    };
+    const float culledCells = float(cullArea[2]-cullArea[0]+1)*(cullArea[3]-cullArea[1]+1);
+    const float wideCells = float(area[2]-area[0]+1)*(area[3]-area[1]+1);
+    if(covered && culledCells <= wideCells*CULL_SHRINK) return false;
+    memcpy(cullArea, area, sizeof(cullArea));
+    return true;
+}
+
+bool ParticleGrid::generateMesh(uint capacity) {
+    updateRenderMode();
+    // Merged and plain records can't be patched into each other.
+    if(!imageMode && mergeMode != meshMerged) {
+        meshBufferTick = 0;
+        meshMerged = mergeMode;
+    }
+    // A merged mesh is built from the image, both have to see every change since the older of them.
+    const bool merged = !imageMode && mergeMode;
+    const uint sinceTick = imageMode ? imageBufferTick : (merged ? std::min(meshBufferTick, imageBufferTick) : meshBufferTick);
+    // Whatever the snapshots hold can't be patched after a full generation.
+    const bool full = sinceTick == 0;
+    // The dirty blocks of every generation are read into the same place.
+    collectDirtyBlocks(true);
+    // Shared images are generated straight into the back snapshot, shared meshes are only culled into it.
+    if(sharedMesh && imageMode && generateSharedMesh(capacity)) return true;
+    if(imageMode) {
+        if(!gridPipeline->generateImage(capacity, sinceTick)) return false;
+    } else if(merged) {
+        if(!gridPipeline->generateMergedMesh(capacity, sinceTick)) return false;
+    } else if(!gridPipeline->generateMesh(capacity, sinceTick)) return false;
+    updateBufferTicks(gridPipeline->getTick());
+    dirtyBlocksPending = !sharedMesh;
+    if(full) {
+        snapshotStale[0] = true;
+        snapshotStale[1] = true;
+    }
+    meshSlots = capacity;
+    meshImage = imageMode;
+    if(!meshImage) {
+        updateCullArea();
+        return cullMesh();
+    }
+    meshDirty = true;
+    return true;
+}
+
+void ParticleGrid::updateBufferTicks(uint tick) {
+    if(imageMode || mergeMode) imageBufferTick = tick;
+    if(!imageMode) meshBufferTick = tick;
+}
+
+bool ParticleGrid::cullMesh() {
+    if(sharedMesh && cullSharedMesh()) return true;
+    if(!gridPipeline->cullMesh(meshSlots, cullArea)) return false;
+    meshDirty = true;
+    return true;
+}
+
+bool ParticleGrid::prepareSharedSnapshot(uint snapshot, size_t size) {
+    if(sharedSnapshots[snapshot] != 0 && sharedSnapshots[snapshot]->getSize() >= size) return true;
+    // The snapshot might still be written to by the previous mesh generation.
+    gridPipeline->waitRead();
+    if(sharedSnapshots[snapshot] != 0) delete sharedSnapshots[snapshot];
+    sharedTicks[snapshot] = 0;
+    sharedSnapshots[snapshot] = new ExternalBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+    imageSetsStale[snapshot] = true;
+
+    const int fd = sharedSnapshots[snapshot]->exportMemory();
+    if(fd < 0) return false;
+    const bool imported = gridPipeline->importSnapshot(snapshot, fd, size);
+    close(fd);
+    return imported;
+}
+
+bool ParticleGrid::growSnapshot(uint snapshot, size_t size) {
+    const size_t partSize = (size + SNAPSHOT_ALIGNMENT-1) / SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT;
+    if(snapshotPoolUsed + partSize <= snapshotPoolSize) {
+        // The old part is left unused until the pool is laid out again.
+        snapshotOffset[snapshot] = snapshotPoolUsed;
+        snapshotSize[snapshot] = partSize;
+        snapshotPoolUsed += partSize;
+        imageSetsStale[snapshot] = true;
+        return true;
+    }
+    // Parts of the other grids move, none of them can have a read into the pool in flight.
+    for(auto& grid : grids) if(grid->meshReadPending && !grid->sharedMesh) return false;
+
+    snapshotSize[snapshot] = partSize;
+    size_t used = 0;
+    for(auto& grid : grids) if(!grid->sharedMesh) used += grid->snapshotSize[0] + grid->snapshotSize[1];
+    const size_t poolSize = std::max(used, snapshotPoolSize*2);
+    Buffer* pool = new Buffer(poolSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_SHARING_MODE_EXCLUSIVE, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+    // The parts are laid out again without the unused ones in between. Only the drawn snapshots are kept,
+    // the other ones are read whole the next time. The previous frame is done by now, the old pool isn't in use.
+    char* dst = (char*)pool->map();
+    const char* src = snapshotPool != 0 ? (const char*)snapshotPool->map() : 0;
+    size_t offset = 0;
+    for(auto& grid : grids) {
+        if(grid->sharedMesh) continue;
+        for(uint i = 0; i < 2; i++) {
+            const bool keep = src != 0 && i == grid->frontSnapshot && grid->snapshotSlots[i] != 0 && !(grid == this && i == snapshot);
+            if(keep) memcpy(dst + offset, src + grid->snapshotOffset[i], grid->snapshotSize[i]);
+            else grid->snapshotStale[i] = true;
+            grid->snapshotOffset[i] = offset;
+            grid->imageSetsStale[i] = true;
+            offset += grid->snapshotSize[i];
         }
     }
+    pool->unmap();
+    if(snapshotPool != 0) {
+        snapshotPool->unmap();
+        delete snapshotPool;
+    }
+    snapshotPool = pool;
+    snapshotPoolSize = poolSize;
+    snapshotPoolUsed = used;
+    return true;
+}
+
+void ParticleGrid::disableSharedMesh() {
+    spdlog::warn("Mesh sharing between OpenCL and Vulkan failed, falling back to copying the mesh.");
+    sharedMesh = false;
+    gridPipeline->releaseSnapshots();
+    meshReadPending = false;
+    // The front snapshot can still be drawn from.
+    vkDeviceWaitIdle(Engine::getInstance()->getDevice());
+    for(int i = 0; i < 2; i++) {
+        if(sharedSnapshots[i] != 0) delete sharedSnapshots[i];
+        sharedSnapshots[i] = 0;
+        snapshotSlots[i] = 0;
+        snapshotStale[i] = true;
+        imageSetsStale[i] = true;
+    }
+}
+
+bool ParticleGrid::generateSharedMesh(uint capacity) {
+    const uint back = 1-frontSnapshot;
+    // The back snapshot still holds the image before the last one, only what changed since is revisited.
+    if(!prepareSharedSnapshot(back, getImageSize()) || !gridPipeline->generateSharedImage(back, capacity, snapshotImage[back] ? sharedTicks[back] : 0)) {
+        disableSharedMesh();
+        return false;
+    }
+    // Nothing to read back, the snapshot is swapped in once the generation completes.
+    meshReadPending = true;
+    sharedTicks[back] = gridPipeline->getTick();
+    snapshotSlots[back] = capacity;
+    snapshotImage[back] = true;
+    meshSlots = capacity;
+    meshImage = true;
+    meshDirty = false;
     return true;
 }
 
-void ParticleGrid::render(VkCommandBuffer cmd) {
-    if(particleCount == 0) return;
-    if(dirty) {
-        meshGenLock.lock();
-        meshGenerator->generate(particleCount, *particleBuffer, *meshBuffer);
+bool ParticleGrid::cullSharedMesh() {
+    const uint back = 1-frontSnapshot;
+    if(!prepareSharedSnapshot(back, getMeshSize()) || !gridPipeline->cullSharedMesh(back, meshSlots, cullArea)) {
+        disableSharedMesh();
+        return false;
+    }
+    // Swapped in once the cull completes, the instance count never leaves the device.
+    meshReadPending = true;
+    snapshotSlots[back] = meshSlots;
+    snapshotImage[back] = false;
+    meshDirty = false;
+    return true;
+}
 
-        void* ptr = meshBufferV->map();
-        cl::CommandQueue queue(ClEngine::getInstance()->getContext(), ClEngine::getInstance()->getDevice());
-        queue.enqueueReadBuffer(*meshBuffer, CL_TRUE, 0, (sizeof(float)*4*2)*6*(particleCount), ptr);
-        meshBufferV->unmap();
+bool ParticleGrid::isMeshReadComplete() {
+    return gridPipeline->isReadComplete();
+}
+
+void ParticleGrid::startMeshRead() {
+    // Blocks of the last generation and the visible count of the last cull aren't known yet, the read is
+    // retried on the next frame.
+    if(!collectDirtyBlocks(false)) return;
+    if(!meshImage && !gridPipeline->isVisibleCountReady()) return;
+    if(isSnapshotCurrent(frontSnapshot)) {
+        // Nothing changed since the front snapshot was read, a static scene costs no copies.
+        meshDirty = false;
+        return;
+    }
+
+    const uint back = 1-frontSnapshot;
+    const size_t size = getMeshSize();
+    // An image snapshot holding something else than the drawn level of the last generation is read whole, otherwise
+    // only its dirty blocks. The visible part of the mesh is always read whole.
+    const ImageLevel& level = imageLevels[imageLevel];
+    bool whole = snapshotStale[back] || snapshotImage[back] != meshImage || (meshImage && snapshotLevel[back] != imageLevel);
+    if(snapshotSize[back] < size) {
+        // Retried on the next frame, meshDirty stays set.
+        if(!growSnapshot(back, size)) return;
+        whole = true;
+    }
+    const uint visible = gridPipeline->getVisibleCount();
+    std::vector<std::pair<size_t, size_t>> ranges;
+    // Ranges within the level, it starts on a block so they are whole blocks of it.
+    const size_t levelStart = sizeof(uint)*level.offset;
+    const size_t levelSize = sizeof(uint)*level.width*level.height;
+    if(!meshImage) ranges.push_back({ 0, GridPipeline::getVisibleSize(visible) });
+    else if(whole) ranges.push_back({ 0, levelSize });
+    else {
+        const size_t blockSize = MeshGenPipeline::DIRTY_BLOCK_SIZE*sizeof(uint);
+        const std::vector<uint>& blocks = snapshotDirty[back];
+        for(size_t i = levelStart/blockSize; i < blocks.size()*32 && i*blockSize < levelStart+levelSize; i++) {
+            if((blocks[i/32] & (1u << (i%32))) == 0) continue;
+            const size_t start = i*blockSize - levelStart;
+            const size_t end = std::min(start+blockSize, levelSize);
+            // Neighbouring blocks are merged into one copy.
+            if(!ranges.empty() && ranges.back().first+ranges.back().second == start) ranges.back().second = end-ranges.back().first;
+            else ranges.push_back({ start, end-start });
+        }
+    }
+    std::fill(snapshotDirty[back].begin(), snapshotDirty[back].end(), 0);
+    snapshotSlots[back] = meshSlots;
+    snapshotImage[back] = meshImage;
+    snapshotStale[back] = false;
+    snapshotLevel[back] = imageLevel;
+    memcpy(snapshotArea[back], cullArea, sizeof(cullArea));
+    meshDirty = false;
+    if(ranges.empty()) {
+        // Nothing to copy, the back snapshot is already current.
+        frontSnapshot = back;
+        return;
+    }
+
+    // The copies are in order, the snapshot is complete once the last one is.
+    char* ptr = (char*)snapshotPool->map() + snapshotOffset[back];
+    if(!gridPipeline->readMesh(ptr, meshImage, meshImage ? levelStart : 0, ranges)) {
+        snapshotPool->unmap();
+        // Whatever made it into the snapshot is unknown now.
+        snapshotStale[back] = true;
+        snapshotSlots[back] = 0;
+        meshDirty = true;
+        return;
+    }
+    meshReadPending = true;
+}
+
+void ParticleGrid::updateSnapshots() {
+    // The previous frame is done by now, so the back snapshot isn't in use by the device.
+    if(meshReadPending && isMeshReadComplete()) {
+        if(!sharedMesh) snapshotPool->unmap();
+        frontSnapshot = 1-frontSnapshot;
+        meshReadPending = false;
+    }
+    // The camera left the area the mesh was culled to, the simulation might not regenerate it any time soon.
+    // The cull shares the pipeline with the ticks, it only runs while no tick is being queued. Waiting for
+    // simLock here would deadlock, simulate takes meshGenLock while holding it. A running tick regenerates
+    // and culls the mesh on its own, otherwise the area is still uncovered on the next frame.
+    if(!meshImage && meshSlots > 0) {
+        std::unique_lock lck(simLock, std::try_to_lock);
+        if(lck.owns_lock() && updateCullArea()) cullMesh();
+        else if(!lck.owns_lock()) requestFrame();
+    }
+    updateImageLevel();
+    if(meshDirty && !meshReadPending) startMeshRead();
+    // The new mesh only gets shown by one of the next frames.
+    if(meshDirty || meshReadPending) requestFrame();
+}
+
+VkBuffer ParticleGrid::getFrontSnapshot() {
+    return sharedMesh ? sharedSnapshots[frontSnapshot]->getHandle() : snapshotPool->getHandle();
+}
+
+void ParticleGrid::renderMesh(VkCommandBuffer cmd) {
+    // Only shared snapshots are drawn on their own. The records follow the draw command, the instance count
+    // in it was written by the cull.
+    VkBuffer snapshot = getFrontSnapshot();
+    VkDeviceSize offsets[] = { sizeof(MeshDrawCommand) };
+    vkCmdBindVertexBuffers(cmd, 0, 1, &snapshot, offsets);
+    vkCmdDrawIndirect(cmd, snapshot, 0, 1, sizeof(MeshDrawCommand));
+}
 
-        dirty = false;
-        meshGenLock.unlock();
+void ParticleGrid::renderImage(VkCommandBuffer cmd) {
+    if(imageSets[frontSnapshot] == 0) imageSets[frontSnapshot] = imagePipeline->allocateSet(1);
+    if(imageSetsStale[frontSnapshot]) {
+        if(sharedMesh) imagePipeline->bindBufferToDescriptor(imageSets[frontSnapshot], 0, getFrontSnapshot(), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0, getImageSize());
+        else imagePipeline->bindBufferToDescriptor(imageSets[frontSnapshot], 0, getFrontSnapshot(), VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, snapshotOffset[frontSnapshot], snapshotSize[frontSnapshot]);
+        imageSetsStale[frontSnapshot] = false;
     }
 
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(cmd, 0, 1, &meshBufferV->getHandle(), offsets);
-    vkCmdDraw(cmd, particleCount*6, 1, 0, 0);
+    // The whole grid is a single quad, the fragment shader looks the cells up in the level of the snapshot.
+    const uint level = sharedMesh ? imageLevel : snapshotLevel[frontSnapshot];
+    const uint size[4] = { sizeX, sizeY, level, sharedMesh ? imageLevels[level].offset : 0 };
+    VkDescriptorSet sets[] = { imagePipeline->getDescriptorSet()[0], imageSets[frontSnapshot] };
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, imagePipeline->getHandle());
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, imagePipeline->getLayout(), 0, 2, sets, 0, 0);
+    vkCmdPushConstants(cmd, imagePipeline->getLayout(), VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(size), size);
+    vkCmdDraw(cmd, 6, 1, 0, 0);
 }
 
-void ParticleGrid::simulate() {
-    if(particleCount == 0) return;
+void ParticleGrid::simulate(uint steps) {
+    if(particleCount == 0 || steps == 0) return;
     std::lock_guard lck(simLock);
-    cl::CommandQueue queue(ClEngine::getInstance()->getContext(), ClEngine::getInstance()->getDevice());
-    queue.enqueueUnmapMemObject(*particleBuffer, particles);
-    simulator->simulate(sizeX, sizeY, sizeZ, particleCount, gridBuffer, *particleBuffer);
-    queue.enqueueMapBuffer(*particleBuffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, sizeof(Voxel)*(particleCount/256+(particleCount%256==0?0:1))*256);
-    dirty = true;
+    // Waiting for the previous tick keeps the simulation thread from queueing ticks faster than the device runs them.
+    gridPipeline->waitParticles();
+    applyDeviceChanges();
+    // Emitted particles need free slots on the device, growing the storage is the only time the host waits in here.
+    const uint requiredSpace = gridPipeline->getRequiredSpace(gridPipeline->getCapacity(), steps);
+    if(requiredSpace > 0) {
+        syncParticles();
+        growParticles(requiredSpace);
+    }
+    gridPipeline->releaseParticles();
+    // Every brick touched on the host is a good lower bound for the device brick pool.
+    gridPipeline->reserveBricks(occupancy.getAllocatedBricks());
+    // Slots freed on the host below slotCount are holes as well.
+    const uint hostHoles = slotCount - particleCount;
+    // Kernels run over the whole capacity, particles emitted on the device can be anywhere past slotCount.
+    const uint capacity = gridPipeline->getCapacity();
+    if(!compactionPending) {
+        // Sorting leaves the dead slots at the back, so it doubles as a compaction.
+        bool reordered = false;
+        if(gridPipeline->needsSort()) reordered = gridPipeline->sort(capacity);
+        else if(gridPipeline->needsCompaction(slotCount, hostHoles)) reordered = gridPipeline->compact(capacity);
+        if(reordered) {
+            compactionPending = true;
+            // The slots of the mesh records moved as well.
+            meshBufferTick = 0;
+        }
+    }
+    // Ticks of a batch are chained on the device only, the host sees the particles again after the last one.
+    bool simulated = true;
+    for(uint i = 0; i < steps && simulated; i++) simulated = gridPipeline->simulate(capacity);
+    if(simulated) {
+        std::lock_guard meshLck(meshGenLock);
+        generateMesh(capacity);
+    }
+    // The counters lag a tick behind on the device, the tick after the last change still sees its chunks awake.
+    if(gridPipeline->getAwakeChunks() > 0) requestFrame();
+    // The particles are handed back asynchronously, the host only waits for them once it touches them again.
+    gridPipeline->acquireParticles();
+    occupancyStale = true;
+    dirty = false;
 }
 
 void ParticleGrid::init(Camera& camera) {
@@ -182,18 +761,11 @@ void ParticleGrid::init(Camera& camera) {
         return;
     }
     Finalizer::addCallback([](){ glslang::FinalizeProcess(); });
-    simInitSync = std::async(std::launch::async, [](){
-        simulator = new Simulator();
-        simulator->createSimulationShader();
-        simulator->createSimulationInformation();
-        Finalizer::addCallback([](){ delete simulator; });
-    });
-    meshInitSync = std::async(std::launch::async, [](){
-        meshGenerator = new MeshGenPipeline();
-        meshGenerator->createMeshGenerationShader();
-        meshGenerator->createMeshGenerationInformation();
-        Finalizer::addCallback([](){ delete meshGenerator; });
+    Finalizer::addCallback([](){
+        if(snapshotPool != 0) delete snapshotPool;
+        if(drawCommands != 0) delete drawCommands;
     });
+    initCompute();
     pipelineCreatSync = std::async(std::launch::async, [&camera](){
         Shader vert = Shader(VK_SHADER_STAGE_VERTEX_BIT, "main");
         if(!vert.addCode("shaders/default/vertex.spv")) return;
@@ -204,9 +776,10 @@ void ParticleGrid::init(Camera& camera) {
         pipeline->addShader(&vert);
         pipeline->addShader(&frag);
 
-        int bind = pipeline->addBinding(sizeof(float)*8, VK_VERTEX_INPUT_RATE_VERTEX);
-        pipeline->addAttribute(bind, 0, 0, VK_FORMAT_R32G32B32A32_SFLOAT);
-        pipeline->addAttribute(bind, 1, sizeof(float)*4, VK_FORMAT_R32G32B32A32_SFLOAT);
+        int bind = pipeline->addBinding(sizeof(MeshInstance), VK_VERTEX_INPUT_RATE_INSTANCE);
+        pipeline->addAttribute(bind, 0, offsetof(MeshInstance, position), VK_FORMAT_R16G16_UINT);
+        pipeline->addAttribute(bind, 1, offsetof(MeshInstance, color), VK_FORMAT_R8G8B8A8_UNORM);
+        pipeline->addAttribute(bind, 2, offsetof(MeshInstance, size), VK_FORMAT_R16G16_UINT);
 
         pipeline->addDescriptors(0, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT);
 
@@ -215,18 +788,131 @@ void ParticleGrid::init(Camera& camera) {
         })) return;
         pipeline->bindBufferToDescriptor(0, 0, camera.getBuffer().getHandle(), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, sizeof(glm::mat4)*2);
         Finalizer::addCallback([](){ delete pipeline; });
+
+        Shader imageVert = Shader(VK_SHADER_STAGE_VERTEX_BIT, "main");
+        if(!imageVert.addCode("shaders/grid/vertex.spv")) return;
+        Shader imageFrag = Shader(VK_SHADER_STAGE_FRAGMENT_BIT, "main");
+        if(!imageFrag.addCode("shaders/grid/fragment.spv")) return;
+
+        imagePipeline = new GraphicsPipeline();
+        imagePipeline->addShader(&imageVert);
+        imagePipeline->addShader(&imageFrag);
+
+        imagePipeline->addDescriptors(0, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT);
+        imagePipeline->addDescriptors(1, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT);
+        imagePipeline->addPushConstant(0, sizeof(uint)*4, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+        // Cells of the coarser levels are only partly covered.
+        imagePipeline->enableAlphaBlend();
+
+        if(!imagePipeline->assemble({ 1280, 720 }, [](VkDescriptorSetLayout layout) {
+            return Engine::getInstance()->allocate_descriptor_set(layout);
+        })) return;
+        imagePipeline->bindBufferToDescriptor(0, 0, camera.getBuffer().getHandle(), VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, sizeof(glm::mat4)*2);
+        Finalizer::addCallback([](){ delete imagePipeline; });
+    });
+}
+
+void ParticleGrid::initCompute() {
+    simInitSync = std::async(std::launch::async, [](){
+        simulator = new Simulator();
+        simulatorReady = simulator->createSimulationShader();
+        simulator->createSimulationInformation();
+        Finalizer::addCallback([](){ delete simulator; });
+    });
+    meshInitSync = std::async(std::launch::async, [](){
+        meshGenerator = new MeshGenPipeline();
+        meshGenerator->createMeshGenerationShader();
+        meshGenerator->createMeshGenerationInformation();
+        Finalizer::addCallback([](){ delete meshGenerator; });
     });
 }
 
-void ParticleGrid::waitInitComplete() {
+bool ParticleGrid::waitInitComplete() {
     simInitSync.wait();
     meshInitSync.wait();
-    pipelineCreatSync.wait();
+    if(pipelineCreatSync.valid()) pipelineCreatSync.wait();
+    return simulatorReady;
+}
+
+void ParticleGrid::requestFrame() {
+    frameRequested = true;
+    if(frameCallback) frameCallback();
+}
+
+void ParticleGrid::setFrameCallback(const std::function<void()>& callback) {
+    frameCallback = callback;
+}
+
+bool ParticleGrid::takeFrameRequest() {
+    return frameRequested.exchange(false);
 }
 
 void ParticleGrid::renderAll(VkCommandBuffer cmd) {
-    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->getHandle());
+    std::lock_guard meshLck(meshGenLock);
+    // Grids are drawn at their cell coordinates on the z = 0 plane.
+    Camera* camera = Camera::getInstance();
+    if(camera != 0) viewArea = camera->getVisibleArea(0.0f);
+    for(auto& grid : grids) grid->updateSnapshots();
+
+    // Every mesh is drawn with the pipeline bound once, the host doesn't know how many instances any of them has.
+    std::vector<ParticleGrid*> pooled;
+    std::vector<ParticleGrid*> shared;
+    for(auto& grid : grids) {
+        const uint front = grid->frontSnapshot;
+        if(grid->snapshotSlots[front] == 0 || grid->snapshotImage[front]) continue;
+        if(grid->sharedMesh) shared.push_back(grid);
+        else pooled.push_back(grid);
+    }
+    if(!pooled.empty() || !shared.empty()) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->getHandle());
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->getLayout(), 0, 1, pipeline->getDescriptorSet(), 0, 0);
+    }
+    if(!pooled.empty()) {
+        if(drawCommandCount < pooled.size()) {
+            if(drawCommands != 0) delete drawCommands;
+            drawCommands = new Buffer(sizeof(MeshDrawCommand)*pooled.size(), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_SHARING_MODE_EXCLUSIVE, VMA_MEMORY_USAGE_CPU_TO_GPU);
+            drawCommandCount = pooled.size();
+        }
+        // The commands in front of the snapshots are gathered into one table. The host only moves them, the instance
+        // counts in them were written by the culls. With the pool bound past its first command, the records of a
+        // snapshot start at the instance its offset points to.
+        const bool multiDraw = Engine::getInstance()->supportsMultiDraw();
+        const char* pool = (const char*)snapshotPool->map();
+        MeshDrawCommand* commands = (MeshDrawCommand*)drawCommands->map();
+        for(size_t i = 0; i < pooled.size(); i++) {
+            const size_t offset = pooled[i]->snapshotOffset[pooled[i]->frontSnapshot];
+            memcpy(&commands[i], pool + offset, sizeof(MeshDrawCommand));
+            commands[i].firstInstance = multiDraw ? offset/sizeof(MeshInstance) : 0;
+        }
+        drawCommands->unmap();
+        snapshotPool->unmap();
+
+        if(multiDraw) {
+            VkDeviceSize offsets[] = { sizeof(MeshDrawCommand) };
+            vkCmdBindVertexBuffers(cmd, 0, 1, &snapshotPool->getHandle(), offsets);
+            vkCmdDrawIndirect(cmd, drawCommands->getHandle(), 0, pooled.size(), sizeof(MeshDrawCommand));
+        } else {
+            // Every snapshot is bound on its own, still without the host knowing its instance count.
+            for(size_t i = 0; i < pooled.size(); i++) {
+                VkDeviceSize offsets[] = { pooled[i]->snapshotOffset[pooled[i]->frontSnapshot] + sizeof(MeshDrawCommand) };
+                vkCmdBindVertexBuffers(cmd, 0, 1, &snapshotPool->getHandle(), offsets);
+                vkCmdDrawIndirect(cmd, drawCommands->getHandle(), i*sizeof(MeshDrawCommand), 1, sizeof(MeshDrawCommand));
+            }
+        }
+    }
+    // Shared snapshots are buffers of their own which OpenCL writes into, each of them is drawn separately.
+    for(auto& grid : shared) grid->renderMesh(cmd);
+    // Images bind their own snapshot.
+    for(auto& grid : grids) {
+        const uint front = grid->frontSnapshot;
+        if(grid->snapshotSlots[front] != 0 && grid->snapshotImage[front]) grid->renderImage(cmd);
+    }
+}
+
+void ParticleGrid::simulateAll(uint steps) {
+    for(auto& grid : grids) grid->simulate(steps);
+}
 
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->getLayout(), 0, 1, pipeline->getDescriptorSet(), 0, 0);
-    for(auto& grid : grids) grid->render(cmd);
+void ParticleGrid::updateMeshAll() {
+    for(auto& grid : grids) grid->updateMesh();
 }
@@ -0,0 +1,134 @@
+#include <simulator/simulation_thread.hpp>
+
+#include <simulator/particle_grid.hpp>
+
+#include <chrono>
+
+using namespace unibox;
+
+SimulationThread::SimulationThread(double tickRate) {
+    this->tickRate = tickRate;
+    this->speed = 1.0;
+    this->maxCatchUp = 4;
+    this->running = false;
+    this->paused = false;
+    this->pendingSteps = 0;
+    this->tickCount = 0;
+}
+
+SimulationThread::~SimulationThread() {
+    stop();
+}
+
+void SimulationThread::start() {
+    std::lock_guard lck(lock);
+    if(running) return;
+    running = true;
+    thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop() {
+    {
+        std::lock_guard lck(lock);
+        if(!running) return;
+        running = false;
+    }
+    wakeup.notify_all();
+    thread.join();
+}
+
+void SimulationThread::run() {
+    using clock = std::chrono::steady_clock;
+    auto previous = clock::now();
+    double accumulator = 0;
+
+    std::unique_lock lck(lock);
+    while(running) {
+        uint32_t ticks = 0;
+        if(paused) {
+            ticks = pendingSteps;
+            pendingSteps = 0;
+            accumulator = 0;
+            previous = clock::now();
+        } else {
+            const auto now = clock::now();
+            accumulator += std::chrono::duration<double>(now - previous).count() * tickRate * speed;
+            previous = now;
+            ticks = static_cast<uint32_t>(accumulator);
+            if(ticks > maxCatchUp) {
+                // Too far behind, running every missed tick would only make it worse.
+                ticks = maxCatchUp;
+                accumulator = 0;
+            } else accumulator -= ticks;
+        }
+
+        lck.unlock();
+        // Catching up and fast forwarding run as one batch, only the last tick gets drawn anyway.
+        if(ticks > 0) ParticleGrid::simulateAll(ticks);
+        // Edits made while nothing was simulated still have to show up.
+        else ParticleGrid::updateMeshAll();
+        lck.lock();
+        tickCount += ticks;
+
+        if(ticks > 0 && !paused) continue;
+        // Sleep until the next tick is due or something changes.
+        const double rate = tickRate * speed;
+        const auto wait = paused || rate <= 0 ? std::chrono::duration<double>(0.01) : std::chrono::duration<double>((1.0 - accumulator) / rate);
+        wakeup.wait_for(lck, std::chrono::duration_cast<std::chrono::microseconds>(wait), [this]() { return !running || (paused && pendingSteps > 0); });
+    }
+}
+
+void SimulationThread::setTickRate(double ticksPerSecond) {
+    std::lock_guard lck(lock);
+    tickRate = ticksPerSecond;
+    wakeup.notify_all();
+}
+
+double SimulationThread::getTickRate() {
+    std::lock_guard lck(lock);
+    return tickRate;
+}
+
+void SimulationThread::setSpeed(double multiplier) {
+    std::lock_guard lck(lock);
+    speed = multiplier;
+    wakeup.notify_all();
+}
+
+double SimulationThread::getSpeed() {
+    std::lock_guard lck(lock);
+    return speed;
+}
+
+void SimulationThread::setMaxCatchUp(uint32_t ticks) {
+    std::lock_guard lck(lock);
+    maxCatchUp = ticks;
+}
+
+void SimulationThread::pause() {
+    std::lock_guard lck(lock);
+    paused = true;
+}
+
+void SimulationThread::resume() {
+    std::lock_guard lck(lock);
+    paused = false;
+    wakeup.notify_all();
+}
+
+bool SimulationThread::isPaused() {
+    std::lock_guard lck(lock);
+    return paused;
+}
+
+void SimulationThread::step(uint32_t ticks) {
+    std::lock_guard lck(lock);
+    if(!paused) return;
+    pendingSteps += ticks;
+    wakeup.notify_all();
+}
+
+uint64_t SimulationThread::getTickCount() {
+    std::lock_guard lck(lock);
+    return tickCount;
+}
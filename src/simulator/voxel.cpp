@@ -0,0 +1,96 @@
+#include <simulator/voxel.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+using namespace unibox;
+
+static unsigned short floatToHalf(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const int exponent = ((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+
+    // NaN keeps the quiet bit set so dropping the low payload bits never turns it into infinity.
+    if(((bits >> 23) & 0xFF) == 0xFF) return sign | 0x7C00 | (mantissa != 0 ? 0x200 | (mantissa >> 13) : 0);
+    if(exponent >= 31) return sign | 0x7C00;
+
+    uint32_t result;
+    uint32_t shift;
+    if(exponent <= 0) {
+        // Subnormal or too small for a half.
+        if(exponent < -10) return sign;
+        mantissa |= 0x800000;
+        shift = 14 - exponent;
+        result = mantissa >> shift;
+    } else {
+        shift = 13;
+        result = (exponent << 10) | (mantissa >> shift);
+    }
+    // Round to nearest even, a mantissa carry moves into the exponent and the largest half rounds up to infinity.
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t halfway = 1u << (shift - 1);
+    if(rest > halfway || (rest == halfway && (result & 1))) result++;
+    return sign | result;
+}
+
+static float halfToFloat(unsigned short value) {
+    const uint32_t sign = (value & 0x8000) << 16;
+    int exponent = (value >> 10) & 0x1F;
+    uint32_t mantissa = value & 0x3FF;
+
+    uint32_t bits;
+    if(exponent == 0x1F) bits = sign | 0x7F800000 | (mantissa << 13);
+    else if(exponent != 0) bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+    else if(mantissa == 0) bits = sign;
+    else {
+        // Normalize the subnormal.
+        exponent = 1;
+        while((mantissa & 0x400) == 0) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | ((exponent - 15 + 127) << 23) | ((mantissa & 0x3FF) << 13);
+    }
+
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+void unibox::packVoxel(const Voxel& voxel, VoxelHot& hot, VoxelCold& cold) {
+    hot.type = voxel.type;
+    hot.stype = voxel.stype;
+    hot.padding = 0;
+    hot.state = voxel.state;
+    for(int i = 0; i < 3; i++) {
+        const unsigned int cell = static_cast<unsigned int>(voxel.position[i]);
+        hot.position[i] = cell;
+        cold.subPosition[i] = static_cast<unsigned short>(std::clamp((voxel.position[i] - cell)*65536.0f, 0.0f, 65535.0f));
+        cold.velocity[i] = voxel.velocity[i];
+    }
+    for(int i = 0; i < 4; i++) {
+        cold.paintColor[i] = static_cast<unsigned char>(std::clamp(voxel.paintColor[i], 0.0f, 1.0f)*255.0f + 0.5f);
+        cold.data[i] = voxel.data[i];
+    }
+    cold.temperature = floatToHalf(voxel.temperature);
+}
+
+Voxel unibox::unpackVoxel(const VoxelHot& hot, const VoxelCold& cold) {
+    Voxel voxel;
+    voxel.type = hot.type;
+    voxel.stype = hot.stype;
+    voxel.state = hot.state;
+    for(int i = 0; i < 3; i++) {
+        voxel.position[i] = hot.position[i] + cold.subPosition[i]/65536.0f;
+        voxel.velocity[i] = cold.velocity[i];
+    }
+    for(int i = 0; i < 4; i++) {
+        voxel.paintColor[i] = cold.paintColor[i]/255.0f;
+        voxel.data[i] = cold.data[i];
+    }
+    voxel.temperature = halfToFloat(cold.temperature);
+    return voxel;
+}
@@ -2,14 +2,17 @@
 
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+
 using namespace unibox;
 
 SaveFile::SaveFile(const std::string& file) {
     valid = false;
     fileStream = std::ifstream(file, std::ios::binary);
-    char magic[4];
+    char magic[4] = {};
     fileStream.read(magic, 4);
-    if(magic[0] == 'U' &&
+    if(fileStream.good() &&
+       magic[0] == 'U' &&
        magic[1] == 'N' &&
        magic[2] == 'B' &&
        magic[3] == 'X') {
@@ -19,13 +22,13 @@ SaveFile::SaveFile(const std::string& file) {
             fileStream.read((char*)&strLen, 1);
             char name[strLen];
             fileStream.read(name, strLen);
-            this->name = name;
+            this->name = std::string(name, strLen);
         } {
             uint16_t descLen;
             fileStream.read((char*)&descLen, 2);
             char description[descLen];
             fileStream.read(description, descLen);
-            this->description = description;
+            this->description = std::string(description, descLen);
         } {
             uint32_t data[3];
             fileStream.read((char*)data, sizeof(uint32_t)*3);
@@ -33,7 +36,7 @@ SaveFile::SaveFile(const std::string& file) {
             sizeY = data[1];
             sizeZ = data[2];
         }
-        valid = true;
+        valid = fileStream.good();
     }
 }
 
@@ -41,9 +44,9 @@ SaveFile::~SaveFile() {
 
 }
 
-void SaveFile::particleReadVersion1() {
+bool SaveFile::particleReadVersion1() {
     {
-        uint16_t mappingsLen;
+        uint16_t mappingsLen = 0;
         fileStream.read((char*)&mappingsLen, 2);
         for(int i = 0; i < mappingsLen; i++) {
             uint8_t nameLen;
@@ -54,10 +57,11 @@ void SaveFile::particleReadVersion1() {
 
             uint16_t id;
             fileStream.read((char*)&id, 2);
+            if(!fileStream.good()) break;
             mappings.insert({ id, Particle::getParticleId(name) });
         }
     } {
-        uint32_t particleCount;
+        uint32_t particleCount = 0;
         fileStream.read((char*)&particleCount, 4);
         for(uint32_t i = 0; i < particleCount; i++) {
             uint8_t flags;
@@ -95,16 +99,24 @@ void SaveFile::particleReadVersion1() {
                 voxel.paintColor[3] = colors[3]/255.0;
             }
 
+            if(!fileStream.good()) break;
             particles.push_back(voxel);
         }
     }
+    const bool complete = fileStream.good();
     fileStream.close();
+    if(!complete) spdlog::error("Particle file is cut short.");
+    return complete;
 }
 
-void SaveFile::readParticles() {
+bool SaveFile::readParticles() {
+    if(!valid) {
+        spdlog::error("Not a particle file.");
+        return false;
+    }
     switch(version) {
-        case 1: particleReadVersion1(); break;
-        default: spdlog::error("Unknown particle file version."); break;
+        case 1: return particleReadVersion1();
+        default: spdlog::error("Unknown particle file version."); return false;
     }
 }
 
@@ -118,4 +130,64 @@ uint32_t SaveFile::getSizeY() {
 
 uint32_t SaveFile::getSizeZ() {
     return sizeZ;
-}
\ No newline at end of file
+}
+
+bool SaveFile::write(const std::string& file, const std::string& name, const std::string& description, uint32_t sizeX, uint32_t sizeY, uint32_t sizeZ, const std::vector<Voxel>& particles) {
+    std::ofstream stream = std::ofstream(file, std::ios::binary);
+    if(!stream.is_open()) {
+        spdlog::error("Could not open " + file + " for writing.");
+        return false;
+    }
+
+    stream.write("UNBX", 4);
+    const uint8_t version = 1;
+    stream.write((const char*)&version, 1);
+    {
+        const uint8_t nameLen = std::min<size_t>(name.size(), 255);
+        stream.write((const char*)&nameLen, 1);
+        stream.write(name.data(), nameLen);
+        const uint16_t descLen = std::min<size_t>(description.size(), 65535);
+        stream.write((const char*)&descLen, 2);
+        stream.write(description.data(), descLen);
+        const uint32_t size[3] = { sizeX, sizeY, sizeZ };
+        stream.write((const char*)size, sizeof(size));
+    } {
+        // Only the types which are used get a mapping, the ids are the ones of this session.
+        std::vector<uint16_t> types;
+        for(auto& voxel : particles) {
+            if(voxel.type != 0 && std::find(types.begin(), types.end(), voxel.type) == types.end()) types.push_back(voxel.type);
+            if(voxel.stype != 0 && std::find(types.begin(), types.end(), voxel.stype) == types.end()) types.push_back(voxel.stype);
+        }
+        const uint16_t mappingsLen = types.size();
+        stream.write((const char*)&mappingsLen, 2);
+        for(uint16_t id : types) {
+            const std::string typeName = Particle::getParticleName(id);
+            const uint8_t nameLen = std::min<size_t>(typeName.size(), 255);
+            stream.write((const char*)&nameLen, 1);
+            stream.write(typeName.data(), nameLen);
+            stream.write((const char*)&id, 2);
+        }
+    } {
+        uint32_t particleCount = 0;
+        for(auto& voxel : particles) if(voxel.type != 0) particleCount++;
+        stream.write((const char*)&particleCount, 4);
+        for(auto& voxel : particles) {
+            if(voxel.type == 0) continue;
+            // Velocity, data and paint are always written, the reader doesn't care.
+            const uint8_t flags = 0x07;
+            stream.write((const char*)&flags, 1);
+            stream.write((const char*)&voxel.type, 2);
+            stream.write((const char*)&voxel.temperature, sizeof(float));
+            const uint32_t position[3] = { (uint32_t)voxel.position[0], (uint32_t)voxel.position[1], (uint32_t)voxel.position[2] };
+            stream.write((const char*)position, sizeof(position));
+
+            stream.write((const char*)&voxel.velocity, sizeof(voxel.velocity));
+            stream.write((const char*)&voxel.stype, 2);
+            stream.write((const char*)&voxel.data, sizeof(voxel.data));
+            uint8_t colors[4];
+            for(int i = 0; i < 4; i++) colors[i] = std::clamp(voxel.paintColor[i], 0.0f, 1.0f)*255.0f + 0.5f;
+            stream.write((const char*)colors, sizeof(colors));
+        }
+    }
+    return stream.good();
+}
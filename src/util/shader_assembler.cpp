@@ -3,12 +3,16 @@
 #include <istream>
 #include <fstream>
 #include <sstream>
+#include <filesystem>
+#include <iomanip>
 
 #include <spdlog/spdlog.h>
 #include <glslang/SPIRV/GlslangToSpv.h>
 
 using namespace unibox;
 
+std::string ShaderAssembler::programCacheDirectory = "cache/programs";
+
 ShaderAssembler::ShaderAssembler(const std::string& baseFile) {
     std::ifstream fileStream = std::ifstream(baseFile, std::ios::binary);
     std::stringstream fileString;
@@ -89,6 +93,12 @@ std::vector<uint32_t>& ShaderAssembler::compile(EShLanguage language) {
 }
 
 cl::Program* ShaderAssembler::compile(const cl::Context& context, const cl::Device& device) {
+	const std::string cachePath = programCacheDirectory.empty() ? "" : programCacheDirectory + "/" + getProgramCacheKey(device) + ".bin";
+	if(!cachePath.empty()) {
+		cl::Program* cached = loadCachedProgram(context, device, cachePath);
+		if(cached != 0) return cached;
+	}
+
 	cl::Program::Sources source(1, std::make_pair(code.c_str(), code.size()+1));
 	cl::Program* program = new cl::Program(context, source);
 	
@@ -99,9 +109,98 @@ cl::Program* ShaderAssembler::compile(const cl::Context& context, const cl::Devi
 		return 0;
 	}
 
+	if(!cachePath.empty()) storeCachedProgram(*program, cachePath);
+	return program;
+}
+
+std::string ShaderAssembler::getProgramCacheKey(const cl::Device& device) {
+	// 64 bit FNV-1a, a driver update or a different device changes the key just like an edited particle pack.
+	uint64_t hash = 14695981039346656037ull;
+	auto add = [&hash](const std::string& value) {
+		for(char c : value) {
+			hash ^= static_cast<unsigned char>(c);
+			hash *= 1099511628211ull;
+		}
+		hash ^= 0xFF;
+		hash *= 1099511628211ull;
+	};
+	add(code);
+	add(device.getInfo<CL_DEVICE_NAME>());
+	add(device.getInfo<CL_DEVICE_VENDOR>());
+	add(device.getInfo<CL_DEVICE_VERSION>());
+	add(device.getInfo<CL_DRIVER_VERSION>());
+
+	std::stringstream key;
+	key << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return key.str();
+}
+
+cl::Program* ShaderAssembler::loadCachedProgram(const cl::Context& context, const cl::Device& device, const std::string& path) {
+	std::ifstream stream = std::ifstream(path, std::ios::binary);
+	if(!stream.is_open()) return 0;
+	std::stringstream contents;
+	contents << stream.rdbuf();
+	const std::string binary = contents.str();
+	if(binary.empty()) return 0;
+
+	cl::Program::Binaries binaries(1, std::make_pair(binary.data(), binary.size()));
+	std::vector<cl_int> binaryStatus;
+	cl_int error;
+	cl::Program* program = new cl::Program(context, { device }, binaries, &binaryStatus, &error);
+	// Binaries still have to be built, a stale or corrupt one is dropped and the program is rebuilt from source.
+	if(error != CL_SUCCESS || binaryStatus.empty() || binaryStatus[0] != CL_SUCCESS || program->build() != CL_SUCCESS) {
+		spdlog::warn("Cached OpenCL program '" + path + "' could not be loaded, rebuilding it.");
+		delete program;
+		std::error_code removeError;
+		std::filesystem::remove(path, removeError);
+		return 0;
+	}
+	spdlog::info("Loaded cached OpenCL program '" + path + "'.");
 	return program;
 }
 
+void ShaderAssembler::storeCachedProgram(cl::Program& program, const std::string& path) {
+	// The context only holds a single device, so there is a single binary.
+	const std::vector<size_t> sizes = program.getInfo<CL_PROGRAM_BINARY_SIZES>();
+	if(sizes.size() != 1 || sizes[0] == 0) return;
+	std::vector<unsigned char> binary(sizes[0]);
+	unsigned char* binaryPtr = binary.data();
+	cl_int error = clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(binaryPtr), &binaryPtr, 0);
+	if(error != CL_SUCCESS) {
+		spdlog::error("OpenCL program binary read error: " + std::to_string(error));
+		return;
+	}
+
+	std::error_code fsError;
+	std::filesystem::create_directories(programCacheDirectory, fsError);
+	if(fsError) {
+		spdlog::error("Could not create the program cache directory '" + programCacheDirectory + "'.");
+		return;
+	}
+	// Written next to the target and renamed, so a crash never leaves a truncated binary behind.
+	const std::string tempPath = path + ".tmp";
+	std::ofstream stream = std::ofstream(tempPath, std::ios::binary);
+	if(!stream.is_open()) return;
+	stream.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+	stream.close();
+	// A full disk only shows up on the write or the flush, the partial binary must not replace a good one.
+	if(stream.fail()) {
+		spdlog::error("Could not write the cached OpenCL program '" + tempPath + "'.");
+		std::filesystem::remove(tempPath, fsError);
+		return;
+	}
+	std::filesystem::rename(tempPath, path, fsError);
+	if(fsError) std::filesystem::remove(tempPath, fsError);
+}
+
+void ShaderAssembler::setProgramCacheDirectory(const std::string& directory) {
+	programCacheDirectory = directory;
+}
+
+NativeProgram* ShaderAssembler::compile(NativeEngine& engine, const std::string& name) {
+	return engine.compile(code, name);
+}
+
 void ShaderAssembler::dump(std::ostream& stream) {
     stream << code;
 }
@@ -5,6 +5,8 @@
 
 #include <renderer/renderer.hpp>
 
+#include <cstring>
+
 using namespace unibox;
 using namespace vkb;
 
@@ -24,6 +26,10 @@ Engine::Engine() {
 
     lastPool = 0;
 
+    externalMemory = false;
+    getMemoryFd = 0;
+    multiDraw = false;
+
     instance = this;
 }
 
@@ -94,13 +100,14 @@ bool Engine::init(GLFWwindow* window) {
     }
 
     // Required device features.
-    VkPhysicalDeviceFeatures features;
+    VkPhysicalDeviceFeatures features = {};
     features.samplerAnisotropy = VK_TRUE;
 
     PhysicalDeviceSelector selector { vkb_instance };
     auto phys_ret = selector.set_surface(surface)
                             .set_minimum_version(1, 0)
                             .set_required_features(features)
+                            .add_desired_extension(VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME)
                             .select();
     if(!phys_ret) {
         spdlog::error("Could not select a physical device.");
@@ -109,6 +116,13 @@ bool Engine::init(GLFWwindow* window) {
     }
     
     vkb_physDevice = phys_ret.value();
+    // Optional, grids are drawn with one indirect call each without them.
+    VkPhysicalDeviceFeatures supported;
+    vkGetPhysicalDeviceFeatures(vkb_physDevice.physical_device, &supported);
+    multiDraw = supported.multiDrawIndirect == VK_TRUE && supported.drawIndirectFirstInstance == VK_TRUE;
+    vkb_physDevice.features.multiDrawIndirect = multiDraw ? VK_TRUE : VK_FALSE;
+    vkb_physDevice.features.drawIndirectFirstInstance = multiDraw ? VK_TRUE : VK_FALSE;
+
     DeviceBuilder devBuilder { vkb_physDevice };
     auto dev_ret = devBuilder.build();
     if(!dev_ret) {
@@ -161,6 +175,7 @@ bool Engine::init(GLFWwindow* window) {
     glfwGetWindowSize(window, reinterpret_cast<int*>(&width), reinterpret_cast<int*>(&height));
     
     if(!init_vma(vkb_physDevice.physical_device, device, vkb_instance.instance)) return false;
+    init_external_memory();
     if(!init_swapchain(width, height)) return false;
     if(!init_commands()) return false;
     if(!init_renderpass()) return false;
@@ -169,6 +184,47 @@ bool Engine::init(GLFWwindow* window) {
     return true;
 }
 
+void Engine::init_external_memory() {
+    // External memory itself is core in 1.1, only the file descriptor export is an extension.
+    if(vkb_physDevice.properties.apiVersion < VK_API_VERSION_1_1) return;
+    uint32_t count = 0;
+    vkEnumerateDeviceExtensionProperties(vkb_physDevice.physical_device, 0, &count, 0);
+    std::vector<VkExtensionProperties> extensions(count);
+    vkEnumerateDeviceExtensionProperties(vkb_physDevice.physical_device, 0, &count, extensions.data());
+    bool found = false;
+    for(auto& extension : extensions) if(strcmp(extension.extensionName, VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME) == 0) found = true;
+    if(!found) return;
+
+    getMemoryFd = reinterpret_cast<PFN_vkGetMemoryFdKHR>(vkGetDeviceProcAddr(device, "vkGetMemoryFdKHR"));
+    if(getMemoryFd == 0) return;
+
+    VkPhysicalDeviceIDProperties idProperties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES
+    };
+    VkPhysicalDeviceProperties2 properties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &idProperties
+    };
+    vkGetPhysicalDeviceProperties2(vkb_physDevice.physical_device, &properties);
+    memcpy(deviceUUID, idProperties.deviceUUID, VK_UUID_SIZE);
+    externalMemory = true;
+}
+
+int Engine::exportMemory(VkDeviceMemory memory) {
+    if(!externalMemory) return -1;
+    VkMemoryGetFdInfoKHR info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR,
+        .memory = memory,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT
+    };
+    int fd = -1;
+    if(getMemoryFd(device, &info, &fd) != VK_SUCCESS) {
+        spdlog::error("Could not export buffer memory.");
+        return -1;
+    }
+    return fd;
+}
+
 bool Engine::init_commands() {
     default_gfx_pool = new CommandPool(device, gfx_queue_index);
     default_comp_pool = new CommandPool(device, compute_queue_index);
@@ -0,0 +1,96 @@
+#include <vk-engine/external_buffer.hpp>
+
+#include <vk-engine/engine.hpp>
+
+#include <spdlog/spdlog.h>
+
+using namespace unibox;
+
+ExternalBuffer::ExternalBuffer(size_t size, VkBufferUsageFlags usage) {
+    this->handle = 0;
+    this->memory = 0;
+    this->size = size;
+    this->valid = false;
+
+    VkDevice device = Engine::getInstance()->getDevice();
+
+    VkExternalMemoryBufferCreateInfo externalInfo = {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT
+    };
+    VkBufferCreateInfo createInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = &externalInfo,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    if(vkCreateBuffer(device, &createInfo, 0, &handle) != VK_SUCCESS) {
+        spdlog::error("Could not create an external buffer.");
+        return;
+    }
+
+    VkMemoryRequirements requirements;
+    vkGetBufferMemoryRequirements(device, handle, &requirements);
+    VkPhysicalDeviceMemoryProperties properties;
+    vkGetPhysicalDeviceMemoryProperties(Engine::getInstance()->getPhysicalDevice(), &properties);
+    uint32_t memoryType = properties.memoryTypeCount;
+    for(uint32_t i = 0; i < properties.memoryTypeCount; i++) {
+        if((requirements.memoryTypeBits & (1 << i)) == 0) continue;
+        if((properties.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT) == 0) continue;
+        memoryType = i;
+        break;
+    }
+    if(memoryType == properties.memoryTypeCount) {
+        spdlog::error("No device local memory type for an external buffer.");
+        return;
+    }
+
+    VkMemoryDedicatedAllocateInfo dedicatedInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+        .buffer = handle
+    };
+    VkExportMemoryAllocateInfo exportInfo = {
+        .sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO,
+        .pNext = &dedicatedInfo,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT
+    };
+    VkMemoryAllocateInfo allocateInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = &exportInfo,
+        .allocationSize = requirements.size,
+        .memoryTypeIndex = memoryType
+    };
+    if(vkAllocateMemory(device, &allocateInfo, 0, &memory) != VK_SUCCESS) {
+        spdlog::error("Could not allocate external buffer memory.");
+        return;
+    }
+    if(vkBindBufferMemory(device, handle, memory, 0) != VK_SUCCESS) {
+        spdlog::error("Could not bind external buffer memory.");
+        return;
+    }
+    valid = true;
+}
+
+ExternalBuffer::~ExternalBuffer() {
+    VkDevice device = Engine::getInstance()->getDevice();
+    if(handle != 0) vkDestroyBuffer(device, handle, 0);
+    if(memory != 0) vkFreeMemory(device, memory, 0);
+}
+
+bool ExternalBuffer::isValid() {
+    return valid;
+}
+
+size_t ExternalBuffer::getSize() {
+    return size;
+}
+
+int ExternalBuffer::exportMemory() {
+    if(!valid) return -1;
+    return Engine::getInstance()->exportMemory(memory);
+}
+
+VkBuffer& ExternalBuffer::getHandle() {
+    return handle;
+}
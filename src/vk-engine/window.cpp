@@ -8,6 +8,7 @@ Window* Window::instance = 0;
 
 Window::Window() {
     window = 0;
+    inputReceived = true;
     instance = this;
 }
 
@@ -35,6 +36,9 @@ bool Window::init() {
         return false;
     }
     glfwSetMouseButtonCallback(window, mouseButtonCallback);
+    glfwSetKeyCallback(window, keyCallback);
+    glfwSetCursorPosCallback(window, cursorCallback);
+    glfwSetWindowRefreshCallback(window, refreshCallback);
 
     spdlog::info("Initializing render engine.");
     return engine.init(window);
@@ -56,6 +60,18 @@ void Window::frameStart() {
     glfwPollEvents();
 }
 
+void Window::waitEvents(double timeout) {
+    glfwWaitEventsTimeout(timeout);
+}
+
+void Window::wakeUp() {
+    glfwPostEmptyEvent();
+}
+
+bool Window::takeInput() {
+    return inputReceived.exchange(false);
+}
+
 void Window::render() {
     engine.draw();
 }
@@ -69,6 +85,7 @@ glm::vec2 Window::getCursorPos() {
 
 void Window::mouseButtonCallback(GLFWwindow* window, int button, int eventType, int other) {
     if(instance->window == window) {
+        instance->inputReceived = true;
         glm::vec2 mousePos = instance->getCursorPos();
         if(eventType == 1) {
             for(auto& call : instance->mouseDownCallbacks) {
@@ -82,6 +99,22 @@ void Window::mouseButtonCallback(GLFWwindow* window, int button, int eventType,
     }
 }
 
+void Window::keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+    if(instance->window == window && action == GLFW_PRESS) {
+        instance->inputReceived = true;
+        for(auto& call : instance->keyDownCallbacks) call(key, mods);
+    }
+}
+
+void Window::cursorCallback(GLFWwindow* window, double x, double y) {
+    // The GUI reacts to the cursor position on every frame.
+    if(instance->window == window) instance->inputReceived = true;
+}
+
+void Window::refreshCallback(GLFWwindow* window) {
+    if(instance->window == window) instance->inputReceived = true;
+}
+
 void Window::addMouseDownCallback(std::function<void(double, double, int)> callback) {
     this->mouseDownCallbacks.push_back(callback);
 }
@@ -89,3 +122,7 @@ void Window::addMouseDownCallback(std::function<void(double, double, int)> callb
 void Window::addMouseUpCallback(std::function<void(double, double, int)> callback) {
     this->mouseUpCallbacks.push_back(callback);
 }
+
+void Window::addKeyDownCallback(std::function<void(int, int)> callback) {
+    this->keyDownCallbacks.push_back(callback);
+}
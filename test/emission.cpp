@@ -0,0 +1,103 @@
+#include "test.hpp"
+
+#include <cl-engine/engine.hpp>
+#include <native-engine/engine.hpp>
+#include <simulator/particle.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <map>
+#include <tuple>
+
+using namespace unibox;
+
+static const uint worldSize = 64;
+static const uint ticks = 10;
+// Bricks are 32 cells wide. The open lamps sit in the top row of their brick and nothing else lives in the
+// bricks above them, so every one of their photons lands in a brick which has to be allocated for it.
+static const uint lampY = 31;
+static const uint openLamps[] = { 36, 44 };
+static const uint coveredLamp = 28;
+static const uint contestedLamp = 20;
+
+static Voxel createVoxel(ushort type, uint x, uint y) {
+    Voxel voxel = {};
+    voxel.type = type;
+    voxel.position[0] = x + 0.5f;
+    voxel.position[1] = y + 0.5f;
+    return voxel;
+}
+
+static bool checkScene(const std::string& backend, MoveResolution resolution) {
+    const ushort lamp = Particle::getParticleId("unibox:lamp");
+    const ushort photon = Particle::getParticleId("unibox:photon");
+    const ushort copper = Particle::getParticleId("unibox:copper");
+    const ushort sand = Particle::getParticleId("unibox:sand");
+    const std::string name = backend + (resolution == TWO_PHASE ? " two phase" : " single pass");
+
+    std::vector<Voxel> voxels;
+    for(uint x : openLamps) voxels.push_back(createVoxel(lamp, x, lampY));
+    voxels.push_back(createVoxel(lamp, coveredLamp, lampY));
+    voxels.push_back(createVoxel(copper, coveredLamp, lampY+1));
+    // Single pass moves don't claim their cells, only two phase ones can lose against an emission.
+    if(resolution == TWO_PHASE) {
+        voxels.push_back(createVoxel(lamp, contestedLamp, lampY));
+        // Walls on both sides keep the sand from sliding off the photon.
+        voxels.push_back(createVoxel(copper, contestedLamp-1, lampY+1));
+        voxels.push_back(createVoxel(copper, contestedLamp+1, lampY+1));
+        Voxel falling = createVoxel(sand, contestedLamp, lampY+2);
+        falling.velocity[1] = -1;
+        voxels.push_back(falling);
+    }
+    uint placed = 0;
+    const std::vector<Voxel> result = test::runScene(voxels, worldSize, worldSize, ticks, resolution, 256, &placed);
+
+    std::map<std::tuple<uint, uint>, ushort> cells;
+    for(auto& voxel : result) cells[{ (uint)voxel.position[0], (uint)voxel.position[1] }] = voxel.type;
+    bool passed = test::check(cells.size() == result.size(), name + ": " + std::to_string(result.size()-cells.size()) + " particles share a cell.");
+
+    // A photon leaves every other tick, the previous one still blocks the cell above the lamp in between.
+    // The one emitted in tick t has moved up by one cell in every tick after it.
+    const uint perLamp = (ticks+1)/2;
+    uint expected = voxels.size() + perLamp*(sizeof(openLamps)/sizeof(uint));
+    if(resolution == TWO_PHASE) expected++;
+    passed &= test::check(result.size() == expected, name + ": " + std::to_string(result.size()) + " particles instead of " + std::to_string(expected) + ".");
+    // Nothing dies in here, the host learns about the emitted particles from this count alone.
+    passed &= test::check(placed == result.size() - voxels.size(), name + ": " + std::to_string(placed) + " emissions counted as placed, " + std::to_string(result.size() - voxels.size()) + " were.");
+    for(uint x : openLamps) {
+        for(uint i = 0; i < perLamp; i++) {
+            const uint y = lampY+1 + (ticks-1 - i*2);
+            auto cell = cells.find({ x, y });
+            passed &= test::check(cell != cells.end() && cell->second == photon, name + ": no photon at " + std::to_string(x) + ", " + std::to_string(y) + ".");
+        }
+    }
+
+    uint covered = 0;
+    for(auto& [cell, type] : cells) if(std::get<0>(cell) == coveredLamp && type == photon) covered++;
+    passed &= test::check(covered == 0, name + ": the covered lamp emitted " + std::to_string(covered) + " photons.");
+
+    if(resolution == TWO_PHASE) {
+        // The photon claims the cell first, the sand stops on top of it and keeps the lamp covered from then on.
+        auto emitted = cells.find({ contestedLamp, lampY+1 });
+        auto blocked = cells.find({ contestedLamp, lampY+2 });
+        passed &= test::check(emitted != cells.end() && emitted->second == photon, name + ": the emission lost its cell to a move.");
+        passed &= test::check(blocked != cells.end() && blocked->second == sand, name + ": the sand isn't resting on the emitted photon.");
+    }
+    return passed;
+}
+
+int test::emission() {
+    bool passed = true;
+    {
+        NativeEngine nativeEngine = NativeEngine();
+        passed &= checkScene("native", TWO_PHASE);
+        passed &= checkScene("native", SINGLE_PASS);
+    }
+
+    ClEngine clEngine = ClEngine(CL_DEVICE_TYPE_ALL);
+    if(ClEngine::getInstance() != 0) {
+        passed &= checkScene("OpenCL", TWO_PHASE);
+        passed &= checkScene("OpenCL", SINGLE_PASS);
+    } else spdlog::warn("No OpenCL device, emission is only tested on the native backend.");
+    return passed ? 0 : 1;
+}
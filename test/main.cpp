@@ -0,0 +1,84 @@
+#include "test.hpp"
+
+#include <simulator/particle.hpp>
+#include <compute/simulator.hpp>
+#include <compute/meshgen.hpp>
+#include <util/finalizer.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <cstdio>
+#include <cstring>
+#include <map>
+
+using namespace unibox;
+
+bool test::check(bool condition, const std::string& message) {
+    if(!condition) spdlog::error(message);
+    return condition;
+}
+
+std::vector<Voxel> test::runScene(const std::vector<Voxel>& voxels, uint sizeX, uint sizeY, uint ticks, MoveResolution resolution, uint freeSlots, uint* emitPlaced) {
+    Simulator simulator = Simulator();
+    if(!simulator.createSimulationShader()) return {};
+    simulator.createSimulationInformation();
+    MeshGenPipeline meshGenerator = MeshGenPipeline();
+    meshGenerator.createMeshGenerationShader();
+    meshGenerator.createMeshGenerationInformation();
+
+    const GridInfo info = GridInfo::create(sizeX, sizeY, 1);
+    GridPipeline* pipeline = GridPipeline::create(simulator, meshGenerator, info);
+    const uint capacity = voxels.size() + freeSlots;
+    if(!pipeline->resize(capacity, 0)) {
+        delete pipeline;
+        return {};
+    }
+    pipeline->setMoveResolution(resolution);
+    for(size_t i = 0; i < voxels.size(); i++) packVoxel(voxels[i], pipeline->getParticles()[i], pipeline->getParticleData()[i]);
+    pipeline->setEmitBase(voxels.size());
+    pipeline->reserveBricks(info.getBrickCount());
+    pipeline->releaseParticles();
+
+    bool simulated = true;
+    for(uint i = 0; i < ticks && simulated; i++) simulated = pipeline->simulate(capacity);
+    pipeline->acquireParticles();
+    pipeline->waitParticles();
+    if(emitPlaced != 0) *emitPlaced = pipeline->getEmitPlaced();
+
+    std::vector<Voxel> result;
+    if(simulated) {
+        for(uint i = 0; i < capacity; i++) {
+            if(pipeline->getParticles()[i].type != 0) result.push_back(unpackVoxel(pipeline->getParticles()[i], pipeline->getParticleData()[i]));
+        }
+    }
+    delete pipeline;
+    return result;
+}
+
+// unibox-test [test...], run from a directory holding the particles and shaders like unibox.
+int main(int argc, char** argv) {
+    const std::map<std::string, int (*)()> tests = {
+        { "backends", test::backends },
+        { "emission", test::emission },
+        { "reference", test::reference }
+    };
+
+    Finalizer* finalizer = new Finalizer();
+    Particle::loadParticles();
+    int result = 0;
+    uint skipped = 0, run = 0;
+    for(auto& [name, function] : tests) {
+        bool enabled = argc < 2;
+        for(int i = 1; i < argc; i++) if(name == argv[i]) enabled = true;
+        if(!enabled) continue;
+
+        run++;
+        const int status = function();
+        printf("%-16s %s\n", name.c_str(), status == 0 ? "passed" : status == test::SKIPPED ? "skipped" : "failed");
+        if(status == test::SKIPPED) skipped++;
+        else if(status != 0) result = 1;
+    }
+    delete finalizer;
+    if(result == 0 && run > 0 && skipped == run) return test::SKIPPED;
+    return result;
+}
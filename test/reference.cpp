@@ -0,0 +1,264 @@
+#include "test.hpp"
+
+#include <native-engine/engine.hpp>
+#include <simulator/particle.hpp>
+
+#include <spdlog/spdlog.h>
+
+#include <vector>
+#include <random>
+#include <limits>
+#include <algorithm>
+
+using namespace unibox;
+
+// Serial host version of a two phase tick in a flat world holding nothing but sand, written after the kernels
+// in simulator.cl and unibox_sand_update. It keeps the parts of the pipeline which decide where particles end
+// up: the grid as of the start of the tick, chunk sleep, claims won by the lowest slot and the position packing.
+static const uint SLEEP_TICKS = 2;
+static const uint BRICK_SHIFT = 5;
+
+struct World {
+    uint sizeX;
+    uint sizeY;
+    uint bricksX;
+    std::vector<Voxel> particles;
+    // Slot+1 of the particle in every cell as of the start of the tick, 0 if empty.
+    std::vector<uint> cells;
+    std::vector<uint> activity;
+    uint tick;
+};
+
+// Plain casts to an unsigned type clamp on the native backend, see NativeCast in opencl.hpp.
+static uint toUint(float value) {
+    if(!(value > 0)) return 0;
+    if(value >= (float)std::numeric_limits<uint>::max()) return std::numeric_limits<uint>::max();
+    return (uint)value;
+}
+
+// Positions are stored as a cell and a fraction of 1/65536, like storeParticle does.
+static void storePosition(Voxel& voxel) {
+    for(int i = 0; i < 3; i++) {
+        const uint cell = toUint(voxel.position[i]);
+        const ushort fraction = (ushort)std::clamp((voxel.position[i]-cell)*65536.0f, 0.0f, 65535.0f);
+        voxel.position[i] = cell + fraction/65536.0f;
+    }
+}
+
+static bool checkBounds(const World& world, int x, int y, int z) {
+    return x >= 0 && x < world.sizeX && y >= 0 && y < world.sizeY && z == 0;
+}
+
+static bool isEmpty(const World& world, uint x, uint y) {
+    return world.cells[x + y*world.sizeX] == 0;
+}
+
+static uint getBrick(const World& world, uint x, uint y) {
+    return (x >> BRICK_SHIFT) + (y >> BRICK_SHIFT)*world.bricksX;
+}
+
+static void wakeCell(World& world, uint x, uint y) {
+    for(int dy = -1; dy <= 1; dy++) {
+        for(int dx = -1; dx <= 1; dx++) {
+            const int nx = (int)x+dx;
+            const int ny = (int)y+dy;
+            if(checkBounds(world, nx, ny, 0)) world.activity[getBrick(world, nx, ny)] = world.tick;
+        }
+    }
+}
+
+static void updateSand(const World& world, Voxel& vertex) {
+    const float xStart = vertex.position[0];
+    const float yStart = vertex.position[1];
+    const float zStart = vertex.position[2];
+
+    const uint stepCountX = toUint(vertex.position[0]+vertex.velocity[0]-toUint(vertex.position[0]));
+    const uint stepCountY = toUint(vertex.position[1]+vertex.velocity[1]-toUint(vertex.position[1]));
+    const uint stepCountZ = toUint(vertex.position[2]+vertex.velocity[2]-toUint(vertex.position[2]));
+    uint stepCount = std::max(stepCountX, std::max(stepCountY, stepCountZ));
+    if(stepCount <= 0) stepCount = 1;
+
+    const float stepX = vertex.velocity[0]/stepCount;
+    const float stepY = vertex.velocity[1]/stepCount;
+    const float stepZ = vertex.velocity[2]/stepCount;
+
+    for(int i = 0; i < stepCount; i++) {
+        const float newX = vertex.position[0]+stepX;
+        const float newY = vertex.position[1]+stepY;
+        const float newZ = vertex.position[2]+stepZ;
+        if((int)newX == (int)vertex.position[0] && (int)newY == (int)vertex.position[1] && (int)newZ == (int)vertex.position[2]) {
+            vertex.position[0] = newX;
+            vertex.position[1] = newY;
+            vertex.position[2] = newZ;
+            continue;
+        }
+
+        if(checkBounds(world, (int)newX, (int)newY, (int)newZ)) {
+            if(isEmpty(world, toUint(newX), toUint(newY))) {
+                vertex.position[0] = newX;
+                vertex.position[1] = newY;
+                vertex.position[2] = newZ;
+                continue;
+            }
+            const float newNewXp = newX+stepY;
+            const float newNewYp = newY-stepX;
+            if((int)newNewXp != (int)newX || (int)newNewYp != (int)newY) {
+                if(checkBounds(world, (int)newNewXp, (int)newNewYp, (int)newZ) && isEmpty(world, toUint(newNewXp), toUint(newNewYp))) {
+                    vertex.position[0] = newNewXp;
+                    vertex.position[1] = newNewYp;
+                    vertex.position[2] = newZ;
+                    continue;
+                }
+            }
+            const float newNewXn = newX-stepY;
+            const float newNewYn = newY+stepX;
+            if((int)newNewXn != (int)newX || (int)newNewYn != (int)newY) {
+                if(checkBounds(world, (int)newNewXn, (int)newNewYn, (int)newZ) && isEmpty(world, toUint(newNewXn), toUint(newNewYn))) {
+                    vertex.position[0] = newNewXn;
+                    vertex.position[1] = newNewYn;
+                    vertex.position[2] = newZ;
+                    continue;
+                }
+            }
+        }
+    }
+
+    if(vertex.position[0] == xStart && vertex.position[1] == yStart && vertex.position[2] == zStart &&
+      (vertex.velocity[0] != 0 || vertex.velocity[1] != 0 || vertex.velocity[2] != 0))
+        vertex.state |= 0x01;
+    else vertex.state &= 0xFFFFFFFE;
+
+    if((vertex.state & 0x01) != 0) {
+        vertex.velocity[0] *= 0.9;
+        vertex.velocity[1] *= 0.9;
+        vertex.velocity[2] *= 0.9;
+    }
+}
+
+static bool cellChanged(const Voxel& before, const Voxel& after) {
+    if(before.state != after.state) return true;
+    for(int i = 0; i < 3; i++) if(toUint(before.position[i]) != toUint(after.position[i])) return true;
+    return false;
+}
+
+static bool voxelMoved(const Voxel& before, const Voxel& after) {
+    for(int i = 0; i < 3; i++) if(before.velocity[i] != after.velocity[i] || before.position[i] != after.position[i]) return true;
+    return false;
+}
+
+static void simulateTick(World& world) {
+    std::fill(world.cells.begin(), world.cells.end(), 0);
+    for(uint i = 0; i < world.particles.size(); i++) {
+        const Voxel& voxel = world.particles[i];
+        world.cells[toUint(voxel.position[0]) + toUint(voxel.position[1])*world.sizeX] = i+1;
+    }
+    // Chunks are woken while the tick runs, the work list only sees the activity from before it.
+    std::vector<uint> work;
+    for(uint i = 0; i < world.particles.size(); i++) {
+        const Voxel& voxel = world.particles[i];
+        if(world.tick - world.activity[getBrick(world, toUint(voxel.position[0]), toUint(voxel.position[1]))] <= SLEEP_TICKS) work.push_back(i);
+    }
+
+    std::vector<bool> intent(world.particles.size(), false);
+    std::vector<Voxel> targets(world.particles.size());
+    for(uint i : work) {
+        const Voxel start = world.particles[i];
+        Voxel particle = start;
+        updateSand(world, particle);
+        if(cellChanged(start, particle)) wakeCell(world, toUint(start.position[0]), toUint(start.position[1]));
+        if(toUint(particle.position[0]) != toUint(start.position[0]) || toUint(particle.position[1]) != toUint(start.position[1])) {
+            if(checkBounds(world, (int)particle.position[0], (int)particle.position[1], (int)particle.position[2]) &&
+               isEmpty(world, toUint(particle.position[0]), toUint(particle.position[1]))) {
+                intent[i] = true;
+                targets[i] = particle;
+            }
+            for(int j = 0; j < 3; j++) particle.position[j] = start.position[j];
+        }
+        if(cellChanged(start, particle) || voxelMoved(start, particle)) {
+            storePosition(particle);
+            world.particles[i] = particle;
+        }
+    }
+
+    // The lowest slot wants the cell first.
+    std::vector<uint> claims(world.cells.size(), 0);
+    for(uint i : work) {
+        if(!intent[i]) continue;
+        uint& claim = claims[toUint(targets[i].position[0]) + toUint(targets[i].position[1])*world.sizeX];
+        if(claim == 0 || i+1 < claim) claim = i+1;
+    }
+    for(uint i : work) {
+        if(!intent[i] || claims[toUint(targets[i].position[0]) + toUint(targets[i].position[1])*world.sizeX] != i+1) continue;
+        Voxel& particle = world.particles[i];
+        for(int j = 0; j < 3; j++) particle.position[j] = targets[i].position[j];
+        storePosition(particle);
+        wakeCell(world, toUint(particle.position[0]), toUint(particle.position[1]));
+    }
+    world.tick++;
+}
+
+int test::reference() {
+    const uint worldSize = 64;
+    const uint ticks = 150;
+    const ushort sand = Particle::getParticleId("unibox:sand");
+
+    // Sand scattered over the top half, part of it thrown sideways so the diagonal moves and the decay of
+    // stuck particles are covered as well. Chunks at the bottom fall asleep while the upper ones still fall.
+    std::vector<uint> cells(worldSize*worldSize/2);
+    for(uint i = 0; i < cells.size(); i++) cells[i] = i;
+    std::mt19937 random(worldSize);
+    std::shuffle(cells.begin(), cells.end(), random);
+    std::vector<Voxel> voxels;
+    for(uint i = 0; i < cells.size()/2; i++) {
+        Voxel voxel = {};
+        voxel.type = sand;
+        voxel.velocity[0] = (float(random() % 5) - 2.0f)*0.25f;
+        voxel.velocity[1] = -1;
+        voxel.position[0] = cells[i]%worldSize + 0.5f;
+        voxel.position[1] = worldSize/2 + cells[i]/worldSize + 0.5f;
+        voxels.push_back(voxel);
+    }
+
+    World world;
+    world.sizeX = worldSize;
+    world.sizeY = worldSize;
+    world.bricksX = (worldSize + (1 << BRICK_SHIFT) - 1) >> BRICK_SHIFT;
+    world.particles = voxels;
+    for(auto& voxel : world.particles) storePosition(voxel);
+    world.cells = std::vector<uint>(worldSize*worldSize);
+    // Every chunk starts awake at tick 1, like on the device.
+    world.activity = std::vector<uint>(world.bricksX*world.bricksX, 0);
+    world.tick = 1;
+    for(uint i = 0; i < ticks; i++) simulateTick(world);
+
+    std::vector<Voxel> nativeResult;
+    {
+        NativeEngine nativeEngine = NativeEngine();
+        if(NativeEngine::getInstance() == 0) {
+            spdlog::warn("The native backend isn't available, there is nothing to compare the reference with.");
+            return SKIPPED;
+        }
+        nativeResult = runScene(voxels, worldSize, worldSize, ticks, TWO_PHASE);
+    }
+
+    // Nothing dies and nothing is compacted, so the slots line up.
+    bool passed = check(nativeResult.size() == voxels.size(), "Native lost particles: " + std::to_string(nativeResult.size()) + " of " + std::to_string(voxels.size()));
+    if(!passed) return 1;
+    uint mismatches = 0;
+    for(uint i = 0; i < voxels.size(); i++) {
+        const Voxel& expected = world.particles[i];
+        const Voxel& actual = nativeResult[i];
+        bool equal = actual.type == expected.type && actual.state == expected.state;
+        for(int j = 0; j < 3; j++) equal &= actual.position[j] == expected.position[j] && actual.velocity[j] == expected.velocity[j];
+        if(!equal && mismatches++ < 4) {
+            spdlog::error("Slot " + std::to_string(i) + " is at " + std::to_string(actual.position[0]) + ", " + std::to_string(actual.position[1]) +
+                " instead of " + std::to_string(expected.position[0]) + ", " + std::to_string(expected.position[1]) + ".");
+        }
+    }
+    passed &= check(mismatches == 0, std::to_string(mismatches) + " particles differ between the native backend and the reference.");
+    // The sand has to have moved at all for the comparison to mean anything.
+    uint moved = 0;
+    for(uint i = 0; i < voxels.size(); i++) if(toUint(voxels[i].position[1]) != toUint(world.particles[i].position[1])) moved++;
+    passed &= check(moved > 0, "The sand didn't move.");
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <simulator/voxel.hpp>
+#include <compute/grid_pipeline.hpp>
+
+namespace unibox::test {
+    // ctest treats this exit code as a skipped test.
+    static constexpr int SKIPPED = 77;
+
+    // Logs the message if the condition doesn't hold.
+    bool check(bool condition, const std::string& message);
+
+    // Runs the voxels for the given amount of ticks in a sizeX by sizeY grid on whichever backend is running and
+    // returns every live particle afterwards. Slots past the voxels are left free for emitted particles,
+    // the amount of them which got a cell is stored in emitPlaced if it is set.
+    std::vector<Voxel> runScene(const std::vector<Voxel>& voxels, uint sizeX, uint sizeY, uint ticks, MoveResolution resolution, uint freeSlots = 256, uint* emitPlaced = 0);
+
+    // Tests, they return 0 on success and SKIPPED if the machine can't run them.
+    int backends();
+    int emission();
+    int reference();
+}